@@ -27,11 +27,13 @@
 #include "drivers/audio.h"
 #include "drivers/southbridge.h"
 #include "drivers/serial.h"
+#include "drivers/trace.h"
 
 bool power_off_requested = false;
 volatile bool user_interrupt = false ;
 volatile int user_keyavail = 0 ;
 volatile bool user_freeze = false ;
+volatile bool user_hibernate = false ; // F10, see snapshot.h
 
 fat32_file_t fat_dir;
 char fat_dir_fullpath[6] ;
@@ -81,34 +83,331 @@ uint8 sd_mkdir_filename(const char *dirname)
     return 0 ;
 }
 
-uint8 _sys_exists(uint8 *filename) {
+// Copies the file at path from to path to with fat32.c, size bytes at a time
+// through buffer. A copy that fails half way is deleted
+fat32_error_t _sys_copypath(const char *from, const char *to, uint8 *buffer, uint32 size) {
+    fat32_file_t source, dest;
+    fat32_error_t result;
+    size_t bytesread = 0, written;
+
+    result = fat32_open(&source, from);
+    if (result != FAT32_OK)
+        return (result);
+    remove(to);
+    result = fat32_create(&dest, to);
+    if (result == FAT32_OK) {
+        fat32_reserve(&dest, fat32_size(&source)); // In one piece
+        do {
+            result = fat32_read(&source, buffer, size, &bytesread);
+            if (result == FAT32_OK && bytesread)
+                result = fat32_write(&dest, buffer, bytesread, &written);
+        } while (result == FAT32_OK && bytesread == size);
+        fat32_close(&dest);
+        if (result != FAT32_OK)
+            remove(to);
+    }
+    fat32_close(&source);
+    return (result);
+}
+
+#define PATH_READ 0     // The file as it is seen
+#define PATH_WRITE 1    // The file is written afresh
+#define PATH_UPDATE 2   // The file is changed, its contents are kept
+
+#ifdef OVERLAY
+/* Overlay mode
+
+   With the overlay on, the files of the drives are left as they are on the
+   card. A file that is written goes to the same path under OVLROOT, copied
+   there first when it is changed in place, and deleting a file of a drive
+   leaves a whiteout, an empty file of the same path under OVLGONE. A file is
+   looked up in the overlay, then on the drive unless it has a whiteout, and
+   _findnext lists the overlay and then the files of the drive it does not
+   hide. OVERLAY DISCARD drops the overlay, OVERLAY COMMIT writes it to the
+   drives. The overlay stays on the card, OVERLAY ON after a reboot carries on
+   with it. Files outside the drives (CLOCK.CFG, SNAPSHOT.SYS) are not overlaid.
+*/
+#define OVLROOT "/OVERLAY"
+#define OVLGONE "/OVERLAY/DELETED"
+
+static uint8 overlayOn = FALSE;
+
+// Whether filename is a file of a drive, d/u/NAME
+uint8 _ovl_isdrive(uint8 *filename) {
+    return (filename[0] && filename[1] == FOLDERCHAR && filename[2] && filename[3] == FOLDERCHAR);
+}
+
+// Makes the directories on the way to the file at path
+void _ovl_mkdirs(const char *path) {
+    char dir[128];
+
+    for (uint8 i = 1; path[i] && i < sizeof(dir); ++i) {
+        if (path[i] == FOLDERCHAR) {
+            memcpy(dir, path, i);
+            dir[i] = 0;
+            if (access(dir, F_OK))
+                sd_mkdir_filename(dir);
+        }
+    }
+}
+
+// Whether the file of a drive has a whiteout
+uint8 _ovl_gone(uint8 *filename) {
+    uint8 path[128] = OVLGONE "/";
+
+    strcat((char *)path, (char *)filename);
+    return (!access((char *)path, F_OK));
+}
+
+// Whether the file of a drive is hidden by the overlay, by a file or a whiteout
+uint8 _ovl_hidden(uint8 *filename) {
+    uint8 path[128] = OVLROOT "/";
 
+    strcat((char *)path, (char *)filename);
+    return (!access((char *)path, F_OK) || _ovl_gone(filename));
+}
+
+// Puts in path where the file of a drive is in the overlay for mode, copying
+// it there for PATH_UPDATE. FALSE when it was deleted, for PATH_READ, or the
+// copy failed. fullpath is the file on the drive
+uint8 _ovl_path(uint8 *filename, uint8 *fullpath, uint8 *path, uint8 mode) {
+    uint8 buffer[BlkSZ];   // Once per file, a record at a time spares the stack
+    uint8 gone;
+
+    strcpy((char *)path, OVLROOT "/");
+    strcat((char *)path, (char *)filename);
+    if (!access((char *)path, F_OK))
+        return (TRUE);
+    gone = _ovl_gone(filename);
+    if (mode == PATH_READ) {
+        strcpy((char *)path, (char *)fullpath);
+        return (!gone);
+    }
+    _ovl_mkdirs((char *)path);
+    if (mode == PATH_UPDATE && !gone && !access((char *)fullpath, F_OK))
+        return (_sys_copypath((char *)fullpath, (char *)path, buffer, sizeof(buffer)) == FAT32_OK);
+    return (TRUE);
+}
+
+// Deletes the file of a drive from the overlay, and hides it on the drive with a whiteout
+int _ovl_remove(uint8 *filename) {
+    uint8 path[128] = OVLROOT "/";
+    uint8 gone[128] = OVLGONE "/";
     uint8 fullpath[128] = FILEBASE;
+    int result;
+    FILE *file;
+
+    strcat((char *)path, (char *)filename);
+    strcat((char *)gone, (char *)filename);
     strcat((char *)fullpath, (char *)filename);
-    return (!access((const char *)fullpath, F_OK));
+    result = remove((char *)path);
+    if (!access((char *)fullpath, F_OK) && access((char *)gone, F_OK)) {
+        _ovl_mkdirs((char *)gone);
+        file = fopen((char *)gone, "wb");
+        if (file != NULL)
+            fclose(file);
+        result = (file != NULL) ? 0 : -1;
+    }
+    return (result);
 }
 
-FILE *_sys_fopen_r(uint8 *filename) {
-    uint8 fullpath[128] = FILEBASE;
+// Renames a file of a drive in the overlay. One still on the drive is copied
+// to the new name, and its old name gets a whiteout
+int _ovl_rename(uint8 *name1, uint8 *name2) {
+    uint8 fullpath1[128] = FILEBASE, path1[128];
+    uint8 fullpath2[128] = FILEBASE, path2[128];
+    uint8 buffer[BlkSZ];
+    int result;
+
+    strcat((char *)fullpath1, (char *)name1);
+    strcat((char *)fullpath2, (char *)name2);
+    if (!_ovl_path(name1, fullpath1, path1, PATH_READ) || !_ovl_path(name2, fullpath2, path2, PATH_WRITE))
+        return (-1);
+    if (strcmp((char *)path1, (char *)fullpath1))
+        result = rename((char *)path1, (char *)path2);
+    else
+        result = (_sys_copypath((char *)path1, (char *)path2, buffer, sizeof(buffer)) == FAT32_OK) ? 0 : -1;
+    if (!result)
+        _ovl_remove(name1);
+    return (result);
+}
+
+// Empties the overlay directory at path, and its subdirectories. With commit
+// set its files are applied to the drives first: a whiteout deletes, another
+// file replaces. Returns the number of files, -1 on an error, which leaves the
+// rest of the overlay for another try
+int _ovl_drain(const char *path, uint8 commit, uint8 *buffer, uint32 size) {
+    fat32_file_t dir;
+    fat32_entry_t entry;
+    char child[128], target[128];
+    uint8 gone = !strncmp(path, OVLGONE, strlen(OVLGONE));
+    int files = 0, done;
+
+    // The first entry each time round, the directory changes as it is emptied
+    while (fat32_open(&dir, path) == FAT32_OK) {
+        do {
+            if (fat32_dir_read(&dir, &entry) != FAT32_OK)
+                entry.filename[0] = 0;
+        } while (entry.filename[0] == '.');
+        fat32_close(&dir);
+        if (!entry.filename[0])
+            break;
+        if (strlen(path) + strlen(entry.filename) + 2 > sizeof(child))
+            return (-1);
+        strcpy(child, path);
+        strcat(child, "/");
+        strcat(child, entry.filename);
+        if (entry.attr & FAT32_ATTR_DIRECTORY) {
+            done = _ovl_drain(child, commit, buffer, size);
+            if (done < 0)
+                return (-1);
+            files += done;
+        } else {
+            if (commit) {
+                strcpy(target, FILEBASE);
+                strcat(target, child + strlen(gone ? OVLGONE "/" : OVLROOT "/"));
+                if (gone) {
+                    remove(target);
+                } else {
+                    _ovl_mkdirs(target);
+                    if (_sys_copypath(child, target, buffer, size) != FAT32_OK)
+                        return (-1);
+                }
+            }
+            ++files;
+        }
+        if (fat32_delete(child) != FAT32_OK)
+            return (-1);
+    }
+    return (files);
+}
+
+// Empties the overlay, writing it to the drives first when commit is set.
+// Returns the number of files, -1 on an error
+int _ovl_end(uint8 commit, uint8 *buffer, uint32 size) {
+    int gone, files;
+
+    ++fileChanges;
+    // The whiteouts first, a file written again after it was deleted is in both
+    gone = _ovl_drain(OVLGONE, commit, buffer, size);
+    if (gone < 0)
+        return (-1);
+    fat32_delete(OVLGONE);
+    files = _ovl_drain(OVLROOT, commit, buffer, size);
+    if (files < 0)
+        return (-1);
+    fat32_delete(OVLROOT);
+    return (gone + files);
+}
+#endif
+
+#ifdef ROMDISK
+#include "drivers/romdisk.h"
+
+static uint8 findInRom = FALSE;     // _findnext lists the flash drive
+static uint16 romFindNext = 0;      // Its next file
+
+// Whether a host name is on the flash drive, which hides the folder of that drive
+uint8 _rom_isdrive(uint8 *filename) {
+    return (filename[0] == ROMDISK && filename[1] == FOLDERCHAR);
+}
+
+// The file of the flash drive that a host name is, NULL if there is no such
+// file. The files are in every user area
+const romdisk_file_t *_rom_file(uint8 *filename) {
+    int lo = 0, hi = romdisk_count - 1, mid, cmp;
+
+    if (!_rom_isdrive(filename) || !filename[2] || filename[3] != FOLDERCHAR)
+        return (NULL);
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        cmp = strcmp((char *)filename + 4, romdisk_files[mid].name);
+        if (!cmp)
+            return (&romdisk_files[mid]);
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return (NULL);
+}
+
+// Reads the record at fpos of a file of the flash drive to the DMA. The
+// records are padded with ^Z in flash, it is a single copy
+uint8 _rom_read(const romdisk_file_t *file, long fpos) {
+    if (fpos < 0 || fpos >= file->size)
+        return (0x01);
+    memcpy(_RamSysAddr(dmaAddr), romdisk_data + file->offset + fpos, BlkSZ);
+    return (0x00);
+}
+#endif
+
+// Puts in fullpath where filename is on the card, to be opened for mode.
+// FALSE when there is no such file or it can't be written there
+uint8 _sys_path(uint8 *filename, uint8 *fullpath, uint8 mode) {
+    strcpy((char *)fullpath, FILEBASE);
     strcat((char *)fullpath, (char *)filename);
+#ifdef ROMDISK
+    if (_rom_isdrive(filename))
+        return (FALSE); // Not on the card, see _rom_file
+#endif
+#ifdef OVERLAY
+    if (overlayOn && _ovl_isdrive(filename)) {
+        uint8 path[128];
+        uint8 result = _ovl_path(filename, fullpath, path, mode);
+        strcpy((char *)fullpath, (char *)path);
+        return (result);
+    }
+#endif
+    return (TRUE);
+}
+
+// Whether a file found on a drive is hidden by the overlay
+uint8 _sys_hidden(uint8 *filename) {
+#ifdef OVERLAY
+    return (overlayOn && _ovl_hidden(filename));
+#else
+    return (FALSE);
+#endif
+}
+
+uint8 _sys_exists(uint8 *filename) {
+    uint8 fullpath[128];
+#ifdef ROMDISK
+    if (_rom_isdrive(filename))
+        return (_rom_file(filename) != NULL);
+#endif
+
+    return (_sys_path(filename, fullpath, PATH_READ) && !access((const char *)fullpath, F_OK));
+}
+
+FILE *_sys_fopen_r(uint8 *filename) {
+    uint8 fullpath[128];
+    if (!_sys_path(filename, fullpath, PATH_READ))
+        return (NULL);
     return (fopen((const char *)fullpath, "rb"));
 }
 
 FILE *_sys_fopen_w(uint8 *filename) {
-    uint8 fullpath[128] = FILEBASE;
-    strcat((char *)fullpath, (char *)filename);
+    uint8 fullpath[128];
+    ++fileChanges;
+    if (!_sys_path(filename, fullpath, PATH_WRITE))
+        return (NULL);
     return (fopen((const char *)fullpath, "wb"));
 }
 
 FILE *_sys_fopen_rw(uint8 *filename) {
-    uint8 fullpath[128] = FILEBASE;
-    strcat((char *)fullpath, (char *)filename);
+    uint8 fullpath[128];
+    if (!_sys_path(filename, fullpath, PATH_UPDATE))
+        return (NULL);
     return (fopen((const char *)fullpath, "r+b"));
 }
 
 FILE *_sys_fopen_a(uint8 *filename) {
-    uint8 fullpath[128] = FILEBASE;
-    strcat((char *)fullpath, (char *)filename);
+    uint8 fullpath[128];
+    ++fileChanges;
+    if (!_sys_path(filename, fullpath, PATH_UPDATE))
+        return (NULL);
     return (fopen((const char *)fullpath, "a"));
 }
 
@@ -146,11 +445,29 @@ int _sys_fclose(FILE *file) {
 
 int _sys_remove(uint8 *filename) {
     uint8 fullpath[128] = FILEBASE;
+#ifdef ROMDISK
+    if (_rom_isdrive(filename))
+        return (-1);
+#endif
+    ++fileChanges;
+#ifdef OVERLAY
+    if (overlayOn && _ovl_isdrive(filename))
+        return (_ovl_remove(filename));
+#endif
     strcat((char *)fullpath, (char *)filename);
     return (remove((const char *)fullpath));
 }
 
 int _sys_rename(uint8 *name1, uint8 *name2) {
+#ifdef ROMDISK
+    if (_rom_isdrive(name1))
+        return (-1);
+#endif
+    ++fileChanges;
+#ifdef OVERLAY
+    if (overlayOn && _ovl_isdrive(name1))
+        return (_ovl_rename(name1, name2));
+#endif
     uint8 fullpath1[128] = FILEBASE;
     strcat((char *)fullpath1, (char *)name1);
     uint8 fullpath2[128] = FILEBASE;
@@ -161,12 +478,21 @@ int _sys_rename(uint8 *name1, uint8 *name2) {
 int _sys_select(uint8 *disk) {
     struct stat st;
     uint8 fullpath[128] = FILEBASE;
+#ifdef ROMDISK
+    if (disk[0] == ROMDISK)
+        return (TRUE);
+#endif
     strcat((char *)fullpath, (char *)disk);
     return ((stat((char *)fullpath, &st) == 0) && S_ISDIR(st.st_mode));
 }
 
 long _sys_filesize(uint8 *filename) {
     long l = -1;
+#ifdef ROMDISK
+    const romdisk_file_t *rom = _rom_file(filename);
+    if (rom)
+        return (rom->size);
+#endif
     FILE *file = _sys_fopen_r(filename);
     if (file != NULL) {
         _sys_fseek(file, 0, SEEK_END) ;
@@ -177,6 +503,10 @@ long _sys_filesize(uint8 *filename) {
 }
 
 int _sys_openfile(uint8 *filename) {
+#ifdef ROMDISK
+    if (_rom_isdrive(filename))
+        return (_rom_file(filename) != NULL);
+#endif
     FILE *file = _sys_fopen_r(filename);
     if (file != NULL)
         _sys_fclose(file);
@@ -198,6 +528,49 @@ int _sys_renamefile(uint8 *filename, uint8 *newname) {
     return (!_sys_rename(&filename[0], &newname[0]));
 }
 
+// Opens a file with fat32.c, to be read in large blocks with fat32_read
+// instead of 128 byte records through a FILE
+fat32_error_t _sys_fopen_stream(fat32_file_t *file, uint8 *filename) {
+    uint8 fullpath[128];
+    if (!_sys_path(filename, fullpath, PATH_READ))
+        return (FAT32_ERROR_FILE_NOT_FOUND);
+    return (fat32_open(file, (char *)fullpath));
+}
+
+// Copies a file with fat32.c, size bytes at a time through buffer
+fat32_error_t _sys_copyfile(uint8 *from, uint8 *to, uint8 *buffer, uint32 size) {
+    uint8 frompath[128], topath[128];
+
+#ifdef ROMDISK
+    const romdisk_file_t *rom = _rom_file(from);
+    fat32_file_t dest;
+    fat32_error_t result;
+    size_t written;
+
+    if (rom) { // Written straight from flash
+        ++fileChanges;
+        if (!_sys_path(to, topath, PATH_WRITE))
+            return (FAT32_ERROR_WRITE_FAILED);
+        remove((char *)topath);
+        result = fat32_create(&dest, (char *)topath);
+        if (result == FAT32_OK) {
+            fat32_reserve(&dest, rom->size);
+            result = fat32_write(&dest, romdisk_data + rom->offset, rom->size, &written);
+            fat32_close(&dest);
+            if (result != FAT32_OK)
+                remove((char *)topath);
+        }
+        return (result);
+    }
+#endif
+    if (!_sys_path(from, frompath, PATH_READ))
+        return (FAT32_ERROR_FILE_NOT_FOUND);
+    ++fileChanges;
+    if (!_sys_path(to, topath, PATH_WRITE))
+        return (FAT32_ERROR_WRITE_FAILED);
+    return (_sys_copypath((char *)frompath, (char *)topath, buffer, size));
+}
+
 #ifdef DEBUGLOG
 void _sys_logbuffer(uint8 *buffer) {
     FILE *file;
@@ -220,6 +593,10 @@ uint8 _sys_readseq(uint8 *filename, long fpos) {
     uint8 dmabuf[128];
     uint8 i;
 
+#ifdef ROMDISK
+    if (_rom_isdrive(filename))
+        return (_rom_file(filename) ? _rom_read(_rom_file(filename), fpos) : 0x10);
+#endif
     FILE *file = _sys_fopen_r(&filename[0]);
     if (file != NULL) {
         if (!_sys_fseek(file, fpos, 0)) {
@@ -268,6 +645,19 @@ uint8 _sys_readrand(uint8 *filename, long fpos) {
     uint8 i;
     long extSize;
 
+#ifdef ROMDISK
+    if (_rom_isdrive(filename)) {
+        const romdisk_file_t *rom = _rom_file(filename);
+        if (!rom)
+            return (0x10);
+        if (fpos >= 65536L * 128)
+            return (0x06);
+        result = _rom_read(rom, fpos);
+        if (result && fpos >= 16384 * ((rom->size + 16383) / 16384))
+            result = 0x04; // seek to unwritten extent
+        return (result);
+    }
+#endif
     FILE *file = _sys_fopen_r(&filename[0]);
     if (file != NULL) {
         if (!_sys_fseek(file, fpos, 0)) {
@@ -320,18 +710,18 @@ uint8 _sys_writerand(uint8 *filename, long fpos) {
     return (result);
 }
 
+// Cuts a file to rc records, for the CCP of DRI that shortens $$$.SUB as it runs it
 uint8 _Truncate(char *fn, uint8 rc) {
-// CP/M doesn't support truncate
-	printf("Err: no truncate\n") ;
-/*
-    uint8 result = 0x00;
-    uint8 fullpath[128] = FILEBASE;
-    strcat((char *)fullpath, (char *)fn);
-    if (truncate((char *)fullpath, rc * 128))
-        result = 0xff;
+    fat32_file_t file;
+    uint8 fullpath[128];
+    uint8 result = 0xff;
+
+    if (_sys_path((uint8 *)fn, fullpath, PATH_UPDATE) && fat32_open(&file, (char *)fullpath) == FAT32_OK) {
+        if (fat32_truncate(&file, rc * 128) == FAT32_OK)
+            result = 0x00;
+        fat32_close(&file);
+    }
     return (result);
-*/    
-    return 1 ;
 }
 
 void _MakeUserDir() {
@@ -341,7 +731,19 @@ void _MakeUserDir() {
     uint8 path[4] = {dFolder, FOLDERCHAR, uFolder, 0};
     uint8 fullpath[128] = FILEBASE;
     strcat((char *)fullpath, (char *)path);
+#ifdef ROMDISK
+    if (_rom_isdrive(path))
+        return; // The flash drive has all its files in every user area
+#endif
 
+#ifdef OVERLAY
+    if (overlayOn) {
+        // The new user area is made in the overlay, the drive is left as it is
+        strcpy((char *)fullpath, OVLROOT "/");
+        strcat((char *)fullpath, (char *)path);
+        _ovl_mkdirs((char *)fullpath);
+    }
+#endif
     sd_mkdir_filename((char *)fullpath);
 }
 
@@ -395,6 +797,66 @@ static uint16 fileRecords = 0;
 static uint16 fileExtents = 0;
 static uint16 fileExtentsUsed = 0;
 static uint16 firstFreeAllocBlock;
+static uint32 findNextSize = 0;     // Size in bytes of the last file found, from its directory entry
+static fat32_unlink_t findNextEntry; // Directory entry of the last file found
+static uint8 findNextOnCard = FALSE; // The last file found is findNextEntry, a plain file of a drive
+#ifdef OVERLAY
+static uint8 findInOverlay = FALSE; // fat_dir is the overlay directory, the one of the drive comes next
+#endif
+
+// Returns a file found by _findnext, of size bytes: tmpFCB gets its name, and
+// the DMA its directory entry when isdir
+void _findfound(uint8 *shortName, uint32 size, uint8 isdir) {
+    uint32 bytes;
+
+    findNextSize = size;
+    if (isdir) {
+        // account for host files that aren't multiples of the block size
+        // by rounding their bytes up to the next multiple of blocks
+        bytes = size;
+        if (bytes & (BlkSZ - 1))
+            bytes = (bytes & ~(BlkSZ - 1)) + BlkSZ;
+        // calculate the number of 128 byte records and 16K
+        // extents for this file. _mockupDirEntry will use
+        // these values to populate the returned directory
+        // entry, and decrement the # of records and extents
+        // left to process in the file.
+        fileRecords = bytes / BlkSZ;
+        fileExtents = fileRecords / BlkEX + ((fileRecords & (BlkEX - 1)) ? 1 : 0);
+        fileExtentsUsed = 0;
+        firstFreeAllocBlock = firstBlockAfterDir;
+        _mockupDirEntry(1);
+    } else {
+        fileRecords = 0;
+        fileExtents = 0;
+        fileExtentsUsed = 0;
+        firstFreeAllocBlock = firstBlockAfterDir;
+    }
+    _RamWrite(tmpFCB, filename[0] - '@');
+    _HostnameToFCB(tmpFCB, shortName);
+}
+
+#ifdef ROMDISK
+// _findnext on the flash drive, its directory is in flash
+uint8 _rom_findnext(uint8 isdir) {
+    const romdisk_file_t *file;
+
+    while (romFindNext < romdisk_count) {
+        file = &romdisk_files[romFindNext++];
+        _HostnameToFCBname((uint8 *)file->name, fcbname);
+        if (match(fcbname, pattern)) {
+            if (allUsers)
+                currFindUser = 0;
+            strcpy(findNextDirName, FILEBASE); // For _mockupDirEntry, as _findnext leaves it
+            strncat(findNextDirName, (char *)filename, 4);
+            strcat(findNextDirName, file->name);
+            _findfound((uint8 *)file->name, file->size, isdir);
+            return (0x00);
+        }
+    }
+    return (0xff);
+}
+#endif
 
 uint8 _findnext(uint8 isdir) {
     uint8 result = 0xff;
@@ -402,9 +864,8 @@ uint8 _findnext(uint8 isdir) {
     fat32_error_t fat_result ;
 	
     int i;
-    struct stat st;
-    uint32 bytes;
 
+    findNextOnCard = FALSE;
     // printf("%s\n", filename) ;
     if (allExtents && fileRecords) {
         // _SearchFirst was called with '?' in the FCB's EX field, so
@@ -414,6 +875,10 @@ uint8 _findnext(uint8 isdir) {
         // for the file.
         _mockupDirEntry(1);
         result = 0;
+#ifdef ROMDISK
+    } else if (findInRom) {
+        result = _rom_findnext(isdir);
+#endif
     } else {
 	if (!fat_dir_open ) return(0xff) ; // err dir not opened 
     	while(1)
@@ -443,45 +908,38 @@ uint8 _findnext(uint8 isdir) {
                 _HostnameToFCBname((uint8 *)shortName, fcbname);
                 // printf("short/fcb: %s - %s - %s ", shortName, fcbname, findNextDirName);
                 // if (stat(findNextDirName, &st) == 0) printf("stat OK\n") ; else printf("stat NOK err %d\n", errno )  ;
-                if (match(fcbname, pattern) &&
-                    (stat(findNextDirName, &st) == 0) &&
-                    S_ISREG(st.st_mode)   
-                    // isxdigit((uint8)shortName[2]) &&  (printf("-4") !=0) &&
-                    // (isupper((uint8)shortName[2]) || isdigit((uint8)shortName[2]))
-		    ) {
-		    // printf(" -- ok\n") ;
+                // Directories were skipped above, the entry has the size: no stat, which walks the path again
+                if (match(fcbname, pattern)
+#ifdef OVERLAY
+                    && (findInOverlay || !_sys_hidden((uint8 *)&findNextDirName[strlen(FILEBASE)]))
+#endif
+                    ) {
                     if (allUsers)
                         currFindUser = isdigit((uint8)shortName[2]) ? shortName[2] - '0' : shortName[2] - 'A' + 10;
-                    if (isdir) {
-                        // account for host files that aren't multiples of the block size
-                        // by rounding their bytes up to the next multiple of blocks
-                        bytes = st.st_size;
-                        if (bytes & (BlkSZ - 1))
-                            bytes = (bytes & ~(BlkSZ - 1)) + BlkSZ;
-                        // calculate the number of 128 byte records and 16K
-                        // extents for this file. _mockupDirEntry will use
-                        // these values to populate the returned directory
-                        // entry, and decrement the # of records and extents
-                        // left to process in the file.
-                        fileRecords = bytes / BlkSZ;
-                        fileExtents = fileRecords / BlkEX + ((fileRecords & (BlkEX - 1)) ? 1 : 0);
-                        fileExtentsUsed = 0;
-                        firstFreeAllocBlock = firstBlockAfterDir;
-                        _mockupDirEntry(1);
-                    } else {
-                        fileRecords = 0;
-                        fileExtents = 0;
-                        fileExtentsUsed = 0;
-                        firstFreeAllocBlock = firstBlockAfterDir;
-                    }
-                    _RamWrite(tmpFCB, filename[0] - '@');
-                    _HostnameToFCB(tmpFCB, (uint8 *)shortName);
+                    _findfound((uint8 *)shortName, dir_entry.size, isdir);
+                    findNextEntry.sector = dir_entry.sector;
+                    findNextEntry.offset = dir_entry.offset;
+                    findNextEntry.start_cluster = dir_entry.start_cluster;
+#ifdef OVERLAY
+                    findNextOnCard = !overlayOn; // Else deleted by _ovl_remove
+#else
+                    findNextOnCard = TRUE;
+#endif
                     result = 0x00;
                     break;
                 } // else printf(" %s nok\n", pattern) ; 
             } else {
         	fat32_close(&fat_dir);
 		fat_dir_open = false ;
+#ifdef OVERLAY
+                if (findInOverlay) {
+                    // The overlay is listed, on to the files of the drive it does not hide
+                    findInOverlay = FALSE;
+                    fat_dir_open = (fat32_open(&fat_dir, fat_dir_fullpath) == FAT32_OK);
+                    if (fat_dir_open)
+                        continue;
+                }
+#endif
 		break ;
 	    }
 	  }    
@@ -489,13 +947,62 @@ uint8 _findnext(uint8 isdir) {
     return (result);
 }
 
+// Wildcard delete: the files _findnext finds are queued and deleted together
+// by _sys_deleteflush, one write per directory sector and one pass over the
+// FAT, rather than each with a path lookup while the scan starts over
+#ifndef DELETE_BATCH
+#define DELETE_BATCH 32
+#endif
+static fat32_unlink_t deleteBatch[DELETE_BATCH];
+static uint8 deleteCount = 0;
+
+// Deletes the queued files, returns TRUE if all went
+int _sys_deleteflush(void) {
+    uint8 count = deleteCount;
+
+    deleteCount = 0;
+    return (fat32_delete_entries(deleteBatch, count) == FAT32_OK);
+}
+
+// Deletes filename, the file _findnext found last. A plain file of a drive
+// is only queued, _sys_deleteflush must follow
+int _sys_deletefound(uint8 *filename) {
+    if (!findNextOnCard)
+        return (_sys_deletefile(filename));
+    ++fileChanges;
+    deleteBatch[deleteCount++] = findNextEntry;
+    findNextOnCard = FALSE;
+    return (deleteCount < DELETE_BATCH || _sys_deleteflush());
+}
+
 uint8 _findfirst(uint8 isdir) {
     uint8 path[6] = {'/', '?', FOLDERCHAR, '?', FOLDERCHAR, 0};
     path[1] = filename[0];
     path[3] = filename[2];
     if (fat_dir_open)
         fat32_close(&fat_dir) ;
-    fat32_error_t fat_result = fat32_open(&fat_dir, (char *)path);
+    fat_dir_open = false ;
+    fat32_error_t fat_result;
+#ifdef ROMDISK
+    findInRom = _rom_isdrive(filename);
+    if (findInRom) {
+        romFindNext = 0;
+        _HostnameToFCBname(filename, pattern);
+        fileRecords = 0;
+        fileExtents = 0;
+        fileExtentsUsed = 0;
+        return (_findnext(isdir));
+    }
+#endif
+#ifdef OVERLAY
+    // The overlay directory is listed first, when there is one
+    char overlay[16] = OVLROOT;
+    strcat(overlay, (char *)path);
+    findInOverlay = overlayOn && fat32_open(&fat_dir, overlay) == FAT32_OK;
+    fat_result = findInOverlay ? FAT32_OK : fat32_open(&fat_dir, (char *)path);
+#else
+    fat_result = fat32_open(&fat_dir, (char *)path);
+#endif
     if (fat_result != FAT32_OK)
     {
        	printf("Dir Error: %s\n", fat32_error_string(fat_result));
@@ -519,6 +1026,21 @@ uint8 _findfirstallusers(uint8 isdir) {
     path[1] = filename[0];
     if (fat_dir_open)
         fat32_close(&fat_dir) ;
+    fat_dir_open = false ;
+#ifdef OVERLAY
+    findInOverlay = FALSE;
+#endif
+#ifdef ROMDISK
+    findInRom = _rom_isdrive(filename);
+    if (findInRom) {
+        romFindNext = 0;
+        strcpy((char *)pattern, "???????????");
+        fileRecords = 0;
+        fileExtents = 0;
+        fileExtentsUsed = 0;
+        return (_findnextallusers(isdir));
+    }
+#endif
     fat32_error_t fat_result = fat32_open(&fat_dir, (char *)path);
     if (fat_result != FAT32_OK)
     {
@@ -588,6 +1110,78 @@ uint32 _HardwareIn(const uint32 Port) {
 /* Console abstraction functions */
 /*===============================================================================*/
 
+#ifdef STREAMIO
+/* Headless runs of the Linux build (runcpm-host)
+
+   -i FILE  the console input is read from FILE, then from the keyboard (stdin)
+   -o FILE  the console output is also written to FILE
+   -s       the console output goes to the -o file only
+   -x       RunCPM ends when the -i file is over, instead of waiting for keys
+   -n       the LCD is not rendered, the console output still reaches stdout
+   -w       the drives are not written, the writes go to an overlay that is
+            discarded at the start and at the end, so every run sees the same card
+*/
+static uint8 streamExitAtEnd = FALSE;
+
+#ifdef OVERLAY
+void _ovl_atexit(void) {
+    _ovl_end(FALSE, NULL, 0);
+}
+#endif
+
+// Called when a key is wanted and the -i file is over
+void _abort_if_kbd_eof(void) {
+    if (streamExitAtEnd) {
+        if (streamOutputFile)
+            fflush(streamOutputFile);
+        exit(0);
+    }
+}
+
+void _host_init(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:o:sxnw")) != -1) {
+        switch (opt) {
+        case 'i':
+            streamInputFile = host_fopen_native(optarg, "rb");
+            if (!streamInputFile) {
+                fprintf(stderr, "%s: can't read %s\n", argv[0], optarg);
+                exit(1);
+            }
+            streamInputActive = TRUE;
+            break;
+        case 'o':
+            streamOutputFile = host_fopen_native(optarg, "wb");
+            if (!streamOutputFile) {
+                fprintf(stderr, "%s: can't write %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            consoleOutputActive = FALSE;
+            break;
+        case 'x':
+            streamExitAtEnd = TRUE;
+            break;
+        case 'n':
+            stdio_set_driver_enabled(&picocalc_stdio_driver, false);
+            break;
+#ifdef OVERLAY
+        case 'w':
+            _ovl_end(FALSE, NULL, 0);
+            overlayOn = TRUE;
+            atexit(_ovl_atexit);
+            break;
+#endif
+        default:
+            fprintf(stderr, "Usage: %s [-i input] [-o output] [-s] [-x] [-n] [-w]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+#endif
+
 void _console_init(void) {
 }
 
@@ -606,6 +1200,8 @@ int _kbhit(void) {
 
 uint8 _getch(void) {
   int ch ;
+  if (!_kbhit())
+    _SyncDisks() ; // Idle until a key, the card is left whole should the power go
   while(1) {
     if (user_keyavail>0)  {
 	user_keyavail-- ;
@@ -614,6 +1210,10 @@ uint8 _getch(void) {
     if (keyboard_key_available()) {
 	 return keyboard_get_key() ;
     } 
+#ifdef HIBERNATE
+    if (user_hibernate && _snapHibernate(TRUE))
+	return '\r' ; // the machine stops, Status is STATUS_EXIT
+#endif
     sleep_ms(10) ;
     //return getchar() ;
   }
@@ -645,6 +1245,17 @@ void _putch(uint8 ch) {
 #endif
 }
 
+// Puts len characters at once, the console does them in one go
+void _putchs(const uint8 *str, uint32 len) {
+#if UART_DEBUG
+    while (len--)
+        _putch(*str++);
+#else
+    while(user_freeze) ; // wait for Ctrl-Q
+    stdio_put_string((const char *)str, len, false, true);
+#endif
+}
+
 uint8 _getche(void) {
     uint8 ch = _getch();
     _putch(ch);
@@ -0,0 +1,243 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* End-to-end workload benchmark, run by the BENCH command of the internal CCP
+
+   The script (BENCH.TXT by default) has one workload per line:
+
+       name|command line|console input
+
+   The command line is fed to the CCP as if it was typed and the console input,
+   if any, is handed to the program before the keyboard is read. In the console
+   input ^M stands for Return, ^Z for Ctrl-Z and so on, and ^^ for a plain ^.
+   A line with an empty name is run but not measured (setup), lines starting
+   with ';' are comments.
+
+   A workload ends when the CCP asks for the next command line. Its wall time,
+   emulated cycles, BDOS and BIOS calls, SD and LCD traffic are then printed as
+   one JSON object, and also written to A:BENCH.JSN (user 0).
+*/
+
+#define BENCH_SCRIPT_SIZE 4096          // Largest script accepted
+#define BENCH_RESULTS "A/0/BENCH.JSN"   // Results file
+#define BENCH_RECORD_SIZE 384
+
+#ifdef RUNCPM_HOST
+    #define BENCH_PLATFORM "runcpm-host"
+#else
+    #define BENCH_PLATFORM "picocalc"
+#endif
+
+typedef struct {
+    uint64 us;
+    uint64 cycles;
+    uint32 bdosCalls;
+    uint32 biosCalls;
+    uint32 sdReads;     // Sectors
+    uint32 sdWrites;    // Sectors
+    uint64 lcdBytes;
+} BenchSample;
+
+static char benchScript[BENCH_SCRIPT_SIZE + 1];
+static char *benchLine = NULL;          // Next script line, NULL when no script is running
+static const char *benchName = NULL;    // Workload being measured, NULL if none
+static const char *benchCommand = NULL; // Its command line
+static uint16 benchCount = 0;           // Workloads reported so far
+static BenchSample benchStart;
+
+void _benchSample(BenchSample *s) {
+    s->us = time_us_64();
+    s->cycles = benchCycles;
+    s->bdosCalls = benchBdosCalls;
+    s->biosCalls = benchBiosCalls;
+    fat32_get_io_stats(&s->sdReads, &s->sdWrites);
+    s->lcdBytes = lcd_get_bytes_sent();
+}
+
+// Prints a piece of the JSON report and appends it to the results file
+void _benchEmit(const char *str) {
+    FILE *file = _sys_fopen_a((uint8 *)BENCH_RESULTS);
+    if (file != NULL) {
+        fputs(str, file);
+        _sys_fclose(file);
+    }
+    _puts(str);
+}
+
+// Copies a string into a JSON string literal, returns the length written
+int _benchQuote(char *to, const char *from, int size) {
+    int n = 0;
+
+    to[n++] = '"';
+    while (*from && n < size - 3) {
+        if (*from == '"' || *from == '\\')
+            to[n++] = '\\';
+        to[n++] = (*from >= ' ') ? *from : '?';
+        ++from;
+    }
+    to[n++] = '"';
+    to[n] = 0;
+    return n;
+}
+
+// Ends the workload being measured and reports it
+void _benchEnd(void) {
+    BenchSample now;
+    char record[BENCH_RECORD_SIZE];
+    int n;
+
+    benchKeys = NULL; // Input the program did not read is dropped
+    if (!benchName)
+        return;
+    _benchSample(&now);
+
+    n = sprintf(record, "%s\r\n{\"name\":", benchCount ? "," : "");
+    n += _benchQuote(record + n, benchName, 40);
+    n += sprintf(record + n, ",\"command\":");
+    n += _benchQuote(record + n, benchCommand, 130);
+    sprintf(record + n,
+            ",\"wall_us\":%llu,\"cycles\":%llu,\"bdos_calls\":%lu,\"bios_calls\":%lu"
+            ",\"sd_read_bytes\":%llu,\"sd_write_bytes\":%llu,\"lcd_bytes\":%llu}\r\n",
+            now.us - benchStart.us,
+            now.cycles - benchStart.cycles,
+            (unsigned long)(now.bdosCalls - benchStart.bdosCalls),
+            (unsigned long)(now.biosCalls - benchStart.biosCalls),
+            (uint64)(now.sdReads - benchStart.sdReads) * 512,
+            (uint64)(now.sdWrites - benchStart.sdWrites) * 512,
+            now.lcdBytes - benchStart.lcdBytes);
+    _benchEmit(record);
+    ++benchCount;
+    benchName = NULL;
+}
+
+// Turns the ^X notation of the console input into control characters, in place
+void _benchDecodeKeys(char *keys) {
+    char *to = keys;
+
+    while (*keys) {
+        if (keys[0] == '^' && keys[1]) {
+            *(to++) = (keys[1] == '^') ? '^' : (toupper(keys[1]) & 0x1f);
+            keys += 2;
+        } else {
+            *(to++) = *(keys++);
+        }
+    }
+    *to = 0;
+}
+
+// Loads a script and starts the report, returns TRUE if the script was loaded
+uint8 _benchBegin(uint8 *filename) {
+    char header[96];
+    FILE *file;
+    long l;
+
+    file = _sys_fopen_r(filename);
+    if (file == NULL)
+        return FALSE;
+    l = _sys_fread(benchScript, 1, BENCH_SCRIPT_SIZE, file);
+    _sys_fclose(file);
+    benchScript[l > 0 ? l : 0] = 0;
+    for (char *p = benchScript; *p; ++p) {
+        if (*p == 0x1a) { // CP/M end of text
+            *p = 0;
+            break;
+        }
+    }
+
+    file = _sys_fopen_w((uint8 *)BENCH_RESULTS); // Starts a new results file
+    if (file != NULL)
+        _sys_fclose(file);
+
+    benchLine = benchScript;
+    benchName = NULL;
+    benchCount = 0;
+    sprintf(header, "{\"runcpm\":\"" VERSION "\",\"platform\":\"" BENCH_PLATFORM "\",\"workloads\":[\r\n");
+    _benchEmit(header);
+    return TRUE;
+}
+
+// Returns TRUE if the script has lines left to run
+uint8 _benchMore(void) {
+    const char *p = benchLine;
+
+    while (*p) {
+        while (*p == '\r' || *p == '\n')
+            ++p;
+        if (*p && *p != ';')
+            return TRUE;
+        while (*p && *p != '\r' && *p != '\n')
+            ++p;
+    }
+    return FALSE;
+}
+
+// Closes the report, the script is done
+void _benchClose(void) {
+    _benchEmit("]}\r\n");
+    benchLine = NULL;
+}
+
+// Called by the CCP when it needs a command line. Ends the previous workload and,
+// while the script lasts, places its next command line on the CCP buffer at
+// address buf (CP/M C_READSTR layout) and starts measuring it
+uint8 _benchNext(uint16 buf) {
+    char *name, *command, *keys, *p;
+    uint8 len;
+
+    if (!benchLine)
+        return FALSE;
+    _benchEnd();
+
+    while (*benchLine) {
+        // Splits the next line in place
+        name = benchLine;
+        while (*benchLine && *benchLine != '\r' && *benchLine != '\n')
+            ++benchLine;
+        while (*benchLine == '\r' || *benchLine == '\n')
+            *(benchLine++) = 0;
+        if (!*name || *name == ';')
+            continue;
+
+        command = keys = NULL;
+        for (p = name; *p; ++p) {
+            if (*p == '|') {
+                *p = 0;
+                if (!command) {
+                    command = p + 1;
+                } else {
+                    keys = p + 1;
+                    break;
+                }
+            }
+        }
+        if (!command) { // A line with only a command
+            command = name;
+            name = "";
+        }
+        if (!*name && !_benchMore())
+            _benchClose(); // A last setup line (EXIT, say) may not come back
+
+        len = 0;
+        while (command[len] && len < cmdLen - 2) {
+            _RamWrite(buf + 2 + len, command[len]);
+            ++len;
+        }
+        _RamWrite(buf + 1, len);
+        _puts(command);
+
+        if (keys) {
+            _benchDecodeKeys(keys);
+            benchKeys = (uint8 *)keys;
+        }
+        if (*name) {
+            benchName = name;
+            benchCommand = command;
+            _benchSample(&benchStart);
+        }
+        return TRUE;
+    }
+    _benchClose();
+    return FALSE;
+}
+
+#endif // BENCH_H
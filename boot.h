@@ -0,0 +1,115 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+/* Boot timeline and cached clock estimate
+
+   main marks the end of each boot stage with _bootMark, in us since power up,
+   and the internal CCP marks the first prompt. The BOOT command prints the
+   timeline.
+
+   Z80estimateClock runs the emulator for about a second, so its result is kept
+   in CLOCKCFG on the SD card with the build it was measured on, and is only
+   measured again by another build, or by BOOT CLOCK. The battery level is read
+   in the background by the keyboard timer, the banner shows it when the first
+   read is done.
+*/
+
+#define CLOCKCFG "CLOCK.CFG"        // Cached clock estimate, in the root of the SD card
+#define CLOCKCFG_BUILD "Built " __DATE__ " " __TIME__
+#define BOOT_STAGES 8
+
+static const char *bootNames[BOOT_STAGES];
+static uint32 bootTimes[BOOT_STAGES];
+static uint8 bootStages = 0;
+static uint8 bootReady = FALSE;     // The first prompt was marked
+
+void _bootMark(const char *name) {
+    if (bootStages < BOOT_STAGES) {
+        bootNames[bootStages] = name;
+        bootTimes[bootStages++] = time_us_32();
+    }
+}
+
+// Marks the first prompt of the internal CCP, once
+void _bootPrompt(void) {
+    if (!bootReady) {
+        bootReady = TRUE;
+        _bootMark("prompt");
+    }
+}
+
+// Reads the cached clock run time, 0 if there is none for this build
+uint32 _bootLoadClock(void) {
+    FILE *file = _sys_fopen_r((uint8 *)CLOCKCFG);
+    char text[64];
+    size_t length;
+    unsigned long elapsed = 0;
+
+    if (file == NULL)
+        return 0;
+    length = _sys_fread(text, 1, sizeof(text) - 1, file);
+    _sys_fclose(file);
+    text[length] = 0;
+    if (strncmp(text, CLOCKCFG_BUILD "\r\n", sizeof(CLOCKCFG_BUILD) + 1))
+        return 0;
+    sscanf(text + sizeof(CLOCKCFG_BUILD) + 1, "%lu", &elapsed);
+    return (uint32)elapsed;
+}
+
+void _bootSaveClock(uint32 elapsed) {
+    FILE *file = _sys_fopen_w((uint8 *)CLOCKCFG);
+    char text[64];
+
+    if (file == NULL)
+        return;
+    sprintf(text, CLOCKCFG_BUILD "\r\n%lu ms\r\n", (unsigned long)elapsed);
+    _sys_fwrite(text, 1, strlen(text), file);
+    _sys_fclose(file);
+}
+
+// Prints the clock estimate, measuring it if there is no cached one or force is set
+void _bootClock(uint8 force) {
+    uint32 elapsed = force ? 0 : _bootLoadClock();
+    uint8 page[32];
+    uint8 status = Status;
+
+    if (!elapsed) {
+        // The test code runs at 0x0000 and stops on a HALT, both are put back for BOOT CLOCK
+        for (uint8 i = 0; i < sizeof(page); ++i)
+            page[i] = _RamRead(i);
+        elapsed = Z80estimateClock();
+        for (uint8 i = 0; i < sizeof(page); ++i)
+            _RamWrite(i, page[i]);
+        Status = status;
+        _bootSaveClock(elapsed);
+    }
+    Z80printClock(elapsed);
+}
+
+void _bootBattery(void) {
+    int16_t level = keyboard_battery_level();
+
+    if (level < 0)
+        return;
+    printf("Battery Level: %d%%", level & 0x7f);
+    if (level & 0x80)
+        _puts(" (charging)");
+    _puts("\r\n");
+}
+
+void _bootReport(void) {
+    char line[48];
+    uint32 last = 0;
+
+    _puts("Stage        At ms  Took ms\r\n");
+    for (uint8 i = 0; i < bootStages; ++i) {
+        sprintf(line, "%-10s %7lu.%01lu %6lu.%01lu\r\n", bootNames[i],
+                (unsigned long)(bootTimes[i] / 1000), (unsigned long)(bootTimes[i] % 1000 / 100),
+                (unsigned long)((bootTimes[i] - last) / 1000), (unsigned long)((bootTimes[i] - last) % 1000 / 100));
+        _puts(line);
+        last = bootTimes[i];
+    }
+    _bootBattery();
+}
+
+#endif // BOOT_H
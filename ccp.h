@@ -24,6 +24,9 @@
 #define FCB_SIZE          36
 #define SEC_SIZE          128
 #define MAX_USER          15
+#ifndef SUBMIT_SIZE
+#define SUBMIT_SIZE       2048          // Lines of a .SUB run natively, a longer one runs with SUBMIT.COM
+#endif
 
 // CCP global variables
 uint8 pageSize = DEFAULT_PAGE_SIZE;     // for TYPE
@@ -32,6 +35,9 @@ uint8 paramDrive = 0;                   // 0 -> 15 = A -> P (Drive for the first
 uint8 currentUser = 0;                  // 0 -> 15 (Current user area to access)
 bool submitFlag = FALSE;                // Submit Flag
 uint8 submitRecords = 0;                // Number of records on the Submit file
+uint8 submitQueue[SUBMIT_SIZE];         // Lines of the native SUBMIT, each one its length then its characters
+uint16 submitNext = 0, submitEnd = 0;   // Next line to run in submitQueue, and end of the lines
+uint32 submitDeletes = 0;               // batchDeletes when the native SUBMIT started
 uint8 prompt[PROMPT_SIZE] = "\r\n  >";  // Command prompt
 uint16 cmdBufferPtr, errorPtr;          // Pointer to the command buffer, and error position
 uint8 bufferLen = 0;                    // Actual size of the typed command line
@@ -41,6 +47,10 @@ typedef struct {
     uint8 (*handler)(void);
 } Command;
 
+#ifdef BENCHMARK
+    #include "bench.h" // bench.h - Workload benchmark run by the BENCH command
+#endif
+
 // Used to call BIOS from inside the CCP
 void _ccp_bios(uint8 function) {
     SET_LOW_REGISTER(PCX, function);
@@ -234,6 +244,145 @@ void _ccp_askForKey(void) {
 }
 
 #ifdef Internals
+// The TPA is free while the CCP runs, COPY, TYPE and LDIR /C read the files
+// into it from defLoad, this much at a time
+#define CCP_BUFFER (16 * 1024)
+
+// A file read CCP_BUFFER at a time: with fat32.c from a folder drive,
+// through its FCB from a disk image, or copied from the flash drive
+typedef struct {
+    fat32_file_t file;
+    uint16 fcbaddr;
+    uint8 image;
+#ifdef ROMDISK
+    const uint8 *rom;   // What is left of a file of the flash drive
+    uint32 left;
+#endif
+} CcpStream;
+
+// Opens the file of an FCB to be read as a stream
+uint8 _ccp_openstream(uint16 fcbaddr, CcpStream *stream) {
+    CPM_FCB *F = (CPM_FCB *)_RamSysAddr(fcbaddr);
+    uint8 name[17];
+
+    if (_SelectDisk(F->dr))
+        return FALSE;
+    stream->fcbaddr = fcbaddr;
+    stream->image = FALSE;
+#ifdef DISKIMAGE
+    if (_dsk_fcbslot(fcbaddr) != 0xff) {
+        F->ex = F->s2 = F->cr = 0;
+        stream->image = TRUE;
+        return (_dsk_open(fcbaddr) == 0x00);
+    }
+#endif
+    _FCBtoHostname(fcbaddr, name);
+    if (!name[4])
+        return FALSE; // Invalid filename
+#ifdef ROMDISK
+    stream->rom = NULL;
+    if (_rom_isdrive(name)) {
+        const romdisk_file_t *file = _rom_file(name);
+        if (!file)
+            return FALSE;
+        stream->rom = romdisk_data + file->offset;
+        stream->left = file->size;
+        return TRUE;
+    }
+#endif
+    return (_sys_fopen_stream(&stream->file, name) == FAT32_OK);
+} // _ccp_openstream
+
+// Reads up to size bytes of a stream, FALSE on an error
+uint8 _ccp_readstream(CcpStream *stream, uint8 *buffer, size_t size, size_t *length) {
+#ifdef DISKIMAGE
+    if (stream->image) {
+        *length = _dsk_read(stream->fcbaddr, buffer, size);
+        return TRUE;
+    }
+#endif
+#ifdef ROMDISK
+    if (stream->rom) {
+        *length = size < stream->left ? size : stream->left;
+        memcpy(buffer, stream->rom, *length);
+        stream->rom += *length;
+        stream->left -= *length;
+        return TRUE;
+    }
+#endif
+    return (fat32_read(&stream->file, buffer, size, length) == FAT32_OK);
+} // _ccp_readstream
+
+// Whether a stream has more to read
+uint8 _ccp_streammore(CcpStream *stream) {
+#ifdef DISKIMAGE
+    uint8 record[BlkSZ];
+
+    if (stream->image)
+        return (_dsk_read(stream->fcbaddr, record, BlkSZ) != 0);
+#endif
+#ifdef ROMDISK
+    if (stream->rom)
+        return (stream->left != 0);
+#endif
+    return (!fat32_eof(&stream->file));
+} // _ccp_streammore
+
+void _ccp_closestream(CcpStream *stream) {
+#ifdef ROMDISK
+    if (stream->rom)
+        return;
+#endif
+    if (!stream->image)
+        fat32_close(&stream->file);
+} // _ccp_closestream
+
+// Sums the bytes of a buffer a word at a time, two bytes in each half of the
+// word. 128 words at most are added before folding, so the halves never carry
+uint16 _ccp_sum(const uint8 *buffer, uint32 length) {
+    uint32 sum = 0, halves, words;
+    const uint32 *word;
+
+    while (length && ((uintptr_t)buffer & 3)) {
+        sum += *buffer++;
+        --length;
+    }
+    while (length >= 4) {
+        word = (const uint32 *)buffer;
+        words = length / 4 > 128 ? 128 : length / 4;
+        halves = 0;
+        for (uint32 i = 0; i < words; ++i)
+            halves += (word[i] & 0x00ff00ff) + ((word[i] >> 8) & 0x00ff00ff);
+        sum += (halves & 0xffff) + (halves >> 16);
+        buffer += words * 4;
+        length -= words * 4;
+    }
+    while (length--)
+        sum += *buffer++;
+    return ((uint16)sum);
+} // _ccp_sum
+
+// Checksums a file as CP/M reads it, its last record padded with ^Z
+uint8 _ccp_checksum(uint16 fcbaddr, uint16 *checksum) {
+    CcpStream file;
+    uint8 *buffer = _RamSysAddr(defLoad);
+    size_t length = 0;
+    uint32 size = 0;
+    uint16 sum = 0;
+
+    if (!_ccp_openstream(fcbaddr, &file))
+        return FALSE;
+    while (_ccp_readstream(&file, buffer, CCP_BUFFER, &length) && length) {
+        sum += _ccp_sum(buffer, length);
+        size += length;
+    }
+    _ccp_closestream(&file);
+    if (size & (BlkSZ - 1))
+        sum += (BlkSZ - (size & (BlkSZ - 1))) * 0x1a;
+    *checksum = sum;
+    return TRUE;
+} // _ccp_checksum
+
 // DIR command - standard directory listing
 uint8 _ccp_dir(void) {
     uint8 i;
@@ -319,10 +468,9 @@ uint8 _ccp_ldir(void) {
                 _ccp_bdos(C_WRITE, ' ');
                 len++;
             }
-            // Get file size
-            long fsize = _FileSize(tmpFCB);
-            uint32 size = (fsize == -1) ? 0 : (uint32)fsize;
-            
+            // The size of the directory entry, rounded up to records as _FileSize does
+            uint32 size = (findNextSize + BlkSZ - 1) & ~(uint32)(BlkSZ - 1);
+
             // Print size in bytes, padded to 7 digits
             // Optimized to remove sprintf
             uint32 temp = size;
@@ -341,21 +489,9 @@ uint8 _ccp_ldir(void) {
             _puts(" bytes");
 
             if (checksumOption) {
-                // Compute checksum
+                // The search stays open, the file is read on its own handle
                 uint16 checksum = 0;
-                CPM_FCB *F = (CPM_FCB *)_RamSysAddr(tmpFCB);
-                F->ex = 0;
-                F->cr = 0;
-                if (!_ccp_bdos(F_OPEN, tmpFCB)) {
-                    // Optimization: Use direct pointer if available for checksum
-                    uint8* dmaPtr = (uint8*)_RamSysAddr(dmaAddr);
-                    while (!_ccp_bdos(F_READ, tmpFCB)) {
-                        for (uint8 i = 0; i < 128; ++i) {
-                            checksum += dmaPtr[i];
-                        }
-                    }
-                    _ccp_bdos(F_CLOSE, tmpFCB);
-                }
+                _ccp_checksum(tmpFCB, &checksum);
                 // Print checksum
                 _puts("  ");
                 _ccp_printHex16(checksum);
@@ -385,38 +521,37 @@ uint8 _ccp_era(void) {
 } // _ccp_era
 
 // TYPE command - types a file to the console
+// The file is read CCP_BUFFER at a time, and handed to the console a page at
+// a time, or up to the ^Z
 uint8 _ccp_type(void) {
-    uint8 i, c, l = 0, p = 0;
-    uint16 a = 0;
+    CcpStream file;
+    uint8 *buffer = _RamSysAddr(defLoad);
+    size_t length = 0, start, i;
+    uint8 l = 0, stop = FALSE;
 
     _puts("\r\n");
-    if (!_ccp_bdos(F_OPEN, ParFCB)) {
-
-        while (!_ccp_bdos(F_READ, ParFCB)) {
-            i = 128;
-            a = dmaAddr;
-
-            while (i) {
-                c = _RamRead(a);
-                if (c == 0x1a)
+    if (_ccp_openstream(ParFCB, &file)) {
+        while (!stop && _ccp_readstream(&file, buffer, CCP_BUFFER, &length) && length) {
+            for (start = i = 0; i < length; ++i) {
+                if (buffer[i] == 0x1a) {
+                    stop = TRUE;
                     break;
-                _ccp_bdos(C_WRITE, c);
-                if (c == 0x0a) {
-                    ++l;
-                    if (pageSize && (l == pageSize)) {
-                        l = 0;
-                        _ccp_askForKey();
-                        p = HIGH_REGISTER(AF);
-                        if (p == 3)
-                            break;
+                }
+                if (buffer[i] == 0x0a && pageSize && ++l == pageSize) {
+                    _putspan(buffer + start, i + 1 - start);
+                    start = i + 1;
+                    l = 0;
+                    _ccp_askForKey();
+                    if (HIGH_REGISTER(AF) == 3) {
+                        stop = TRUE;
+                        break;
                     }
                 }
-                --i;
-                ++a;
             }
-            if (p == 3)
-                break;
+            if (i > start)
+                _putspan(buffer + start, i - start);
         }
+        _ccp_closestream(&file);
     } else {
         _puts("No file");
     }
@@ -683,59 +818,93 @@ uint8 _ccp_vol(void) {
     return (error);
 } // _ccp_vol
 
-// COPY command - copies a file
-// Usage: COPY <src> <dest>
+// COPY command - copies files, natively with fat32.c
+// Usage: COPY <src> <dest>, src may have wildcards, dest may be just a drive
+// The TPA is free while the CCP runs: the copy buffer is at defLoad and the
+// names found are listed after it, so that the directory is read only once
+#define COPY_NAMES  (defLoad + CCP_BUFFER)
 uint8 _ccp_copy(void) {
+    uint8 dest[12];
+    uint8 from[17], to[17];
+    uint16 names = COPY_NAMES;
+    uint16 copied = 0;
+    uint8 found, i, c;
+    fat32_error_t result;
+
     if (_RamRead(ParFCB + 1) == ' ') {
         _puts("\r\nNo source");
         return 0;
     }
-    if (_RamRead(SecFCB + 1) == ' ') {
+    if (_RamRead(SecFCB + 1) == ' ' && !_RamRead(SecFCB)) {
         _puts("\r\nNo dest");
         return 0;
     }
-
-    // Move SecFCB to CmdFCB to avoid corruption when opening ParFCB
-    // ParFCB (0x5C) overlaps SecFCB (0x6C) when used as a full FCB
-    for (uint8 i = 0; i < 16; ++i) {
-        _RamWrite(CmdFCB + i, _RamRead(SecFCB + i));
-    }
-    // Initialize the rest of CmdFCB
-    for (uint8 i = 16; i < 36; ++i) {
-        _RamWrite(CmdFCB + i, 0);
-    }
-
-    if (_ccp_bdos(F_OPEN, ParFCB) == 255) {
-        _puts("\r\nSource not found");
+    // SecFCB is overwritten by the search, keep the destination drive and name
+    for (i = 0; i < 12; ++i)
+        dest[i] = _RamRead(SecFCB + i);
+    if (!dest[0])
+        dest[0] = currentDrive + 1;
+    if (roVector & (1 << (dest[0] - 1))) {
+        _puts("\r\nDrive R/O");
         return 0;
     }
-    
-    _ccp_bdos(F_DELETE, CmdFCB); // Delete dest if exists
-    
-    if (_ccp_bdos(F_MAKE, CmdFCB) == 255) {
-        _puts("\r\nDir full");
+#ifdef DISKIMAGE
+    // COPY works on the files of the card, PIP copies from and to the images
+    if (_dsk_slot(dest[0] - 1) != 0xff || _dsk_slot(_RamRead(ParFCB) ? _RamRead(ParFCB) - 1 : currentDrive) != 0xff) {
+        _puts("\r\nDisk image, use PIP");
         return 0;
     }
-    
-    if (_ccp_bdos(F_OPEN, CmdFCB) == 255) {
-        _puts("\r\nErr open dest");
+#endif
+
+    _ccp_bdos(F_DMAOFF, defDMA);
+    found = (uint8)_ccp_bdos(F_SFIRST, ParFCB);
+    while (found != 0xFF && names + 11 <= inBuf) {
+        for (i = 0; i < 11; ++i)
+            _RamWrite(names++, _RamRead(defDMA + found * 32 + 1 + i) & 0x7F);
+        found = (uint8)_ccp_bdos(F_SNEXT, ParFCB);
+    }
+    if (names == COPY_NAMES) {
+        _puts("\r\nSource not found");
         return 0;
     }
-    
-    _puts("\r\nCopying...");
-    
-    // Use 128 byte buffer at defDMA
-    while(TRUE) {
-        _ccp_bdos(F_DMAOFF, defDMA);
-        if (_ccp_bdos(F_READ, ParFCB) != 0) break; // EOF (or error, assumed EOF for now)
-        if (_ccp_bdos(F_WRITE, CmdFCB) != 0) {
-            _puts("\r\nDisk full");
+
+    for (uint16 name = COPY_NAMES; name < names; name += 11) {
+        // Source on its drive, destination named after the source where it has blanks or '?'
+        _RamWrite(CmdFCB, _RamRead(ParFCB) ? _RamRead(ParFCB) : currentDrive + 1);
+        for (i = 0; i < 11; ++i)
+            _RamWrite(CmdFCB + 1 + i, _RamRead(name + i));
+        _FCBtoHostname(CmdFCB, from);
+        _RamWrite(CmdFCB, dest[0]);
+        for (i = 0; i < 11; ++i) {
+            c = dest[i + 1];
+            if (c != '?' && dest[1] != ' ')
+                _RamWrite(CmdFCB + 1 + i, c);
+        }
+        _FCBtoHostname(CmdFCB, to);
+
+        _puts("\r\n");
+        _putcon(from[0]);
+        _putcon(':');
+        _puts((char *)from + 4);
+        _puts(" -> ");
+        _putcon(to[0]);
+        _putcon(':');
+        _puts((char *)to + 4);
+        if (!strcmp((char *)from, (char *)to)) {
+            _puts(" same file");
+            continue;
+        }
+        result = _sys_copyfile(from, to, _RamSysAddr(defLoad), CCP_BUFFER);
+        if (result != FAT32_OK) {
+            _puts(" ");
+            _puts(fat32_error_string(result));
             break;
         }
+        ++copied;
     }
-    
-    _ccp_bdos(F_CLOSE, CmdFCB);
-    _puts(" Done.");
+    _puts("\r\n");
+    _ccp_printDec(copied);
+    _puts(copied == 1 ? " file copied" : " files copied");
     return 0;
 } // _ccp_copy
 
@@ -797,14 +966,277 @@ uint8 _ccp_poke(void) {
     return 0;
 } // _ccp_poke
 
+// PROF command - BDOS/BIOS call profiler (see profiler.h)
+// Usage: PROF [ON|OFF|CLEAR], without argument prints the report
+uint8 _ccp_prof(void) {
+    uint8 arg[9];
+    uint8 i = 0;
+
+    while (i < 8 && _RamRead(ParFCB + i + 1) != ' ') {
+        arg[i] = _RamRead(ParFCB + i + 1);
+        ++i;
+    }
+    arg[i] = 0;
+    _puts("\r\n");
+    if (!i) {
+        _profReport();
+    } else if (_ccp_strEqual((char *)arg, "ON")) {
+        profEnabled = TRUE;
+        _puts("Profiler on");
+    } else if (_ccp_strEqual((char *)arg, "OFF")) {
+        profEnabled = FALSE;
+        _puts("Profiler off");
+    } else if (_ccp_strEqual((char *)arg, "CLEAR")) {
+        _profClear();
+        _puts("Profiler cleared");
+    } else {
+        _puts("Usage: PROF [ON|OFF|CLEAR]");
+    }
+    return 0;
+} // _ccp_prof
+
+#ifdef RUNCPM_TRACE
+// TRACE command - timeline trace recorder (see drivers/trace.c)
+// Usage: TRACE [ON|OFF|CLEAR|SAVE [<file>]], without argument shows the state
+uint8 _ccp_trace(void) {
+    uint8 arg[9];
+    uint8 path[17];
+    uint8 i = 0;
+    const char *str = "TRACE   JSN";
+    FILE *file;
+
+    while (i < 8 && _RamRead(ParFCB + i + 1) != ' ') {
+        arg[i] = _RamRead(ParFCB + i + 1);
+        ++i;
+    }
+    arg[i] = 0;
+    _puts("\r\n");
+    if (!i) {
+        _puts(trace_is_recording() ? "Trace on, " : "Trace off, ");
+        _ccp_printDec(trace_count());
+        _puts(" events");
+    } else if (_ccp_strEqual((char *)arg, "ON")) {
+        trace_start();
+        _puts("Trace on");
+    } else if (_ccp_strEqual((char *)arg, "OFF")) {
+        trace_stop();
+        _puts("Trace off");
+    } else if (_ccp_strEqual((char *)arg, "CLEAR")) {
+        trace_clear();
+        _puts("Trace cleared");
+    } else if (_ccp_strEqual((char *)arg, "SAVE")) {
+        if (_RamRead(SecFCB + 1) == ' ') {
+            for (i = 0; i < 11; ++i)
+                _RamWrite(SecFCB + i + 1, str[i]);
+        }
+        _FCBtoHostname(SecFCB, path);
+        file = _sys_fopen_w(path);
+        if (file == NULL) {
+            _puts("Unable to save");
+        } else {
+            trace_write_json(file);
+            _sys_fclose(file);
+            _puts("Saved");
+        }
+    } else {
+        _puts("Usage: TRACE [ON|OFF|CLEAR|SAVE [<file>]]");
+    }
+    return 0;
+} // _ccp_trace
+#endif
+
+#ifdef IOLOG
+static fat32_io_record_t ioLog[IOLOG_CAPACITY];
+
+// IOLOG command - logs the SD sector accesses (see fat32_io_capture)
+// Usage: IOLOG [ON|OFF|SAVE [<file>]], without argument shows the state
+uint8 _ccp_iolog(void) {
+    uint8 arg[9];
+    uint8 path[17];
+    uint8 i = 0;
+    uint32 count, dropped;
+    const char *str = "IOLOG   CSV";
+    FILE *file;
+
+    while (i < 8 && _RamRead(ParFCB + i + 1) != ' ') {
+        arg[i] = _RamRead(ParFCB + i + 1);
+        ++i;
+    }
+    arg[i] = 0;
+    _puts("\r\n");
+    if (!i) {
+        count = fat32_io_captured(&dropped);
+        _ccp_printDec(count);
+        _puts(" accesses logged, ");
+        _ccp_printDec(dropped);
+        _puts(" dropped");
+    } else if (_ccp_strEqual((char *)arg, "ON")) {
+        fat32_io_capture(ioLog, IOLOG_CAPACITY);
+        _puts("Logging on");
+    } else if (_ccp_strEqual((char *)arg, "OFF")) {
+        fat32_io_capture(NULL, 0);
+        _puts("Logging off");
+    } else if (_ccp_strEqual((char *)arg, "SAVE")) {
+        if (_RamRead(SecFCB + 1) == ' ') {
+            for (i = 0; i < 11; ++i)
+                _RamWrite(SecFCB + i + 1, str[i]);
+        }
+        _FCBtoHostname(SecFCB, path);
+        file = _sys_fopen_w(path);
+        if (file == NULL) {
+            _puts("Unable to save");
+        } else {
+            fat32_io_write_log(file);
+            _sys_fclose(file);
+            _puts("Saved");
+        }
+    } else {
+        _puts("Usage: IOLOG [ON|OFF|SAVE [<file>]]");
+    }
+    return 0;
+} // _ccp_iolog
+#endif
+
+#ifdef PCSAMPLE
+// SAMPLE command - guest program counter sampler (see sampler.h)
+// Usage: SAMPLE [<n>] shows the n busiest addresses, SAMPLE ON [<period>], OFF, CLEAR, SAVE [<file>]
+uint8 _ccp_sample(void) {
+    uint8 arg[9];
+    uint8 path[17];
+    uint8 i = 0;
+    uint32 n = 0;
+    const char *str = "PCSAMPLECSV";
+
+    while (i < 8 && _RamRead(ParFCB + i + 1) != ' ') {
+        arg[i] = _RamRead(ParFCB + i + 1);
+        ++i;
+    }
+    arg[i] = 0;
+    _puts("\r\n");
+    if (!i || (arg[0] >= '0' && arg[0] <= '9')) {
+        n = _ccp_fcbtonum();
+        if (n > PCS_MAX_TOP)
+            n = PCS_MAX_TOP;
+        _pcsReport(n ? n : PCS_DEFAULT_TOP);
+    } else if (_ccp_strEqual((char *)arg, "ON")) {
+        for (i = 1; i <= 8; ++i) {
+            uint8 ch = _RamRead(SecFCB + i);
+            if (ch < '0' || ch > '9')
+                break;
+            n = n * 10 + ch - '0';
+        }
+        _pcsStart(n);
+        _puts("Sampler on");
+    } else if (_ccp_strEqual((char *)arg, "OFF")) {
+        _pcsStop();
+        _puts("Sampler off");
+    } else if (_ccp_strEqual((char *)arg, "CLEAR")) {
+        _pcsClear();
+        _puts("Sampler cleared");
+    } else if (_ccp_strEqual((char *)arg, "SAVE")) {
+        if (_RamRead(SecFCB + 1) == ' ') {
+            for (i = 0; i < 11; ++i)
+                _RamWrite(SecFCB + i + 1, str[i]);
+        }
+        _FCBtoHostname(SecFCB, path);
+        _puts(_pcsSave(path) ? "Saved" : "Unable to save");
+    } else {
+        _puts("Usage: SAMPLE [<n>|ON [<period>]|OFF|CLEAR|SAVE [<file>]]");
+    }
+    return 0;
+} // _ccp_sample
+#endif
+
+#ifdef BENCHMARK
+// BENCH command - runs a benchmark script (see bench.h)
+// Usage: BENCH [<script>]
+uint8 _ccp_bench(void) {
+    uint8 path[17];
+    const char *str = "BENCH   TXT";
+
+    if (_RamRead(ParFCB + 1) == ' ') {
+        for (uint8 i = 0; i < 11; ++i)
+            _RamWrite(ParFCB + i + 1, str[i]);
+    }
+    _FCBtoHostname(ParFCB, path);
+    _puts("\r\n");
+    if (!_benchBegin(path)) {
+        _puts("No file");
+        return 0;
+    }
+    firstBoot = FALSE; // Do not restart the script from AUTOEXEC.TXT on warm boots
+    return 0;
+} // _ccp_bench
+#endif
+
+// BOOT command - shows the boot timeline (see boot.h)
+// Usage: BOOT [CLOCK], CLOCK measures the emulated clock again and caches it
+uint8 _ccp_boottime(void) {
+    _puts("\r\n");
+    if (_RamRead(ParFCB + 1) == 'C')
+        _bootClock(TRUE);
+    else
+        _bootReport();
+    return 0;
+} // _ccp_boottime
+
+#ifdef HIBERNATE
+// SUSPEND command - hibernates, saves the machine to SNAPSHOT.SYS and stops (see snapshot.h)
+// Usage: SUSPEND [RAW], RAW stores the memory uncompressed
+uint8 _ccp_suspend(void) {
+    _puts("\r\n");
+    _snapHibernate(_RamRead(ParFCB + 1) != 'R');
+    return 0;
+} // _ccp_suspend
+#endif
+
+#ifdef OVERLAY
+// OVERLAY command - writes go to a scratch tree, the drives are kept (see abstraction_picocalc.h)
+// Usage: OVERLAY [ON|OFF|COMMIT|DISCARD], without argument shows the state
+uint8 _ccp_overlay(void) {
+    uint8 arg[9];
+    uint8 i = 0;
+    int files = 0;
+
+    while (i < 8 && _RamRead(ParFCB + i + 1) != ' ') {
+        arg[i] = _RamRead(ParFCB + i + 1);
+        ++i;
+    }
+    arg[i] = 0;
+    _puts("\r\n");
+    if (!i) {
+        _puts(overlayOn ? "Overlay on" : "Overlay off");
+    } else if (_ccp_strEqual((char *)arg, "ON") || _ccp_strEqual((char *)arg, "OFF")) {
+        overlayOn = (arg[1] == 'N');
+        ++fileChanges; // The files seen change
+        _puts(overlayOn ? "Overlay on" : "Overlay off");
+    } else if (_ccp_strEqual((char *)arg, "COMMIT") || _ccp_strEqual((char *)arg, "DISCARD")) {
+        files = _ovl_end(arg[0] == 'C', _RamSysAddr(defLoad), CCP_BUFFER);
+        if (files < 0) {
+            _puts("Overlay error, partly done");
+        } else {
+            _ccp_printDec(files);
+            _puts(arg[0] == 'C' ? " files committed" : " files discarded");
+        }
+    } else {
+        _puts("Usage: OVERLAY [ON|OFF|COMMIT|DISCARD]");
+    }
+    return 0;
+} // _ccp_overlay
+#endif
+
 #endif // Internals
 
 // ?/Help command
 uint8 _ccp_hlp(void) {
     _puts("\r\nCCP Commands:\r\n");
     _puts(" ?                  - Shows this list of commands\r\n");
+#ifdef BENCHMARK
+    _puts(" BENCH [<script>]   - Runs benchmark workloads, see BENCH.TXT\r\n");
+#endif
+    _puts(" BOOT [CLOCK]       - Shows the boot timeline, CLOCK measures the Z80 clock again\r\n");
     _puts(" CLS                - Clears the screen\r\n");
-    _puts(" COPY <src> <dst>   - Copies a file\r\n");
+    _puts(" COPY <src> <dst>   - Copies files, src may have wildcards, dst may be a drive\r\n");
     _puts(" DEL [<patt>]       - Alias to ERA\r\n");
     _puts(" DIR [<patt>]       - Lists file directory\r\n");
     _puts(" DUMP <addr|file>   - Hex+ASCII dump of memory or file\r\n");
@@ -812,13 +1244,33 @@ uint8 _ccp_hlp(void) {
     _puts(" ECHO <text>        - Prints text to console\r\n");
     _puts(" ERA [<patt>]       - Erases files\r\n");
     _puts(" EXIT               - Terminates RunCPM\r\n");
+#ifdef IOLOG
+    _puts(" IOLOG [<opt>]      - Logs SD sector accesses, opt = ON, OFF or SAVE [<file>]\r\n");
+    _puts("                      SAVE writes IOLOG.CSV, for ioreplay.py\r\n");
+#endif
     _puts(" LDIR [<patt>] [/C] - Lists file directory with sizes\r\n");
     _puts("                      /C option includes 16 bit checksum\r\n");
+#ifdef OVERLAY
+    _puts(" OVERLAY [<opt>]    - Keeps the drives, writes go to an overlay\r\n");
+    _puts("                      opt = ON, OFF, COMMIT or DISCARD\r\n");
+#endif
     _puts(" PAGE [<n>]         - Sets the paging size for TYPE and LDIR\r\n");
     _puts("                      n = 0 to 255, 0 disables paging\r\n");
     _puts(" POKE <addr> <val>  - Writes a byte to memory (hex)\r\n");
+    _puts(" PROF [ON|OFF|CLEAR]- Profiles BDOS/BIOS calls, no option shows them\r\n");
     _puts(" REN <new>=<old>    - Renames files\r\n");
+#ifdef PCSAMPLE
+    _puts(" SAMPLE [<n>|<opt>] - Program counter sampler, shows the n busiest addresses\r\n");
+    _puts("                      opt = ON [<period>], OFF, CLEAR or SAVE [<file>]\r\n");
+#endif
     _puts(" SAVE <n> <file>    - Saves memory pages (256 bytes) to file\r\n");
+#ifdef HIBERNATE
+    _puts(" SUSPEND [RAW]      - Saves the machine and stops, the next boot resumes it\r\n");
+#endif
+#ifdef RUNCPM_TRACE
+    _puts(" TRACE [<opt>]      - Timeline trace, opt = ON, OFF, CLEAR or SAVE [<file>]\r\n");
+    _puts("                      SAVE writes TRACE.JSN, for Perfetto\r\n");
+#endif
     _puts(" TYPE <file>        - Displays file contents\r\n");
     _puts(" USER <n>           - Changes user area\r\n");
     _puts(" VER                - Displays the current CCP version\r\n");
@@ -846,9 +1298,29 @@ static const Command Commands[] = {
     {"EXIT", _ccp_exit},
     {"PAGE", _ccp_page},
     {"POKE", _ccp_poke},
+    {"PROF", _ccp_prof},
     {"VER", _ccp_ver},
     {"DUMP", _ccp_dump},
     {"VOL", _ccp_vol},
+    {"BOOT", _ccp_boottime},
+#ifdef BENCHMARK
+    {"BENCH", _ccp_bench},
+#endif
+#ifdef PCSAMPLE
+    {"SAMPLE", _ccp_sample},
+#endif
+#ifdef RUNCPM_TRACE
+    {"TRACE", _ccp_trace},
+#endif
+#ifdef IOLOG
+    {"IOLOG", _ccp_iolog},
+#endif
+#ifdef HIBERNATE
+    {"SUSPEND", _ccp_suspend},
+#endif
+#ifdef OVERLAY
+    {"OVERLAY", _ccp_overlay},
+#endif
 #endif
     {"?", _ccp_hlp},
     {NULL, NULL} // Sentinel
@@ -877,6 +1349,217 @@ const Command *_ccp_cnum(void) {
     return NULL; // External command
 } // _ccp_cnum
 
+// Where _ccp_find looks for a command, in this order
+enum {
+    CMD_HERE,   // On the drive given, or the current one, current user
+#ifdef ROMDISK
+    CMD_ROM,    // On the flash drive, when no drive was given
+#endif
+    CMD_A0,     // On A: user 0, when no drive was given
+    CMD_USER0,  // On the current drive user 0, when no drive was given
+    CMD_NONE    // Nowhere
+};
+
+#define CMD_CACHE 16
+
+// A command looked for before, in the context it was looked for
+typedef struct {
+    uint8 name[11];     // Name and type, as in CmdFCB
+    uint8 drive;        // Drive of CmdFCB
+    uint8 current;      // Current drive and user then, (user << 4) | drive
+    uint8 place;        // CMD_HERE to CMD_NONE
+} CmdPlace;
+
+static CmdPlace cmdCache[CMD_CACHE];
+static uint8 cmdCached = 0, cmdOldest = 0;
+static uint32 cmdChanges = 0, cmdFolders = 0; // fileChanges and fat32_dir_generation the cache is good for
+
+// Sets CmdFCB and the user for a place where commands are looked for, user
+// receives the user to set back when it is changed
+void _ccp_place(uint8 place, uint8 drive, uint8 *user) {
+#ifdef ROMDISK
+    if (place == CMD_ROM) { // Its files are in every user area
+        _RamWrite(CmdFCB, ROMDISK - '@');
+        place = CMD_HERE;
+    } else
+#endif
+    _RamWrite(CmdFCB, place == CMD_HERE ? drive : place == CMD_A0 ? 0x01 : 0x00);
+    if (place == CMD_HERE && *user) {
+        _ccp_bdos(F_USERNUM, currentUser);
+        *user = 0;
+    } else if (place != CMD_HERE && currentUser && !*user) {
+        *user = currentUser;
+        _ccp_bdos(F_USERNUM, 0x0000);
+    }
+} // _ccp_place
+
+// Opens the command in CmdFCB where CP/M looks for it: on its drive, then, if
+// no drive was given, on the flash drive, on A: user 0 and on the current
+// drive user 0. Where it was found, or that it was found nowhere, is cached
+// until a file is created, deleted or renamed, on the card or not, or a card is
+// mounted, so that a command already run costs a single F_OPEN, and an unknown
+// one none.
+// Returns TRUE if found, with the user left set to where it was
+uint8 _ccp_find(uint8 *user) {
+    uint8 drive = _RamRead(CmdFCB);
+    uint8 last = drive ? CMD_HERE : currentUser ? CMD_USER0 : CMD_A0;
+    uint8 current = (currentUser << 4) | currentDrive;
+    uint8 *name = _RamSysAddr(CmdFCB + 1);
+    CmdPlace *cached = NULL;
+    uint8 place, i;
+
+    if (cmdChanges != fileChanges || cmdFolders != fat32_dir_generation()) {
+        cmdChanges = fileChanges;
+        cmdFolders = fat32_dir_generation();
+        cmdCached = cmdOldest = 0;
+    }
+    for (i = 0; i < cmdCached && !cached; ++i)
+        if (cmdCache[i].drive == drive && cmdCache[i].current == current && !memcmp(cmdCache[i].name, name, 11))
+            cached = &cmdCache[i];
+    if (cached) {
+        if (cached->place == CMD_NONE) {
+            ++cacheHits[CACHE_COMMAND];
+            return FALSE;
+        }
+        _ccp_place(cached->place, drive, user);
+        if (!_ccp_bdos(F_OPEN, CmdFCB)) {
+            ++cacheHits[CACHE_COMMAND];
+            return TRUE;
+        }
+    } else {
+        if (cmdCached < CMD_CACHE) {
+            cached = &cmdCache[cmdCached++];
+        } else {
+            cached = &cmdCache[cmdOldest];
+            cmdOldest = (cmdOldest + 1) % CMD_CACHE;
+        }
+        memcpy(cached->name, name, 11);
+        cached->drive = drive;
+        cached->current = current;
+    }
+
+    ++cacheMisses[CACHE_COMMAND];
+    for (place = CMD_HERE; place <= last; ++place) {
+        _ccp_place(place, drive, user);
+        if (!_ccp_bdos(F_OPEN, CmdFCB)) {
+            cached->place = place;
+            return TRUE;
+        }
+    }
+    cached->place = CMD_NONE;
+    _ccp_place(CMD_HERE, drive, user); // restore previous drive and user
+    return FALSE;
+} // _ccp_find
+
+// Finds parameter n (1 to 9) of the command tail at defDMA, returns its length
+uint8 _ccp_subParam(uint8 n, uint16 *start) {
+    uint16 pos = defDMA + 1;
+    uint16 end = pos + _RamRead(defDMA);
+    uint8 len = 0;
+
+    while (n--) {
+        while (pos < end && _RamRead(pos) == ' ')
+            ++pos;
+        *start = pos;
+        for (len = 0; pos < end && _RamRead(pos) != ' '; ++pos)
+            ++len;
+    }
+    return (len);
+} // _ccp_subParam
+
+// Queues the lines of the .SUB file in CmdFCB as SUBMIT.COM would write them
+// to $$$.SUB: $1 to $9 are the parameters, $$ is a $ and ^X is a control
+// character. The lines are then read from memory, the file is neither
+// written nor scanned for, warm boots included. Returns FALSE when the batch
+// does not fit, it then runs with SUBMIT.COM. The lines are put together in
+// the TPA, after the file, so that submitQueue only changes once they all fit
+uint8 _ccp_submit(void) {
+    CcpStream file;
+    uint8 *text = _RamSysAddr(defLoad);
+    uint8 *queue = text + CCP_BUFFER;
+    size_t length = 0, i = 0;
+    uint16 end = 0, line, start = 0;
+    uint8 ch, len;
+
+    if (!_ccp_openstream(CmdFCB, &file))
+        return FALSE;
+    if (!_ccp_readstream(&file, text, CCP_BUFFER, &length) || length == CCP_BUFFER) {
+        _ccp_closestream(&file);
+        return FALSE;
+    }
+    _ccp_closestream(&file);
+
+    while (i < length && text[i] != 0x1a) {
+        line = end++;
+        for (; i < length && text[i] != 0x0a && text[i] != 0x1a; ++i) {
+            ch = text[i];
+            len = 1;
+            if (ch == 0x0d)
+                continue;
+            if (ch == '$' && i + 1 < length && text[i + 1] >= '1' && text[i + 1] <= '9') {
+                len = _ccp_subParam(text[++i] - '0', &start);
+            } else if ((ch == '$' && i + 1 < length && text[i + 1] == '$') ||
+                       (ch == '^' && i + 1 < length && toupper(text[i + 1]) >= '@' && toupper(text[i + 1]) <= '_')) {
+                ch = ch == '$' ? '$' : toupper(text[i + 1]) - '@';
+                ++i;
+            }
+            if (end + len > SUBMIT_SIZE)
+                return FALSE;
+            while (len--)
+                queue[end++] = start ? _RamRead(start++) : ch;
+            start = 0;
+        }
+        if (end > SUBMIT_SIZE || end - line - 1 > cmdLen)
+            return FALSE;
+        queue[line] = end - line - 1;
+        if (i < length && text[i] == 0x0a)
+            ++i;
+    }
+    memcpy(submitQueue, queue, end);
+    submitNext = 0;
+    submitEnd = end;
+    submitFlag = end != 0;
+    submitDeletes = batchDeletes;
+    return TRUE;
+} // _ccp_submit
+
+// Writes the lines of the native SUBMIT not run yet to $$$.SUB, last line in
+// the first record as SUBMIT.COM does, for a snapshot (see snapshot.h): after
+// the resume the batch goes on from the file
+void _ccp_submitSave(void) {
+    uint8 name[13] = {'A', FOLDERCHAR, '0', FOLDERCHAR, '$', '$', '$', '.', 'S', 'U', 'B', 0};
+    uint8 record[SEC_SIZE];
+    uint16 lines = 0, pos, n;
+    FILE *file;
+
+#ifndef BATCHA
+    name[0] = cDrive + 'A';
+#endif
+#ifndef BATCH0
+    name[2] = toupper(tohex(userCode));
+#endif
+    for (pos = submitNext; pos < submitEnd; pos += submitQueue[pos] + 1)
+        ++lines;
+    file = _sys_fopen_w(name);
+    while (file && lines--) {
+        for (pos = submitNext, n = 0; n < lines; ++n)
+            pos += submitQueue[pos] + 1;
+        memset(record, 0, sizeof(record));
+        memcpy(record, &submitQueue[pos], submitQueue[pos] + 1);
+        _sys_fwrite(record, 1, sizeof(record), file);
+    }
+    if (file)
+        _sys_fclose(file);
+    submitNext = submitEnd = 0;
+} // _ccp_submitSave
+
+// Points BatchFCB at the $$$.SUB the last _CheckSUB found, for _ccp_readInput
+void _ccp_batchFCB(void) {
+    for (uint8 i = 0; i < 36; ++i) {
+        _RamWrite(BatchFCB + i, _RamRead(tmpFCB + i));
+    }
+} // _ccp_batchFCB
+
 // External (.COM) command
 uint8 _ccp_ext(void) {
     bool error = TRUE, found = FALSE;
@@ -895,29 +1578,8 @@ uint8 _ccp_ext(void) {
             _RamWrite(CmdFCB + 11, 'M');
         }
 
-        drive = _RamRead(CmdFCB);           // Get the drive from the command FCB
-        found = !_ccp_bdos(F_OPEN, CmdFCB); // Look for the program on the FCB
-                                            // drive, current or specified
-        if (!found) {                       // If not found
-            if (!drive) {                   // and the search was on the default drive
-                _RamWrite(CmdFCB, 0x01);    // Then look on drive A: user 0
-                if (currentUser) {
-                    user = currentUser;           // Save the current user
-                    _ccp_bdos(F_USERNUM, 0x0000); // then set it to 0
-                }
-                found = !_ccp_bdos(F_OPEN, CmdFCB);
-                if (!found) {                               // If still not found then
-                    if (currentUser) {                      // If current user not = 0
-                        _RamWrite(CmdFCB, 0x00);            // look on current drive user 0
-                        found = !_ccp_bdos(F_OPEN, CmdFCB); // and try again
-                    }
-                }
-            }
-        }
-        if (!found) {
-            _RamWrite(CmdFCB, drive);      // restore previous drive
-            _ccp_bdos(F_USERNUM, currentUser); // restore to previous user
-        }
+        drive = _RamRead(CmdFCB);  // Get the drive from the command FCB
+        found = _ccp_find(&user); // Look for it where CP/M does
     }
 
     // if .COM not found then look for a .SUB file
@@ -927,31 +1589,13 @@ uint8 _ccp_ext(void) {
         _RamWrite(CmdFCB + 10, 'U');
         _RamWrite(CmdFCB + 11, 'B');
 
-        drive = _RamRead(CmdFCB);           // Get the drive from the command FCB
-        found = !_ccp_bdos(F_OPEN, CmdFCB); // Look for the program on the FCB
-                                            // drive, current or specified
-        if (!found) {                       // If not found
-            if (!drive) {                   // and the search was on the default drive
-                _RamWrite(CmdFCB, 0x01);    // Then look on drive A: user 0
-                if (currentUser) {
-                    user = currentUser;           // Save the current user
-                    _ccp_bdos(F_USERNUM, 0x0000); // then set it to 0
-                }
-                found = !_ccp_bdos(F_OPEN, CmdFCB);
-                if (!found) {                               // If still not found then
-                    if (currentUser) {                      // If current user not = 0
-                        _RamWrite(CmdFCB, 0x00);            // look on current drive user 0
-                        found = !_ccp_bdos(F_OPEN, CmdFCB); // and try again
-                    }
-                }
-            }
-        }
-        if (!found) {
-            _RamWrite(CmdFCB, drive);      // restore previous drive
-            _ccp_bdos(F_USERNUM, currentUser); // restore to previous user
-        }
+        drive = _RamRead(CmdFCB);  // Get the drive from the command FCB
+        found = _ccp_find(&user); // Look for it where CP/M does
 
-        if (found) {
+        if (found && _ccp_submit()) { // Runs from memory, without SUBMIT.COM
+            found = FALSE;
+            error = FALSE;
+        } else if (found) {
             //_puts(".SUB file found!\n");
             int i;
 
@@ -976,27 +1620,12 @@ uint8 _ccp_ext(void) {
             for (i = 0; i < s; i++)
                 _RamWrite(CmdFCB + i + 1, str[i]);
 
-            // now try to find SUBMIT.COM file
-            found =
-                !_ccp_bdos(F_OPEN, CmdFCB);  // Look for the program on the FCB
-                                             // drive, current or specified
-            if (!found) {                    // If not found
-                if (!drive) {                // and the search was on the default drive
-                    _RamWrite(CmdFCB, 0x01); // Then look on drive A: user 0
-                    if (currentUser) {
-                        user = currentUser;           // Save the current user
-                        _ccp_bdos(F_USERNUM, 0x0000); // then set it to 0
-                    }
-                    found = !_ccp_bdos(F_OPEN, CmdFCB);
-                    if (!found) {      // If still not found then
-                        if (currentUser) { // If current user not = 0
-                            _RamWrite(CmdFCB,
-                                      0x00);                    // look on current drive user 0
-                            found = !_ccp_bdos(F_OPEN, CmdFCB); // and try again
-                        }
-                    }
-                }
+            // now try to find SUBMIT.COM file, from the current user
+            if (user) {
+                _ccp_bdos(F_USERNUM, currentUser);
+                user = 0;
             }
+            found = _ccp_find(&user);
             if (found) {
                 // insert "@" into command buffer
                 // note: this is so the rest will be parsed correctly
@@ -1017,19 +1646,17 @@ uint8 _ccp_ext(void) {
 
     if (found) { // Program was found somewhere
         _puts("\r\n");
-        _ccp_bdos(F_DMAOFF, loadAddr);       // Sets the DMA address for the loading
-        while (!_ccp_bdos(F_READ, CmdFCB)) { // Loads the program into memory
-            loadAddr += 128;
-            if (loadAddr ==
-                BDOSjmppage) { // Breaks if it reaches the end of TPA
+        // Loads the program into memory in one read, up to the end of the TPA
+        CcpStream file;
+        size_t length = 0, room = BDOSjmppage - loadAddr;
+        if (_ccp_openstream(CmdFCB, &file)) {
+            _ccp_readstream(&file, _RamSysAddr(loadAddr), room, &length);
+            if (length == room && _ccp_streammore(&file))
                 _puts("\r\nNo Memory");
-                break;
-            }
-            _ccp_bdos(F_DMAOFF,
-                      loadAddr); // Points the DMA offset to the next loadAddr
+            _ccp_closestream(&file);
+            while ((length & (SEC_SIZE - 1)) && length < room) // Pads the last record as F_READ does
+                _RamWrite(loadAddr + length++, 0x1a);
         }
-        _ccp_bdos(F_DMAOFF,
-                  defDMA); // Points the DMA offset back to the default
 
         if (user) {                        // If a user was selected
             _ccp_bdos(F_USERNUM, currentUser); // Set it back
@@ -1053,7 +1680,13 @@ uint8 _ccp_ext(void) {
         PC = loadAddr;                       // Sets CP/M application jump point
         SP = BDOSjmppage;                    // Sets the stack to the top of the TPA
 
+#ifdef HIBERNATE
+        snapGuest = TRUE;
+#endif
         Z80run(cpuDelayInstructions); // Starts Z80 simulation
+#ifdef HIBERNATE
+        snapGuest = FALSE;
+#endif
         PC = 0;   // Resets the PC/SP after command execution
         SP = 0;
 
@@ -1080,12 +1713,23 @@ void _ccp_cmdError() {
     _puts("?\r\n");
 } // _ccp_cmdError
 
-// Reads input, either from the $$$.SUB or console
+// Reads input, either from the native SUBMIT, the $$$.SUB or console
 void _ccp_readInput(void) {
     uint8 i;
     uint8 chars;
 
-    if (submitFlag) {                             // Are we running a submit?
+    if (submitEnd) {                              // Are we running a native submit?
+        chars = submitQueue[submitNext++];
+        _RamWrite(inBuf + 1, chars);
+        for (i = 0; i < chars; ++i)
+            _RamWrite(inBuf + i + 2, submitQueue[submitNext++]);
+        _RamWrite(inBuf + i + 2, 0);
+        _puts((char *)_RamSysAddr(inBuf + 2));
+        if (submitNext == submitEnd) {
+            submitNext = submitEnd = 0;
+            submitFlag = FALSE;
+        }
+    } else if (submitFlag) {                      // Are we running a submit from $$$.SUB?
         if (!submitRecords) {                        // Are we already counting?
             _ccp_bdos(F_OPEN, BatchFCB);     // Open the batch file
             submitRecords = _RamRead(BatchFCB + 15); // Gets its record count
@@ -1105,6 +1749,10 @@ void _ccp_readInput(void) {
             submitFlag = FALSE;                 // and clears the submit flag
         }
     } else {
+#ifdef BENCHMARK
+        if (_benchNext(inBuf)) // Takes the next command line from a running benchmark
+            return;
+#endif
         _ccp_bdos(C_READSTR, inBuf); // Reads the command line from console
         if (Debug)
             Z80run(cpuDelayInstructions);
@@ -1160,15 +1808,21 @@ bool _ccp_parseDriveUser(bool *errorFlag) {
 }
 
 // Main CCP code
-void _ccp(void) {
-    uint8 i;
-
-    submitFlag = (bool)_ccp_bdos(DRV_ALLRESET, 0x0000);
-    _ccp_bdos(DRV_SET, currentDrive);
-
-    for (i = 0; i < 36; ++i) {
-        _RamWrite(BatchFCB + i, _RamRead(tmpFCB + i));
+// Resets the disks, checks for a pending submit and loads the autoexec file.
+// A native submit a program warm booted in the middle of carries on from
+// memory, with no look for a $$$.SUB, unless the program deleted $$$.SUB to
+// stop it
+void _ccp_boot(void) {
+    if (submitEnd && batchDeletes != submitDeletes)
+        submitNext = submitEnd = 0;
+    if (submitEnd) {
+        _ResetDisks();
+        submitFlag = TRUE;
+    } else {
+        submitFlag = (bool)_ccp_bdos(DRV_ALLRESET, 0x0000);
     }
+    _ccp_bdos(DRV_SET, currentDrive);
+    _ccp_batchFCB();
 
     // Loads an autoexec file if it exists and this is the first boot
     // The file contents are loaded at ccpAddr+8 up to 126 bytes then the size
@@ -1192,6 +1846,18 @@ void _ccp(void) {
         _RamWrite(inBuf + 1, 0); // Clears the buffer
         bufferLen = 0;
     }
+} // _ccp_boot
+
+void _ccp(void) {
+    uint8 i;
+
+#ifdef HIBERNATE
+    if (snapResumed && _snapResume()) { // Carries on from the snapshot
+        if ((Status == STATUS_EXIT) || (Status == STATUS_RESTART))
+            return; // The program resumed has ended
+    } else
+#endif
+        _ccp_boot();
 
     while (TRUE) {
         currentDrive = (uint8)_ccp_bdos(DRV_GET, 0x0000);  // Get current drive
@@ -1206,12 +1872,15 @@ void _ccp(void) {
                 submitFlag ? '$' : '>');
         if (!bufferLen) {
             _puts((char *)prompt);
+            _bootPrompt();
 
             _RamWrite(inBuf,
                       cmdLen); // Sets the buffer size to read the command line
             _ccp_readInput();
             if (Status == STATUS_RETURN)
                 Status = STATUS_RUNNING;
+            if (Status == STATUS_EXIT)
+                break; // Hibernated while typing
             bufferLen = _RamRead(inBuf + 1); // Obtains the number of bytes read
         }
 
@@ -1290,6 +1959,7 @@ void _ccp(void) {
             cDrive = oDrive = currentDrive; // Restore cDrive and oDrive
             if (i)
                 _ccp_cmdError();
+            _SyncDisks(); // The command has ended, the card is left as it left it
         }
         bufferLen = 0;
         if ((Status == STATUS_EXIT) || (Status == STATUS_RESTART))
@@ -28,6 +28,20 @@ void _puts(const char *str) // Puts a \0 terminated string
         _putcon(*(str++));
 }
 
+void _putspan(uint8 *str, uint32 len) // Puts len characters at once, masked in place
+{
+    for (uint32 i = 0; i < len; ++i)
+        str[i] &= mask8bit;
+#ifdef STREAMIO
+    if (consoleOutputActive)
+        _putchs(str, len);
+    if (streamOutputFile)
+        fwrite(str, 1, len, streamOutputFile);
+#else
+    _putchs(str, len);
+#endif
+}
+
 void _puthex8(uint8 c) // Puts a HH hex string
 {
     _putcon(tohex(c >> 4));
@@ -82,6 +96,10 @@ uint8 _chready(void) // Checks if there's a character ready for input
         return 0xff;
     // TODO: Consider adding/keeping _abort_if_kbd_eof() here.
     _abort_if_kbd_eof();
+#endif
+#ifdef BENCHMARK
+    if (benchKeys && *benchKeys)
+        return 0xff;
 #endif
     return (_kbhit() ? 0xff : 0x00);
 }
@@ -93,6 +111,10 @@ uint8 _getconNB(void) // Gets a character, non-blocking, no echo
         return _getStreamInChar();
     // TODO: Consider adding/keeping _abort_if_kbd_eof() here.
     _abort_if_kbd_eof();
+#endif
+#ifdef BENCHMARK
+    if (benchKeys && *benchKeys)
+        return *benchKeys++;
 #endif
     return (_kbhit() ? _getch() : 0x00);
 }
@@ -104,6 +126,10 @@ uint8 _getcon(void) // Gets a character, blocking, no echo
         return _getStreamInChar();
     // TODO: Consider adding/keeping _abort_if_kbd_eof() here.
     _abort_if_kbd_eof();
+#endif
+#ifdef BENCHMARK
+    if (benchKeys && *benchKeys)
+        return *benchKeys++;
 #endif
     return _getch();
 }
@@ -115,6 +141,12 @@ uint8 _getconE(void) // Gets a character, blocking, with echo
         return _getStreamInCharEcho();
     // TODO: Consider adding/keeping _abort_if_kbd_eof() here.
     _abort_if_kbd_eof();
+#endif
+#ifdef BENCHMARK
+    if (benchKeys && *benchKeys) {
+        _putcon(*benchKeys);
+        return *benchKeys++;
+    }
 #endif
     return _getche();
 }
@@ -291,6 +291,9 @@ void _PatchCPM(void) {
         }
     }
     physicalExtentBytes = logicalExtentBytes * (extentMask + 1);
+#ifdef DISKIMAGE
+    _dsk_patch();
+#endif
 } // _PatchCPM
 
 #ifdef DEBUGLOG
@@ -549,10 +552,20 @@ void _logBdosOut(uint8 ch) {
 void _Bios(void) {
     uint8 ch = LOW_REGISTER(PCX);
     uint8 disk[2] = {'A', 0};
+    uint64 profStart = _profStart();
+    uint32 traceStart = trace_begin();
 
 #ifdef DEBUGLOG
     _logBiosIn(ch);
 #endif
+#ifdef BENCHMARK
+    ++benchBiosCalls;
+#endif
+    ++hostBiosCalls;
+#ifdef HIBERNATE
+    if (_snapTrap())
+        return; // Hibernated, the call is made again on resume
+#endif
 
     switch (ch) {
     case B_BOOT: {
@@ -595,14 +608,25 @@ void _Bios(void) {
     case B_SELDSK: { // 9 - Select disk drive
         disk[0] += LOW_REGISTER(BC);
         HL = 0x0000;
+#ifdef DISKIMAGE
+        if (_dsk_seldsk(LOW_REGISTER(BC)))
+            HL = DSK_DPHaddr;
+        else
+#endif
         if (_sys_select(&disk[0]))
             HL = DPHaddr;
         break;
     }
     case B_SETTRK: { // 10 - Set track number
+#ifdef DISKIMAGE
+        _dsk_settrk(BC);
+#endif
         break;
     }
     case B_SETSEC: { // 11 - Set sector number
+#ifdef DISKIMAGE
+        _dsk_setsec(BC);
+#endif
         break;
     }
     case B_SETDMA: { // 12 - Set DMA address
@@ -611,11 +635,19 @@ void _Bios(void) {
         break;
     }
     case B_READ: { // 13 - Read selected sector
-        SET_HIGH_REGISTER(AF, 0x00);
+        uint8 result = 0x00;
+#ifdef DISKIMAGE
+        _dsk_biosio(FALSE, 0, &result); // Only the images have sectors
+#endif
+        SET_HIGH_REGISTER(AF, result);
         break;
     }
     case B_WRITE: { // 14 - Write selected sector
-        SET_HIGH_REGISTER(AF, 0x00);
+        uint8 result = 0x00;
+#ifdef DISKIMAGE
+        _dsk_biosio(TRUE, LOW_REGISTER(BC), &result);
+#endif
+        SET_HIGH_REGISTER(AF, result);
         break;
     }
     case B_LISTST: { // 15 - Get list device status
@@ -698,6 +730,8 @@ void _Bios(void) {
         break;
     }
     } // switch
+    _profRecord(_profEntry(TRUE, ch), profStart);
+    trace_end(TRACE_BIOS, ch, traceStart);
 #ifdef DEBUGLOG
     _logBiosOut(ch);
 #endif
@@ -705,10 +739,20 @@ void _Bios(void) {
 
 void _Bdos(void) {
     uint8 ch = LOW_REGISTER(BC);
+    uint64 profStart = _profStart();
+    uint32 traceStart = trace_begin();
 
 #ifdef DEBUGLOG
     _logBdosIn(ch);
 #endif
+#ifdef BENCHMARK
+    ++benchBdosCalls;
+#endif
+    _hostCountBdos(ch);
+#ifdef HIBERNATE
+    if (_snapTrap())
+        return; // Hibernated, the call is made again on resume
+#endif
 
     HL = 0x0000;                            // HL is reset by the BDOS
     SET_LOW_REGISTER(BC, LOW_REGISTER(DE)); // C ends up equal to E
@@ -1120,10 +1164,7 @@ void _Bdos(void) {
        C = 13 (0Dh) : Reset disk system
      */
     case DRV_ALLRESET: {
-        roVector = 0; // Make all drives R/W
-        loginVector = 0;
-        dmaAddr = 0x0080;
-        cDrive = 0;       // userCode remains unchanged
+        _ResetDisks();
         HL = _CheckSUB(); // Checks if there's a $$$.SUB on the boot disk
         break;
     }
@@ -1186,6 +1227,8 @@ void _Bdos(void) {
        C = 19 (13h) : Delete file
      */
     case F_DELETE: {
+        if (!memcmp(_RamSysAddr(DE + 1), "$$$     SUB", 11))
+            ++batchDeletes; // Whether the file is there or the batch runs from memory
         HL = _DeleteFile(DE);
         break;
     }
@@ -1277,10 +1320,10 @@ void _Bdos(void) {
     }
 
     /*
-       C = 30 (1Eh) : Set file attributes (does nothing)
+       C = 30 (1Eh) : Set file attributes (kept on the disk images only)
      */
     case F_ATTRIB: {
-        HL = 0;
+        HL = _SetAttributes(DE);
         break;
     }
 
@@ -1289,6 +1332,10 @@ void _Bdos(void) {
      */
     case DRV_PDB: {
         HL = DPBaddr;
+#ifdef DISKIMAGE
+        if (_dsk_slot(cDrive) != 0xff)
+            HL = DSK_DPBaddr;
+#endif
         break;
     }
 
@@ -1343,6 +1390,9 @@ void _Bdos(void) {
      */
     case DRV_RESET: {
         roVector = roVector & ~DE;
+#ifdef DISKIMAGE
+        _dsk_reset();
+#endif
         break;
     }
 
@@ -1813,6 +1863,8 @@ void _Bdos(void) {
     // CP/M BDOS does this before returning
     SET_HIGH_REGISTER(BC, HIGH_REGISTER(HL));
     SET_HIGH_REGISTER(AF, LOW_REGISTER(HL));
+    _profRecord(_profEntry(FALSE, ch), profStart);
+    trace_end(TRACE_BDOS, ch, traceStart);
 
 #ifdef DEBUGLOG
     _logBdosOut(ch);
@@ -1042,10 +1042,14 @@ static inline void Z80reset(void) {
 	#endif
 }
 
-#if defined(DEBUG) || defined(iDEBUG)
+#if defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE)
 #include "debug.h"
 #endif
 
+#ifdef BENCHMARK
+static const uint8 z80_tstates_main[256]; // Defined in cpu_mhz.h
+#endif
+
 static inline void Z80run(uint32 cpu_delay) {
 	uint32 temp = 0;
 	uint32 acu;
@@ -1099,6 +1103,20 @@ static inline void Z80run(uint32 cpu_delay) {
 	PCX = PC;
 	INCR(1); /* Add one M1 cycle to refresh counter */
 
+#ifdef BENCHMARK
+	/* prefixed (CB/DD/ED/FD) instructions are counted at the prefix's 4 T-states */
+	benchCycles += z80_tstates_main[RAM[PCX & 0xffff]];
+	++benchInstructions;
+#endif
+
+#ifdef PCSAMPLE
+	if (pcsPeriod && !--pcsCountdown) {
+		pcsCountdown = pcsPeriod;
+		++pcsCounts[(PCX & 0xffff) >> PCS_SHIFT];
+		pcsLastPC[(PCX & 0xffff) >> PCS_SHIFT] = PCX;
+	}
+#endif
+
 	/* push instruction into trace (before it is executed) */
 #if defined(DEBUG) || defined(iDEBUG)
 	z80_trace_push(PCX);
@@ -226,7 +226,7 @@ static inline void Z80reset(void) {
 	#endif
 }
 
-#if defined(DEBUG) || defined(iDEBUG)
+#if defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE)
 #include "debug.h"
 #endif
 
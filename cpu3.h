@@ -226,7 +226,7 @@ static void alu(uint8 op, uint8 val) {
     }
 }
 
-#if defined(DEBUG) || defined(iDEBUG)
+#if defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE)
 #include "debug.h"
 #endif
 
@@ -226,9 +226,10 @@ static void alu(uint8 op, uint8 val) {
     }
 }
 
-#if defined(DEBUG) || defined(iDEBUG)
+#if defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE)
 #include "debug.h"
-#else
+#endif
+#if !defined(DEBUG) && !defined(iDEBUG)
 static void Z80debug(void) {}
 #endif
 
@@ -24,9 +24,9 @@ static const uint8 z80_tstates_main[256] = {
 };
 
 /* Run a small Z80 code and measure the time to estimate emulated clock.
-   This will load a small z80 code into RAM, run it until halt, then compute the 
-   estimated clock at which the CPU is running */
-void Z80estimateClock(void) {
+   This will load a small z80 code into RAM, run it until halt, then return
+   the time it took in ms. Z80clockTstates() is the number of T-states it runs */
+uint32 Z80estimateClock(void) {
 	const uint8 testCode[] = {
 #ifdef ARDUINO
 		0x11, 0xF4, 0x01, // LD DE, 500
@@ -67,7 +67,16 @@ void Z80estimateClock(void) {
 	
 	// End timing
 	time_now = millis();
-	
+
+	// Reset CPU
+	Z80reset();
+
+    // Elapsed time in milliseconds
+    if (time_now == time_start) return 1; // Prevent division by zero
+    return (uint32)(time_now - time_start);
+}
+
+uint64 Z80clockTstates(void) {
 	// Calculate total T-states executed
 	uint8 t_ld_de = z80_tstates_main[0x11];
 	uint8 t_ld_bc = z80_tstates_main[0x01];
@@ -94,25 +103,23 @@ void Z80estimateClock(void) {
 	uint64 total_outer = t_ld_de + (outer_iters - 1) * outer_body + outer_exit;
 
 	// Final T-states count (full count, not in millions)
-    uint64 tstates = total_outer + t_halt;
+    return total_outer + t_halt;
+}
 
-    // Calculate elapsed time in milliseconds
-    uint64 elapsedTime = time_now - time_start;
+/* Prints the clock estimated from a run of Z80estimateClock() */
+void Z80printClock(uint32 elapsedTime) {
+    uint64 tstates = Z80clockTstates();
 
     // Estimate clock speed in Hz
-    if (elapsedTime == 0) elapsedTime = 1; // Prevent division by zero
     uint64 estimatedHz = (tstates * 1000) / elapsedTime;
 
     // Convert to MHz
     uint32 estimatedMHz = (uint32)(estimatedHz / 1000000);
     char buffer[64];
-    sprintf(buffer, "%llu T-states in %llu ms\r\n", tstates, elapsedTime);
+    sprintf(buffer, "%llu T-states in %lu ms\r\n", tstates, (unsigned long)elapsedTime);
     _puts(buffer);
     sprintf(buffer, "Estimated Z80 clock speed: %u MHz\r\n", estimatedMHz);
     _puts(buffer);
-	
-	// Reset CPU
-	Z80reset();
 }
 
 #endif // CPU_MHZ_H
@@ -1,8 +1,9 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-/* Mnemonic tables for Z80 disassembly - shared by all CPU models */
-#if defined(DEBUG) || defined(iDEBUG)
+/* Mnemonic tables for Z80 disassembly - shared by all CPU models
+   With PCSAMPLE alone only the disassembler (Disasm) is built, for the sampler report */
+#if defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE)
 
 static const char* Mnemonics[256] =
 {
@@ -227,8 +228,9 @@ static const char* CPMCalls[41] =
 
 int32 Watch = -1;
 
-#endif /* defined(DEBUG) || defined(iDEBUG) */
+#endif /* defined(DEBUG) || defined(iDEBUG) || defined(PCSAMPLE) */
 
+#if defined(DEBUG) || defined(iDEBUG)
 void watchprint(uint16 pos) {
     uint8 I, J;
     _puts("\r\n");
@@ -422,6 +424,7 @@ static int read_hex16(uint16 *out) {
     *out = (uint16)(v & 0xFFFFu);
     return 1;
 }
+#endif /* defined(DEBUG) || defined(iDEBUG) */
 
 /* Read opcode prefixes from memory at 'pos', advance pos to the
    first operand byte and return the mnemonic pointer. It also returns the
@@ -532,7 +535,7 @@ static uint8 InstructionLength(uint16 pos) {
 }
 
 /* TextLength - compute the length of the text representation of the instruction at pos */
-static uint8 TextLength(uint16 pos) {
+static uint8 __attribute__((unused)) TextLength(uint16 pos) {
     uint8 len = 0;
     const char *txt = GetMnemonicAt(&pos, &len, NULL);
     len = 0;
@@ -630,6 +633,7 @@ uint8 Disasm(uint16 pos) {
     return (len);
 }
 
+#if defined(DEBUG) || defined(iDEBUG)
 /* --- Simple instruction trace buffer and exec breakpoints ---
    Implemented inline here to avoid changing platform Makefiles.
    Trace records last N executed instructions (pc, bytes, len, reg snapshot).
@@ -1056,5 +1060,6 @@ void Z80debug(void) {
         }
     }
 }
+#endif /* defined(DEBUG) || defined(iDEBUG) */
 
 #endif // ifndef DEBUG_H
\ No newline at end of file
@@ -41,6 +41,40 @@ void _error(uint8 error) {
     Status = STATUS_RESTART;
 }
 
+// Writes back what is kept in RAM for the card: the cache of the disk images
+// and the clusters reserved for the file written last. Called when a command
+// ends and while waiting on a key, as the PicoCalc is usually switched off
+// rather than shut down. 0x00, or 0xff on an error
+uint8 _SyncDisks(void) {
+    uint8 result = 0x00;
+
+#ifdef DISKIMAGE
+    result = _dsk_flush(0xff);
+#endif
+    if (fat32_sync() != FAT32_OK && fat32_is_ready())
+        result = 0xff;
+    return (result);
+}
+
+// Resets the disk system as BDOS function 13 does, without the look for a $$$.SUB
+void _ResetDisks(void) {
+    roVector = 0; // Make all drives R/W
+    loginVector = 0;
+    dmaAddr = 0x0080;
+    cDrive = 0;   // userCode remains unchanged
+#ifdef DISKIMAGE
+    _dsk_reset();
+#endif
+    fat32_sync(); // Frees what was reserved for the file written last
+}
+
+#ifdef STREAMIO
+// runcpm-host can exit in the middle of a program, at the end of its -i input
+void _SyncDisksAtExit(void) {
+    _SyncDisks();
+}
+#endif
+
 // Selects the disk to be used by the next disk function
 int _SelectDisk(uint8 dr) {
     uint8 result = 0xff;
@@ -53,7 +87,11 @@ int _SelectDisk(uint8 dr) {
     }
 
     disk[0] += dr;
+#ifdef DISKIMAGE
+    if (_dsk_slot(dr) != 0xff || _sys_select(&disk[0])) {
+#else
     if (_sys_select(&disk[0])) {
+#endif
         loginVector = loginVector | (1 << (disk[0] - 'A'));
         result = 0x00;
     } else {
@@ -291,6 +329,10 @@ long _FileSize(uint16 fcbaddr) {
     long r, l = -1;
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_filesize(fcbaddr));
+#endif
         _FCBtoHostname(fcbaddr, &filename[0]);
         l = _sys_filesize(filename);
         if (l != -1) {
@@ -310,6 +352,10 @@ uint8 _OpenFile(uint16 fcbaddr) {
     int32 i;
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_open(fcbaddr));
+#endif
         _FCBtoHostname(fcbaddr, &filename[0]);
         if (!filename[4])
             return (result); // Invalid filename
@@ -343,6 +389,10 @@ uint8 _CloseFile(uint16 fcbaddr) {
     uint8 result = 0xff;
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_close(fcbaddr));
+#endif
         if (!(F->s2 & 0x80)) { // if file is modified
             if (!RW) {
                 _FCBtoHostname(fcbaddr, &filename[0]);
@@ -369,6 +419,10 @@ uint8 _MakeFile(uint16 fcbaddr) {
 
     if (!_SelectDisk(F->dr)) {
         if (!RW) {
+#ifdef DISKIMAGE
+            if (_dsk_fcbslot(fcbaddr) != 0xff)
+                return (_dsk_make(fcbaddr));
+#endif
             _FCBtoHostname(fcbaddr, &filename[0]);
             if (!filename[4])
                 return (result); // Invalid filename
@@ -395,6 +449,11 @@ uint8 _SearchFirst(uint16 fcbaddr, uint8 isdir) {
     uint8 result = 0xff;
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        dskSearchSlot = 0xff;
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_search(fcbaddr, isdir, TRUE));
+#endif
         _FCBtoHostname(fcbaddr, &filename[0]);
         if (!filename[4])
             return (result); // Invalid filename
@@ -414,6 +473,10 @@ uint8 _SearchNext(uint16 fcbaddr, uint8 isdir) {
     CPM_FCB *F = (CPM_FCB *)_RamSysAddr(tmpFCB);
     uint8 result = 0xff;
 
+#ifdef DISKIMAGE
+    if (dskSearchSlot != 0xff)
+        return (_dsk_search(fcbaddr, isdir, FALSE));
+#endif
     if (!_SelectDisk(F->dr)) {
         if (allUsers) {
             result = _findnextallusers(isdir);
@@ -435,6 +498,10 @@ uint8 _DeleteFile(uint16 fcbaddr) {
 
     if (!_SelectDisk(F->dr)) {
         if (!RW) {
+#ifdef DISKIMAGE
+            if (_dsk_fcbslot(fcbaddr) != 0xff)
+                return (_dsk_delete(fcbaddr));
+#endif
             result = _SearchFirst(fcbaddr, FALSE); // FALSE = Does not create a fake dir entry when finding the file
             while (result != 0xff) {
 #ifdef USE_PUN
@@ -450,13 +517,16 @@ uint8 _DeleteFile(uint16 fcbaddr) {
                 }
 #endif
                 _FCBtoHostname(tmpFCB, &filename[0]);
-                if (_sys_deletefile(&filename[0])) {
+                if (_sys_deletefound(&filename[0])) {
                     deleted = 0x00;
                 } else {
                     _error(errWRITEPROT);
                     break;
                 }
-                result = _SearchFirst(fcbaddr, FALSE); // FALSE = Does not create a fake dir entry when finding the file
+                result = _SearchNext(fcbaddr, FALSE); // One pass, the files found are deleted together
+            }
+            if (!_sys_deleteflush() && deleted == 0x00) {
+                _error(errWRITEPROT);
             }
         } else {
             _error(errWRITEPROT);
@@ -472,6 +542,10 @@ uint8 _RenameFile(uint16 fcbaddr) {
 
     if (!_SelectDisk(F->dr)) {
         if (!RW) {
+#ifdef DISKIMAGE
+            if (_dsk_fcbslot(fcbaddr) != 0xff)
+                return (_dsk_rename(fcbaddr));
+#endif
             _RamWrite(fcbaddr + 16, _RamRead(fcbaddr)); // Prevents rename from moving files between folders
             _FCBtoHostname(fcbaddr + 16, &newname[0]);
             _FCBtoHostname(fcbaddr, &filename[0]);
@@ -498,6 +572,10 @@ uint8 _ReadSeq(uint16 fcbaddr) {
                 (F->cr * BlkSZ);
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_readseq(fcbaddr));
+#endif
         _FCBtoHostname(fcbaddr, &filename[0]);
         result = _sys_readseq(&filename[0], fpos);
         if (!result) { // Read succeeded, adjust FCB
@@ -531,6 +609,10 @@ uint8 _WriteSeq(uint16 fcbaddr) {
 
     if (!_SelectDisk(F->dr)) {
         if (!RW) {
+#ifdef DISKIMAGE
+            if (_dsk_fcbslot(fcbaddr) != 0xff)
+                return (_dsk_writeseq(fcbaddr));
+#endif
             _FCBtoHostname(fcbaddr, &filename[0]);
             result = _sys_writeseq(&filename[0], fpos);
             if (!result) { // Write succeeded, adjust FCB
@@ -580,6 +662,10 @@ uint8 _ReadRand(uint16 fcbaddr) {
     long fpos = record * BlkSZ;
 
     if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff)
+            return (_dsk_random(fcbaddr, FALSE));
+#endif
         _FCBtoHostname(fcbaddr, &filename[0]);
         result = _sys_readrand(&filename[0], fpos);
         if (result == 0 || result == 1 || result == 4) {
@@ -603,6 +689,10 @@ uint8 _WriteRand(uint16 fcbaddr) {
 
     if (!_SelectDisk(F->dr)) {
         if (!RW) {
+#ifdef DISKIMAGE
+            if (_dsk_fcbslot(fcbaddr) != 0xff)
+                return (_dsk_random(fcbaddr, TRUE));
+#endif
             _FCBtoHostname(fcbaddr, &filename[0]);
             result = _sys_writerand(&filename[0], fpos);
             if (!result) { // Write succeeded, adjust FCB
@@ -637,7 +727,7 @@ uint8 _SetRandom(uint16 fcbaddr) {
     CPM_FCB *F = (CPM_FCB *)_RamSysAddr(fcbaddr);
     uint8 result = 0x00;
 
-    int32 count = F->cr & (MaxCR - 1);
+    int32 count = F->cr & MaxCR ? MaxCR : F->cr; // CR is left at MaxCR at the end of an extent of an image
     count += (F->ex & MaxEX) << 7;
     count += (F->s2 & MaxS2) << 12;
 
@@ -659,6 +749,24 @@ void _SetUser(uint8 user) {
         _MakeUserDir(); // Creates the user dir (0-F[G-V]) if needed
 }
 
+// Sets the attributes of a file, kept only on the disk images
+uint8 _SetAttributes(uint16 fcbaddr) {
+    CPM_FCB *F = (CPM_FCB *)_RamSysAddr(fcbaddr);
+    uint8 result = 0x00;
+
+    if (!_SelectDisk(F->dr)) {
+#ifdef DISKIMAGE
+        if (_dsk_fcbslot(fcbaddr) != 0xff) {
+            if (!RW)
+                result = _dsk_attrib(fcbaddr);
+            else
+                _error(errWRITEPROT);
+        }
+#endif
+    }
+    return (result);
+}
+
 // Creates a disk directory folder
 uint8 _MakeDisk(uint16 fcbaddr) {
     CPM_FCB *F = (CPM_FCB *)_RamSysAddr(fcbaddr);
@@ -0,0 +1,734 @@
+#ifndef DISKIMG_H
+#define DISKIMG_H
+
+/* Disk image drives
+
+   A drive B: to P: is a CP/M disk image instead of a folder when the card has
+   an image file for it in its root, C.DSK for C:. The image has the 8 MB hard
+   disk format of RomWBW (hd1k, cpmtools -f wbw_hd1k): 512 byte sectors, 16 to
+   a track, 2 system tracks, 4 KB blocks and 1024 directory entries.
+
+   The BDOS calls of disk.h work on an image as CP/M does, with its own
+   directory and allocation: the FCB holds the blocks of the extent, a record
+   is found by arithmetic on them, and the allocation vector of a drive is
+   built from the directory the first time it is used. The BIOS SELDSK,
+   SETTRK, SETSEC, READ and WRITE reach the same sectors, for the tools that
+   work on the disk instead of the files.
+
+   The image is read and written through a write back cache of DSK_CACHE lines
+   of DSK_LINE bytes, 8 records and 2 SD sectors moved by a single fat32_read
+   or fat32_write. A miss reads the whole line, and the dirty lines go back to
+   the card, in image order, when a file is closed, on a disk reset (every
+   warm boot), when they are evicted, before a hibernation and when RunCPM
+   stops. DSK_DRIVES images are open at a time.
+   The overlay (see abstraction_picocalc.h) does not cover the images.
+*/
+
+#ifndef DSK_DRIVES
+#define DSK_DRIVES 2
+#endif
+#ifndef DSK_CACHE
+#define DSK_CACHE 4
+#endif
+#define DSK_LINE 1024                   // Bytes in a cache line
+#define DSK_BATCH 16                    // Search results sized in one pass over the directory
+#define DSK_IMAGE "%c.DSK"              // Image of a drive, in the root of the card
+
+// Disk parameters of the images (RomWBW hd1k)
+#define DSK_SPT 64                      // Records per track
+#define DSK_BSH 5                       // Block shift, 4 KB blocks
+#define DSK_BLM 31                      // Block mask
+#define DSK_EXM 1                       // Extent mask, two 16 KB extents to a directory entry
+#define DSK_DSM 2043                    // Blocks - 1
+#define DSK_DRM 1023                    // Directory entries - 1
+#define DSK_AL0 0xFF                    // The directory takes blocks 0 to 7
+#define DSK_AL1 0x00
+#define DSK_OFF 2                       // System tracks
+#define DSK_DIRREC (DSK_OFF * DSK_SPT)  // First record of the directory
+
+// The DPB and DPH of the images follow those of the folder drives, in the BIOS page
+#define DSK_DPBaddr (DPHaddr + 16)
+#define DSK_DPHaddr (DSK_DPBaddr + 15)
+
+typedef struct {
+    fat32_file_t file;
+    uint8 drive;                        // 1 = B:, 0 when the slot is free (A: is never an image)
+    uint8 alv[(DSK_DSM + 8) / 8];       // Allocation vector, a bit for each block in use
+} DskDrive;
+
+typedef struct {
+    uint8 slot;                         // dskDrives index, 0xff when the line is free
+    uint8 dirty;
+    uint32 line;                        // Byte offset in the image / DSK_LINE
+    uint32 used;                        // dskClock when last used
+} DskLine;
+
+static DskDrive dskDrives[DSK_DRIVES];
+static DskLine dskLines[DSK_CACHE];
+static uint8 dskData[DSK_CACHE][DSK_LINE];
+static uint32 dskClock = 0;
+static uint16 dskVector = 0;            // Drives that have an image
+static uint8 dskScanned = FALSE;        // dskVector is good for dskMounts
+static uint32 dskMounts = 0;
+static uint8 dskNextSlot = 0;           // Slot reused when all are taken
+static uint8 dskBiosDrive = 0;          // BIOS SELDSK, SETTRK and SETSEC
+static uint16 dskTrack = 0, dskSector = 0;
+static uint8 dskBiosWrites = FALSE;     // BIOS WRITE changed a directory, the allocation vectors are rebuilt
+static uint8 dskPattern[15];            // The FCB of the search, and where it is at
+static uint16 dskNext = 0;
+static uint8 dskSearchSlot = 0xff;
+
+// The next results of the search, with their sizes
+typedef struct {
+    uint16 n;                           // Directory entry
+    uint8 name[12];                     // User and name
+    uint32 records;                     // Of the file, from all its entries
+} DskFound;
+
+static DskFound dskFound[DSK_BATCH];
+static uint8 dskFoundCount = 0, dskFoundNext = 0;
+
+// Writes the dirty cache lines of slot, or of all slots for 0xff, in image order.
+// A line stays dirty until it is written
+uint8 _dsk_flush(uint8 slot) {
+    uint8 filler[BlkSZ];
+    DskLine *first, *last = NULL;
+    fat32_file_t *file;
+    uint32 offset;
+    size_t written;
+    uint8 result = 0x00;
+    uint8 ok;
+
+    while (TRUE) {
+        first = NULL;
+        for (uint8 i = 0; i < DSK_CACHE; ++i)
+            if (dskLines[i].dirty && (slot == 0xff || dskLines[i].slot == slot) &&
+                (!last || dskLines[i].slot > last->slot ||
+                 (dskLines[i].slot == last->slot && dskLines[i].line > last->line)) &&
+                (!first || dskLines[i].slot < first->slot ||
+                 (dskLines[i].slot == first->slot && dskLines[i].line < first->line)))
+                first = &dskLines[i];
+        if (!first)
+            break;
+        last = first;
+        file = &dskDrives[first->slot].file;
+        offset = first->line * DSK_LINE;
+        // An image shorter than the disk grows up to the line, as if formatted
+        memset(filler, 0xE5, sizeof(filler));
+        if (fat32_size(file) < offset + DSK_LINE)
+            fat32_reserve(file, offset + DSK_LINE); // Just what it needs, it stays open
+        ok = TRUE;
+        while (ok && fat32_size(file) < offset)
+            ok = fat32_seek(file, fat32_size(file)) == FAT32_OK &&
+                 fat32_write(file, filler, BlkSZ, &written) == FAT32_OK;
+        if (ok && fat32_seek(file, offset) == FAT32_OK &&
+            fat32_write(file, dskData[first - dskLines], DSK_LINE, &written) == FAT32_OK)
+            first->dirty = FALSE;
+        else
+            result = 0xff;
+    }
+    return (result);
+}
+
+// The record of the image of slot in the cache, read in when missing, NULL on
+// an SD error. write marks its line dirty
+uint8 *_dsk_record(uint8 slot, uint32 record, uint8 write) {
+    uint32 line = record / (DSK_LINE / BlkSZ);
+    DskLine *found = NULL, *oldest = &dskLines[0];
+    size_t length = 0;
+    uint8 i;
+
+    for (i = 0; i < DSK_CACHE && !found; ++i) {
+        if (dskLines[i].slot == slot && dskLines[i].line == line)
+            found = &dskLines[i];
+        else if (dskLines[i].slot == 0xff || (oldest->slot != 0xff && dskLines[i].used < oldest->used))
+            oldest = &dskLines[i];
+    }
+    if (found) {
+        ++cacheHits[CACHE_IMAGE];
+    } else {
+        ++cacheMisses[CACHE_IMAGE];
+        found = oldest;
+        if (found->dirty && _dsk_flush(found->slot))
+            return (NULL);
+        found->slot = 0xff;
+        i = found - dskLines;
+        if (fat32_seek(&dskDrives[slot].file, line * DSK_LINE) != FAT32_OK ||
+            fat32_read(&dskDrives[slot].file, dskData[i], DSK_LINE, &length) != FAT32_OK)
+            length = 0;
+        memset(dskData[i] + length, 0xE5, DSK_LINE - length); // Past the end of the image, as formatted
+        found->slot = slot;
+        found->line = line;
+    }
+    found->used = ++dskClock;
+    if (write)
+        found->dirty = TRUE;
+    return (dskData[found - dskLines] + (record % (DSK_LINE / BlkSZ)) * BlkSZ);
+}
+
+// Directory entry n of the image of slot
+uint8 *_dsk_entry(uint8 slot, uint16 n, uint8 write) {
+    uint8 *record = _dsk_record(slot, DSK_DIRREC + n / 4, write);
+    return (record ? record + (n & 3) * 32 : NULL);
+}
+
+// Block i of the allocation of an FCB or a directory entry
+#define _dsk_block(e, i) ((e)[16 + 2 * (i)] | ((e)[17 + 2 * (i)] << 8))
+#define _dsk_setblock(e, i, b) ((e)[16 + 2 * (i)] = (b) & 0xff, (e)[17 + 2 * (i)] = (b) >> 8)
+
+// Builds the allocation vector of slot from its directory
+void _dsk_login(uint8 slot) {
+    uint8 *alv = dskDrives[slot].alv;
+    uint8 *e;
+    uint16 b;
+
+    memset(alv, 0, sizeof(dskDrives[slot].alv));
+    alv[0] = DSK_AL0;
+    alv[1] = DSK_AL1;
+    for (uint16 n = 0; n <= DSK_DRM; ++n) {
+        e = _dsk_entry(slot, n, FALSE);
+        if (!e)
+            return;
+        if (e[0] < 0x20) // Files, not the labels and time stamps of CP/M 3
+            for (uint8 i = 0; i < 8; ++i)
+                if ((b = _dsk_block(e, i)) && b <= DSK_DSM)
+                    alv[b >> 3] |= 0x80 >> (b & 7);
+    }
+}
+
+// Looks for the images on the card again, after a disk reset or a new card
+void _dsk_scan(void) {
+    char name[8];
+
+    _dsk_flush(0xff);
+    for (uint8 i = 0; i < DSK_DRIVES; ++i) {
+        if (dskDrives[i].drive)
+            fat32_close(&dskDrives[i].file);
+        dskDrives[i].drive = 0;
+    }
+    for (uint8 i = 0; i < DSK_CACHE; ++i)
+        dskLines[i].slot = 0xff;
+    dskVector = 0;
+    for (uint8 drive = 1; drive < 16; ++drive) {
+        sprintf(name, FILEBASE DSK_IMAGE, 'A' + drive);
+        if (!access(name, F_OK))
+            dskVector |= 1 << drive;
+    }
+    dskSearchSlot = 0xff;
+    dskFoundCount = dskFoundNext = 0;
+    dskMounts = fat32_mount_count();
+    dskScanned = TRUE;
+}
+
+// The slot of the image of drive (0 = A:), opened when needed, 0xff if the drive is a folder
+uint8 _dsk_slot(uint8 drive) {
+    char name[8];
+    uint8 slot;
+
+    if (!dskScanned || dskMounts != fat32_mount_count())
+        _dsk_scan();
+    if (drive > 15 || !(dskVector & (1 << drive)))
+        return (0xff);
+    for (slot = 0; slot < DSK_DRIVES; ++slot)
+        if (dskDrives[slot].drive == drive)
+            return (slot);
+    for (slot = 0; slot < DSK_DRIVES && dskDrives[slot].drive; ++slot)
+        ;
+    if (slot == DSK_DRIVES) { // All taken, the next one in turn is closed
+        slot = dskNextSlot;
+        dskNextSlot = (dskNextSlot + 1) % DSK_DRIVES;
+        _dsk_flush(slot);
+        for (uint8 i = 0; i < DSK_CACHE; ++i)
+            if (dskLines[i].slot == slot)
+                dskLines[i].slot = 0xff;
+        fat32_close(&dskDrives[slot].file);
+        dskDrives[slot].drive = 0;
+        if (dskSearchSlot == slot) {
+            dskSearchSlot = 0xff;
+            dskFoundCount = dskFoundNext = 0;
+        }
+    }
+    sprintf(name, FILEBASE DSK_IMAGE, 'A' + drive);
+    if (fat32_open(&dskDrives[slot].file, name) != FAT32_OK) {
+        dskVector &= ~(1 << drive);
+        return (0xff);
+    }
+    dskDrives[slot].drive = drive;
+    _dsk_login(slot);
+    return (slot);
+}
+
+// The slot of the drive of an FCB, 0xff if it is a folder
+uint8 _dsk_fcbslot(uint16 fcbaddr) {
+    uint8 dr = _RamRead(fcbaddr);
+    return (_dsk_slot(dr && dr != '?' ? dr - 1 : cDrive));
+}
+
+// Writes the DPB and DPH of the images, after those of the folder drives
+void _dsk_patch(void) {
+    static const uint8 dpb[15] = {DSK_SPT, 0, DSK_BSH, DSK_BLM, DSK_EXM, DSK_DSM & 0xff, DSK_DSM >> 8,
+                                  DSK_DRM & 0xff, DSK_DRM >> 8, DSK_AL0, DSK_AL1, 0, 0, DSK_OFF, 0};
+    uint16 i;
+
+    for (i = 0; i < 15; ++i)
+        _RamWrite(DSK_DPBaddr + i, dpb[i]);
+    for (i = 0; i < 16; ++i)
+        _RamWrite(DSK_DPHaddr + i, 0);
+    _RamWrite16(DSK_DPHaddr + 8, 0x0080);       // Directory buffer
+    _RamWrite16(DSK_DPHaddr + 10, DSK_DPBaddr); // DPB
+}
+
+// Flushes the cache for a disk reset. After a BIOS write to a directory the images
+// are opened again, and their allocation vectors rebuilt
+void _dsk_reset(void) {
+    if (dskBiosWrites)
+        dskScanned = FALSE;
+    else
+        _dsk_flush(0xff);
+    dskBiosWrites = FALSE;
+}
+
+/* BIOS */
+
+uint8 _dsk_seldsk(uint8 drive) {
+    dskBiosDrive = drive;
+    return (_dsk_slot(drive) != 0xff);
+}
+
+void _dsk_settrk(uint16 track) {
+    dskTrack = track;
+}
+
+void _dsk_setsec(uint16 sector) {
+    dskSector = sector;
+}
+
+// BIOS READ and WRITE of the selected image, FALSE when the disk selected is a folder
+uint8 _dsk_biosio(uint8 write, uint8 type, uint8 *result) {
+    uint8 slot = _dsk_slot(dskBiosDrive);
+    uint8 *record;
+
+    if (slot == 0xff)
+        return (FALSE);
+    *result = 0x01;
+    record = _dsk_record(slot, (uint32)dskTrack * DSK_SPT + dskSector, write);
+    if (record) {
+        if (write) {
+            memcpy(record, _RamSysAddr(dmaAddr), BlkSZ);
+            if (dskTrack * DSK_SPT + dskSector >= DSK_DIRREC &&
+                dskTrack * DSK_SPT + dskSector < DSK_DIRREC + (DSK_DRM + 1) / 4)
+                dskBiosWrites = TRUE;
+            if (type == 1) // Directory write, straight to the card
+                _dsk_flush(slot);
+        } else {
+            memcpy(_RamSysAddr(dmaAddr), record, BlkSZ);
+        }
+        *result = 0x00;
+    }
+    return (TRUE);
+}
+
+/* BDOS */
+
+// The user an FCB is looked for in, 0xff for all of them when its drive is '?'
+#define _dsk_user(f) ((f)[0] == '?' ? 0xff : userCode)
+
+// Whether directory entry e belongs to the file named in f, of user, in the
+// extent group of f when extent is set and its EX is not '?'
+uint8 _dsk_match(const uint8 *e, const uint8 *f, uint8 user, uint8 extent) {
+    if (e[0] == 0xE5 || e[0] >= 0x20 || (user != 0xff && e[0] != user))
+        return (FALSE);
+    for (uint8 i = 1; i < 12; ++i)
+        if ((f[i] & 0x7f) != '?' && (f[i] & 0x7f) != (e[i] & 0x7f))
+            return (FALSE);
+    if (extent && f[12] != '?')
+        return (((e[12] ^ f[12]) & 0x1f & ~DSK_EXM) == 0 && ((e[14] ^ f[14]) & 0x3f) == 0);
+    return (TRUE);
+}
+
+// The first directory entry of the file named in f from n on, its number or -1
+int32 _dsk_find(uint8 slot, const uint8 *f, uint8 user, uint16 n, uint8 extent) {
+    const uint8 *e;
+
+    for (; n <= DSK_DRM; ++n) {
+        e = _dsk_entry(slot, n, FALSE);
+        if (!e)
+            return (-1);
+        if (_dsk_match(e, f, user, extent))
+            return (n);
+    }
+    return (-1);
+}
+
+// Records in the file named in f, from all its directory entries
+uint32 _dsk_records(uint8 slot, const uint8 *f, uint8 user) {
+    uint32 records = 0, last;
+    const uint8 *e;
+    int32 n = -1;
+
+    while ((n = _dsk_find(slot, f, user, n + 1, FALSE)) >= 0) {
+        e = _dsk_entry(slot, n, FALSE);
+        last = ((uint32)(e[14] & 0x3f) * 32 + (e[12] & 0x1f)) * BlkEX + e[15];
+        if (last > records)
+            records = last;
+    }
+    return (records);
+}
+
+// Loads the extent of F from its directory entry. 0x00, or 0xff when there is no entry
+uint8 _dsk_openext(uint8 slot, uint8 *f) {
+    int32 n = _dsk_find(slot, f, userCode, 0, TRUE);
+    const uint8 *e;
+    uint8 ex = f[12] & 0x1f;
+
+    if (n < 0)
+        return (0xff);
+    e = _dsk_entry(slot, n, FALSE);
+    memcpy(f + 1, e + 1, 11);   // With the attributes
+    memcpy(f + 16, e + 16, 16);
+    f[13] = e[13];
+    f[14] = e[14] | 0x80;       // Unmodified
+    if (ex < (e[12] & 0x1f))
+        f[15] = BlkEX;          // An extent before the last one of the entry is full
+    else if (ex == (e[12] & 0x1f))
+        f[15] = e[15];
+    else
+        f[15] = 0;
+    return (0x00);
+}
+
+// Writes the extent of F back to its directory entry, when it was changed
+uint8 _dsk_closeext(uint8 slot, uint8 *f) {
+    int32 n;
+    uint8 *e;
+    uint16 b;
+
+    if (f[14] & 0x80)
+        return (0x00);
+    n = _dsk_find(slot, f, userCode, 0, TRUE);
+    if (n < 0)
+        return (0xff);
+    e = _dsk_entry(slot, n, TRUE);
+    for (uint8 i = 0; i < 8; ++i)
+        if (!_dsk_block(e, i) && (b = _dsk_block(f, i)))
+            _dsk_setblock(e, i, b);
+    if ((f[12] & 0x1f) > (e[12] & 0x1f)) {
+        e[12] = f[12] & 0x1f;
+        e[15] = f[15];
+    } else if ((f[12] & 0x1f) == (e[12] & 0x1f) && f[15] > e[15]) {
+        e[15] = f[15];
+    }
+    f[14] |= 0x80;
+    return (0x00);
+}
+
+// Makes a directory entry for the extent of F, empty. 0x00, or 0xff when the directory is full
+uint8 _dsk_makeext(uint8 slot, uint8 *f) {
+    int32 n;
+    uint8 *e;
+
+    for (n = 0; n <= DSK_DRM; ++n) {
+        e = _dsk_entry(slot, n, FALSE);
+        if (!e)
+            return (0xff);
+        if (e[0] == 0xE5)
+            break;
+    }
+    if (n > DSK_DRM)
+        return (0xff);
+    e = _dsk_entry(slot, n, TRUE);
+    e[0] = userCode;
+    memcpy(e + 1, f + 1, 11);
+    e[12] = f[12] & 0x1f;
+    e[13] = 0;
+    e[14] = f[14] & 0x3f;
+    e[15] = 0;
+    memset(e + 16, 0, 16);
+    memset(f + 16, 0, 16);
+    f[15] = 0;
+    f[14] &= 0x3f;              // Modified
+    return (0x00);
+}
+
+// Moves F to the extent and module of record. 0x00, 0x04 when reading an
+// extent that is not there, 0x05 when the directory is full for a write
+uint8 _dsk_seek(uint8 slot, uint8 *f, uint32 record, uint8 write) {
+    uint8 ex = (record >> 7) & 0x1f;
+    uint8 s2 = (record >> 12) & 0x3f;
+
+    if (ex != (f[12] & 0x1f) || s2 != (f[14] & 0x3f)) {
+        if (_dsk_closeext(slot, f))
+            return (0xff);
+        f[12] = ex;
+        f[14] = s2 | 0x80;
+        if (_dsk_openext(slot, f)) {
+            if (!write)
+                return (0x04);
+            if (_dsk_makeext(slot, f))
+                return (0x05);
+        }
+    }
+    f[32] = record & 0x7f;
+    return (0x00);
+}
+
+// Reads or writes the record CR of the extent of F, from or to buffer,
+// allocating its block for a write. 0x00, 0x01 for a read of unwritten data,
+// 0x02 when the disk is full, 0xff on an SD error
+uint8 _dsk_rw(uint8 slot, uint8 *f, uint8 *buffer, uint8 write) {
+    uint16 index = (f[12] & DSK_EXM) * BlkEX + f[32];
+    uint16 b = _dsk_block(f, index >> DSK_BSH);
+    uint8 *alv = dskDrives[slot].alv;
+    uint8 *record;
+
+    if (!b) {
+        if (!write)
+            return (0x01);
+        for (b = 0; b <= DSK_DSM && (alv[b >> 3] & (0x80 >> (b & 7))); ++b)
+            ;
+        if (b > DSK_DSM)
+            return (0x02);
+        alv[b >> 3] |= 0x80 >> (b & 7);
+        _dsk_setblock(f, index >> DSK_BSH, b);
+    }
+    record = _dsk_record(slot, DSK_DIRREC + (uint32)b * (DSK_BLM + 1) + (index & DSK_BLM), write);
+    if (!record)
+        return (0xff);
+    if (write) {
+        memcpy(record, buffer, BlkSZ);
+        if (f[32] >= f[15])
+            f[15] = f[32] + 1;
+        f[14] &= 0x3f;
+    } else {
+        memcpy(buffer, record, BlkSZ);
+    }
+    return (0x00);
+}
+
+// Reads the next record of F to buffer. 0x00, or 0x01 at the end of the file
+uint8 _dsk_readnext(uint8 slot, uint8 *f, uint8 *buffer) {
+    uint8 result;
+
+    if (f[32] >= BlkEX) { // The extent is over, on to the next one
+        result = _dsk_seek(slot, f, ((uint32)(f[14] & 0x3f) << 12) + ((uint32)((f[12] & 0x1f) + 1) << 7), FALSE);
+        if (result)
+            return (result == 0x04 ? 0x01 : result);
+    }
+    if (f[32] >= f[15])
+        return (0x01);
+    result = _dsk_rw(slot, f, buffer, FALSE);
+    if (!result)
+        ++f[32];
+    return (result);
+}
+
+uint8 _dsk_open(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+
+    if (f[12] == '?')
+        return (0xff);
+    return (_dsk_openext(slot, f));
+}
+
+uint8 _dsk_close(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 result = _dsk_closeext(slot, _RamSysAddr(fcbaddr));
+
+    return (result ? result : _dsk_flush(slot));
+}
+
+uint8 _dsk_make(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+
+    f[12] = 0x00;
+    f[13] = 0x00;
+    f[14] = 0x00;
+    f[32] = 0x00;
+    return (_dsk_makeext(slot, f));
+}
+
+// Finds the next DSK_BATCH results of the search, from dskNext on, then
+// sizes them all in a single pass over the directory, rather than one pass
+// each. FALSE when there are no more
+uint8 _dsk_batch(void) {
+    uint8 user = _dsk_user(dskPattern);
+    DskFound *found;
+    const uint8 *e;
+    uint32 last;
+    int32 n = (int32)dskNext - 1;
+
+    dskFoundCount = dskFoundNext = 0;
+    while (dskFoundCount < DSK_BATCH && (n = _dsk_find(dskSearchSlot, dskPattern, user, n + 1, TRUE)) >= 0) {
+        e = _dsk_entry(dskSearchSlot, n, FALSE);
+        found = &dskFound[dskFoundCount++];
+        found->n = n;
+        memcpy(found->name, e, sizeof(found->name)); // The line of e is gone once others are read
+        found->records = 0;
+        dskNext = n + 1;
+    }
+    if (!dskFoundCount)
+        return (FALSE);
+    for (n = 0; n <= DSK_DRM; ++n) {
+        e = _dsk_entry(dskSearchSlot, n, FALSE);
+        if (!e)
+            break;
+        for (found = dskFound; found < dskFound + dskFoundCount; ++found)
+            if (_dsk_match(e, found->name, found->name[0], FALSE)) {
+                last = ((uint32)(e[14] & 0x3f) * 32 + (e[12] & 0x1f)) * BlkEX + e[15];
+                if (last > found->records)
+                    found->records = last;
+            }
+    }
+    return (TRUE);
+}
+
+// Search first and next: the directory entry goes to the DMA when isdir, and
+// the name and size to tmpFCB and findNextSize, for the internal CCP
+uint8 _dsk_search(uint16 fcbaddr, uint8 isdir, uint8 first) {
+    DskFound *found;
+    uint8 *e;
+
+    if (first) {
+        memcpy(dskPattern, _RamSysAddr(fcbaddr), sizeof(dskPattern));
+        dskSearchSlot = _dsk_fcbslot(fcbaddr);
+        dskNext = 0;
+        dskFoundCount = dskFoundNext = 0;
+    }
+    if (dskSearchSlot == 0xff)
+        return (0xff);
+    do { // A result deleted since its batch was found is passed over
+        if (dskFoundNext == dskFoundCount && !_dsk_batch())
+            return (0xff);
+        found = &dskFound[dskFoundNext++];
+        e = _dsk_entry(dskSearchSlot, found->n, FALSE);
+        if (!e)
+            return (0xff);
+    } while (!_dsk_match(e, dskPattern, _dsk_user(dskPattern), TRUE));
+    if (isdir)
+        memcpy(_RamSysAddr(dmaAddr), e, 32);
+    _RamWrite(tmpFCB, dskDrives[dskSearchSlot].drive + 1); // The FCB drive, 1 = A:
+    for (uint8 i = 1; i < 12; ++i)
+        _RamWrite(tmpFCB + i, e[i] & 0x7f);
+    for (uint8 i = 12; i < 16; ++i)
+        _RamWrite(tmpFCB + i, 0);
+    currFindUser = e[0];
+    findNextSize = found->records * BlkSZ;
+    return (0x00);
+}
+
+uint8 _dsk_delete(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint8 *alv = dskDrives[slot].alv;
+    uint8 result = 0xff;
+    uint16 b;
+    uint8 *e;
+    int32 n = -1;
+
+    while ((n = _dsk_find(slot, f, _dsk_user(f), n + 1, FALSE)) >= 0) {
+        e = _dsk_entry(slot, n, TRUE);
+        for (uint8 i = 0; i < 8; ++i)
+            if ((b = _dsk_block(e, i)) && b <= DSK_DSM)
+                alv[b >> 3] &= ~(0x80 >> (b & 7));
+        e[0] = 0xE5;
+        result = 0x00;
+    }
+    _dsk_flush(slot);
+    return (result);
+}
+
+uint8 _dsk_rename(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint8 result = 0xff;
+    uint8 *e;
+    int32 n = -1;
+
+    while ((n = _dsk_find(slot, f, _dsk_user(f), n + 1, FALSE)) >= 0) {
+        e = _dsk_entry(slot, n, TRUE);
+        for (uint8 i = 1; i < 12; ++i)
+            e[i] = (f[16 + i] & 0x7f) | (e[i] & 0x80);
+        result = 0x00;
+    }
+    _dsk_flush(slot);
+    return (result);
+}
+
+uint8 _dsk_attrib(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint8 result = 0xff;
+    uint8 *e;
+    int32 n = -1;
+
+    while ((n = _dsk_find(slot, f, _dsk_user(f), n + 1, FALSE)) >= 0) {
+        e = _dsk_entry(slot, n, TRUE);
+        memcpy(e + 1, f + 1, 11);
+        result = 0x00;
+    }
+    _dsk_flush(slot);
+    return (result);
+}
+
+uint8 _dsk_readseq(uint16 fcbaddr) {
+    return (_dsk_readnext(_dsk_fcbslot(fcbaddr), _RamSysAddr(fcbaddr), _RamSysAddr(dmaAddr)));
+}
+
+uint8 _dsk_writeseq(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint8 result;
+
+    if (f[32] >= BlkEX) { // The extent is full, on to the next one
+        result = _dsk_seek(slot, f, ((uint32)(f[14] & 0x3f) << 12) + ((uint32)((f[12] & 0x1f) + 1) << 7), TRUE);
+        if (result)
+            return (result == 0x05 ? 0x02 : result);
+    }
+    result = _dsk_rw(slot, f, _RamSysAddr(dmaAddr), TRUE);
+    if (!result)
+        ++f[32];
+    return (result);
+}
+
+// Random read and write, the record of R0 to R2. 0x06 past the end of the disk
+uint8 _dsk_random(uint16 fcbaddr, uint8 write) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint32 record = f[33] | (f[34] << 8) | ((uint32)f[35] << 16);
+    uint8 result;
+
+    if (record > 0xffff)
+        return (0x06);
+    result = _dsk_seek(slot, f, record, write);
+    if (result)
+        return (result);
+    if (!write && f[32] >= f[15])
+        return (0x01);
+    return (_dsk_rw(slot, f, _RamSysAddr(dmaAddr), write));
+}
+
+// Size of the file in bytes, -1 if there is no such file
+long _dsk_filesize(uint16 fcbaddr) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+
+    if (_dsk_find(slot, f, userCode, 0, FALSE) < 0)
+        return (-1);
+    return ((long)_dsk_records(slot, f, userCode) * BlkSZ);
+}
+
+// Reads the records of the open file of the FCB from CR on, to buffer, up to
+// size bytes. Returns the bytes read, for the internal CCP
+uint32 _dsk_read(uint16 fcbaddr, uint8 *buffer, uint32 size) {
+    uint8 slot = _dsk_fcbslot(fcbaddr);
+    uint8 *f = _RamSysAddr(fcbaddr);
+    uint32 length = 0;
+
+    while (length + BlkSZ <= size && !_dsk_readnext(slot, f, buffer + length))
+        length += BlkSZ;
+    return (length);
+}
+
+#endif // DISKIMG_H
@@ -16,7 +16,9 @@
 #include "fat32.h"
 
 #define FD_FLAG_MASK 0x4000 // Mask to indicate a file descriptor
+#ifndef MAX_OPEN_FILES
 #define MAX_OPEN_FILES 16
+#endif
 
 static int initialized = 0;
 static fat32_file_t files[MAX_OPEN_FILES];
@@ -104,8 +106,14 @@ int _open(const char *filename, int oflag, ...)
 
             if (oflag & O_TRUNC)
             {
-                // If O_TRUNC is set, truncate the file
-                files[i].file_size = 0;
+                // If O_TRUNC is set, truncate the file, freeing its clusters as
+                // fat32_write would carry on along the old chain
+                if ((result = fat32_truncate(&files[i], 0)) != FAT32_OK)
+                {
+                    fat32_close(&files[i]);
+                    errno = fat32_error_to_errno(result);
+                    return -1;
+                }
                 files[i].position = 0;
             }
             else if (oflag & O_APPEND)
@@ -22,6 +22,7 @@
 
 #include "lcd.h"
 #include "display.h"
+#include "trace.h"
 
 // Colour Palette definitions
 //
@@ -196,6 +197,7 @@ bool display_emit_available()
 
 void display_emit(char ch)
 {
+    uint32_t start = trace_begin();
     int max_row = MAX_ROW;
     int max_col = lcd_get_columns() - 1;
 
@@ -830,6 +832,35 @@ void display_emit(char ch)
     // Update cursor position
     lcd_move_cursor(column, row);
     lcd_draw_cursor(); // draw the cursor at the new position
+    trace_end(TRACE_DISPLAY, 1, start);
+}
+
+//
+//  Saving and restoring the terminal
+//
+//  The characters on the screen, the font and the cursor position are kept,
+//  for instance over a power cycle. Colours and attributes are back to the
+//  defaults after a restore.
+//
+
+void display_save_state(display_state_t *saved)
+{
+    saved->font_width = lcd_get_glyph_width();
+    saved->column = column;
+    saved->row = row;
+    memcpy(saved->text, lcd_get_text(), sizeof(saved->text));
+}
+
+void display_restore_state(const display_state_t *saved)
+{
+    state = STATE_NORMAL;
+    lcd_set_font(saved->font_width == 4 ? &font_4x10 : saved->font_width == 5 ? &font_5x10 : &font_8x10);
+    lcd_define_scrolling(0, 0);
+    lcd_restore_text(saved->text);
+    column = MIN(saved->column, lcd_get_columns() - 1);
+    row = MIN(saved->row, MAX_ROW);
+    lcd_move_cursor(column, row);
+    lcd_draw_cursor();
 }
 
 //
@@ -2,6 +2,7 @@
 
 #include "pico/stdlib.h"
 #include "font.h"
+#include "lcd.h"
 
 // Processing ANSI escape sequences is a small state machine. These
 // are the states.
@@ -56,6 +57,15 @@ typedef void (*bell_callback_t)(void);
 // Notify when a terminal report is requested
 typedef void (*report_callback_t)(const char *);
 
+// What is on the terminal, to be saved and put back (see display_save_state)
+typedef struct
+{
+    uint8_t font_width;                     // 4, 5 or 8 pixels
+    uint8_t column;                         // cursor position
+    uint8_t row;
+    uint8_t text[ROWS * TEXT_COLUMNS];      // see lcd_get_text
+} display_state_t;
+
 // Function prototypes
 void display_init(void);
 void display_set_led_callback(led_callback_t callback);
@@ -63,3 +73,5 @@ void display_set_bell_callback(bell_callback_t callback);
 void display_set_report_callback(report_callback_t callback);
 bool display_emit_available(void);
 void display_emit(char c);
+void display_save_state(display_state_t *saved);
+void display_restore_state(const display_state_t *saved);
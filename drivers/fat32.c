@@ -20,6 +20,7 @@
 
 #include "sdcard.h"
 #include "fat32.h"
+#include "trace.h"
 
 #define RETURN_ON_ERROR(expr)        \
     {                                \
@@ -43,6 +44,7 @@
 // Global state
 static bool fat32_mounted = false;
 static fat32_error_t mount_status = FAT32_OK; // Error code for mount operation
+static uint32_t mount_count = 0;               // Times a card was mounted, a new count may be another card
 bool fat32_initialised = false;               // Set to true after successful file system initialization
 
 // FAT32 file system state
@@ -57,10 +59,66 @@ static uint32_t bytes_per_cluster;
 
 static uint32_t current_dir_cluster = 0; // Current directory cluster
 
+// Cluster chains are freed by a release. What a file handle knows of its
+// chain, from before the last one, may be wrong
+static uint32_t release_count = 0;
+
+// The chain position of the file closed last, for when it is opened again to
+// carry on where it was: CP/M writes a file one open per record
+static fat32_file_t chain_hint;
+
+// The file closed last with clusters reserved past its end. They stay in its
+// chain, and it carries on growing by runs as large, when it is opened again
+// to be written on. They are freed by fat32_sync, which the CP/M layer calls
+// when a program ends or waits on a key, or by the next file closed with a
+// reservation
+static fat32_file_t reserve_hint;
+
+// Sector I/O counters (see fat32_get_io_stats)
+static uint32_t sectors_read = 0;
+static uint32_t sectors_written = 0;
+static uint32_t fat_hits = 0;   // FAT sectors found in a buffer
+static uint32_t fat_misses = 0; // and read in
+
+// Sector access log (see fat32_io_capture)
+static fat32_io_record_t *io_log = NULL;
+static bool io_logging = false;
+static uint32_t io_log_capacity = 0;
+static uint32_t io_log_count = 0;
+static uint32_t io_log_dropped = 0;
+static uint32_t io_log_start = 0;
+
 // Working buffers
 static uint8_t sector_buffer[FAT32_SECTOR_SIZE] __attribute__((aligned(4)));
+
+// FAT sectors are read and changed in their own buffers. Changed ones are
+// written by fat_flush, to each FAT copy in turn, once however many of their
+// entries changed. The order fat_commit keeps holds while one change touches
+// no more than FAT32_FAT_BUFFERS sectors; past that, see fat_buffer
+#define FAT_SECTOR_NONE (0xFFFFFFFF)
+typedef struct
+{
+    uint32_t sector; // In the FAT, FAT_SECTOR_NONE for none
+    uint32_t used;   // fat_clock when last used
+    bool dirty;      // Changed since written
+} fat_buffer_t;
+static fat_buffer_t fat_buffers[FAT32_FAT_BUFFERS];
+static uint8_t fat_data[FAT32_FAT_BUFFERS][FAT32_SECTOR_SIZE] __attribute__((aligned(4)));
+static uint32_t fat_clock = 0;
+static bool fsinfo_dirty = false; // FSInfo changed, written by fat_commit
 static fat32_lfn_entry_t lfn_buffer[MAX_LFN_PART]; // Buffer for long file name entries
 
+// The folders CP/M keeps its files in are /X/U, with X the drive (A to P)
+// and U the user area (0 to F). They are found once here rather than through
+// the root and the drive folder for every path. The user folders of a drive
+// are indexed on its first use. A folder made or removed, or another mount,
+// starts the index over
+static uint32_t cpm_drive_clusters[16];  // Of the drive folders, 0 for none
+static uint32_t cpm_dirs[16][16];        // Of the user folders, 0 for none
+static bool cpm_root_indexed = false;
+static uint16_t cpm_drives_indexed = 0; // Drives whose user folders are in cpm_dirs
+static uint32_t dir_generation = 0;     // See fat32_dir_generation
+
 // Timer for SD card detection
 static repeating_timer_t sd_card_detect_timer;
 
@@ -73,16 +131,93 @@ static inline uint32_t cluster_to_sector(uint32_t cluster)
     return ((cluster - 2) * boot_sector.sectors_per_cluster) + first_data_sector;
 }
 
-static inline fat32_error_t read_sector(uint32_t sector, uint8_t *buffer)
+static void log_sector(char op, uint32_t sector, const char *caller)
+{
+    if (io_log_count >= io_log_capacity)
+    {
+        io_log_dropped++;
+        return;
+    }
+    io_log[io_log_count].time_us = time_us_32() - io_log_start;
+    io_log[io_log_count].sector = sector;
+    io_log[io_log_count].caller = caller;
+    io_log[io_log_count].op = op;
+    io_log_count++;
+}
+
+static inline fat32_error_t read_sector_from(uint32_t sector, uint8_t *buffer, const char *caller)
 {
-    return sd_read_block(volume_start_block + sector, buffer);
+    uint32_t start = trace_begin();
+    fat32_error_t result;
+
+    sectors_read++;
+    if (io_logging)
+    {
+        log_sector('R', sector, caller);
+    }
+    result = sd_read_block(volume_start_block + sector, buffer);
+    trace_end(TRACE_SECTOR_READ, sector, start);
+    return result;
 }
 
-static inline fat32_error_t write_sector(uint32_t sector, const uint8_t *buffer)
+static inline fat32_error_t write_sector_from(uint32_t sector, const uint8_t *buffer, const char *caller)
 {
-    return sd_write_block(volume_start_block + sector, buffer);
+    uint32_t start = trace_begin();
+    fat32_error_t result;
+
+    sectors_written++;
+    if (io_logging)
+    {
+        log_sector('W', sector, caller);
+    }
+    result = sd_write_block(volume_start_block + sector, buffer);
+    trace_end(TRACE_SECTOR_WRITE, sector, start);
+    return result;
+}
+
+// Runs of sectors are one multiple block transfer
+static fat32_error_t read_sectors_from(uint32_t sector, uint32_t count, uint8_t *buffer, const char *caller)
+{
+    uint32_t start = trace_begin();
+    fat32_error_t result;
+
+    sectors_read += count;
+    if (io_logging)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            log_sector('R', sector + i, caller);
+        }
+    }
+    result = sd_read_blocks(volume_start_block + sector, count, buffer);
+    trace_end(TRACE_SECTOR_READ, sector, start);
+    return result;
+}
+
+static fat32_error_t write_sectors_from(uint32_t sector, uint32_t count, const uint8_t *buffer, const char *caller)
+{
+    uint32_t start = trace_begin();
+    fat32_error_t result;
+
+    sectors_written += count;
+    if (io_logging)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            log_sector('W', sector + i, caller);
+        }
+    }
+    result = sd_write_blocks(volume_start_block + sector, count, buffer);
+    trace_end(TRACE_SECTOR_WRITE, sector, start);
+    return result;
 }
 
+// Sector accesses are tagged with the function making them, for the access log
+#define read_sector(sector, buffer) read_sector_from(sector, buffer, __func__)
+#define write_sector(sector, buffer) write_sector_from(sector, buffer, __func__)
+#define read_sectors(sector, count, buffer) read_sectors_from(sector, count, buffer, __func__)
+#define write_sectors(sector, count, buffer) write_sectors_from(sector, count, buffer, __func__)
+
 //
 // FAT32 file system functions
 //
@@ -172,10 +307,181 @@ static fat32_error_t is_valid_fat32_boot_sector(const fat32_boot_sector_t *bs)
     return FAT32_OK;
 }
 
+// FSInfo is written by fat_commit, after the FAT and the directory entries
 static fat32_error_t update_fsinfo()
 {
-    // Write the updated FSInfo sector back to disk
-    return write_sector(boot_sector.fat32_info, (const uint8_t *)&fsinfo);
+    fsinfo_dirty = true;
+    return FAT32_OK;
+}
+
+// The FAT copy in use and the number of copies kept up to date. With
+// mirroring off (ext_flags bit 7) only the active copy is
+static inline uint8_t fat_active(void)
+{
+    uint8_t active = boot_sector.ext_flags & 0x0F;
+    return (boot_sector.ext_flags & 0x80) && active < boot_sector.num_fats ? active : 0;
+}
+
+static inline uint8_t fat_copies(void)
+{
+    return (boot_sector.ext_flags & 0x80) ? 1 : boot_sector.num_fats;
+}
+
+static inline uint32_t fat_copy_start(uint8_t copy)
+{
+    return boot_sector.reserved_sectors + copy * boot_sector.fat_size_32;
+}
+
+static void fat_drop(void)
+{
+    for (uint8_t i = 0; i < FAT32_FAT_BUFFERS; i++)
+    {
+        fat_buffers[i].sector = FAT_SECTOR_NONE;
+        fat_buffers[i].used = 0;
+        fat_buffers[i].dirty = false;
+    }
+    fsinfo_dirty = false;
+}
+
+// Notes that entries were added to or removed from a directory, folder when
+// one of them is a folder
+static void dir_changed(bool folder)
+{
+    dir_generation++;
+    if (folder)
+    {
+        cpm_root_indexed = false;
+        cpm_drives_indexed = 0;
+    }
+}
+
+// Writes the changed FAT sectors in sector order, to the first FAT copy and
+// then to the second one: a copy is always whole, whenever the card goes
+static fat32_error_t fat_flush(void)
+{
+    bool any = false;
+    for (uint8_t i = 0; i < FAT32_FAT_BUFFERS; i++)
+    {
+        any |= fat_buffers[i].dirty;
+    }
+    if (!any)
+    {
+        return FAT32_OK;
+    }
+
+    uint8_t first = fat_active();
+    for (uint8_t copy = first; copy < first + fat_copies(); copy++)
+    {
+        uint32_t after = 0; // Sectors up to it are written
+        for (;;)
+        {
+            fat_buffer_t *next = NULL;
+            uint8_t index = 0;
+            for (uint8_t i = 0; i < FAT32_FAT_BUFFERS; i++)
+            {
+                if (fat_buffers[i].dirty && fat_buffers[i].sector + 1 > after &&
+                    (!next || fat_buffers[i].sector < next->sector))
+                {
+                    next = &fat_buffers[i];
+                    index = i;
+                }
+            }
+            if (!next)
+            {
+                break;
+            }
+            RETURN_ON_ERROR(write_sector(fat_copy_start(copy) + next->sector, fat_data[index]));
+            after = next->sector + 1;
+        }
+    }
+
+    for (uint8_t i = 0; i < FAT32_FAT_BUFFERS; i++)
+    {
+        fat_buffers[i].dirty = false;
+    }
+    return FAT32_OK;
+}
+
+// Ends a change to the file system, with result the change's own. Data goes
+// to the card first, the FAT copies (fat_flush is called before a directory
+// entry is written) and the directory entries next, FSInfo last
+static fat32_error_t fat_commit(fat32_error_t result)
+{
+    fat32_error_t flushed = fat_flush();
+    if (flushed == FAT32_OK && fsinfo_dirty)
+    {
+        flushed = write_sector(boot_sector.fat32_info, (const uint8_t *)&fsinfo);
+        fsinfo_dirty = flushed != FAT32_OK;
+    }
+    return result != FAT32_OK ? result : flushed;
+}
+
+// The FAT sector in a buffer, read into the unchanged one used least recently
+// when not there. Changed, it is written by the next fat_flush. When every
+// buffer is changed, the one used least recently is written on its own, to
+// each FAT copy in turn, ahead of the data and the rest of the FAT: the order
+// is then best-effort, though a copy still never gets a sector the one before
+// it lacks
+static fat32_error_t fat_buffer(uint32_t sector, bool change, uint8_t **data)
+{
+    uint8_t index = FAT32_FAT_BUFFERS;
+    uint8_t oldest = 0;
+    for (uint8_t i = 0; i < FAT32_FAT_BUFFERS; i++)
+    {
+        if (fat_buffers[i].sector == sector)
+        {
+            index = i;
+            break;
+        }
+        if (fat_buffers[i].used < fat_buffers[oldest].used)
+        {
+            oldest = i;
+        }
+        if (!fat_buffers[i].dirty &&
+            (index == FAT32_FAT_BUFFERS || fat_buffers[i].used < fat_buffers[index].used))
+        {
+            index = i;
+        }
+    }
+    if (index == FAT32_FAT_BUFFERS)
+    {
+        index = oldest;
+    }
+
+    fat_buffer_t *buffer = &fat_buffers[index];
+    if (buffer->sector == sector)
+    {
+        fat_hits++;
+    }
+    else
+    {
+        fat_misses++;
+        if (buffer->dirty)
+        {
+            uint8_t first = fat_active();
+            for (uint8_t copy = first; copy < first + fat_copies(); copy++)
+            {
+                RETURN_ON_ERROR(write_sector(fat_copy_start(copy) + buffer->sector, fat_data[index]));
+            }
+            buffer->dirty = false;
+        }
+        buffer->sector = FAT_SECTOR_NONE;
+        RETURN_ON_ERROR(read_sector(fat_copy_start(fat_active()) + sector, fat_data[index]));
+        buffer->sector = sector;
+    }
+    buffer->used = ++fat_clock;
+    buffer->dirty |= change;
+    *data = fat_data[index];
+    return FAT32_OK;
+}
+
+// The FAT entry of cluster, in a FAT sector buffer until the next fat_buffer
+static fat32_error_t fat_entry(uint32_t cluster, bool change, uint32_t **entry)
+{
+    uint8_t *data;
+    RETURN_ON_ERROR(fat_buffer(cluster * 4 / FAT32_SECTOR_SIZE, change, &data));
+    *entry = (uint32_t *)(data + (cluster * 4) % FAT32_SECTOR_SIZE);
+    return FAT32_OK;
 }
 
 static fat32_error_t read_cluster_fat_entry(uint32_t cluster, uint32_t *value)
@@ -186,15 +492,9 @@ static fat32_error_t read_cluster_fat_entry(uint32_t cluster, uint32_t *value)
         return FAT32_ERROR_INVALID_PARAMETER;
     }
 
-    uint32_t fat_offset = cluster * 4; // 4 bytes per entry in FAT32
-    uint32_t fat_sector = boot_sector.reserved_sectors + (fat_offset / FAT32_SECTOR_SIZE);
-    uint32_t entry_offset = fat_offset % FAT32_SECTOR_SIZE;
-
-    // Read the FAT sector
-    RETURN_ON_ERROR(read_sector(fat_sector, sector_buffer));
-
-    uint32_t entry = *(uint32_t *)(sector_buffer + entry_offset);
-    *value = entry & 0x0FFFFFFF; // Mask out upper 4 bits for FAT32
+    uint32_t *entry;
+    RETURN_ON_ERROR(fat_entry(cluster, false, &entry));
+    *value = *entry & 0x0FFFFFFF; // Mask out upper 4 bits for FAT32
     return FAT32_OK;
 }
 
@@ -206,20 +506,10 @@ static fat32_error_t write_cluster_fat_entry(uint32_t cluster, uint32_t value)
         return FAT32_ERROR_INVALID_PARAMETER;
     }
 
-    uint32_t fat_offset = cluster * 4; // 4 bytes per entry in FAT32
-    uint32_t fat_sector = boot_sector.reserved_sectors + (fat_offset / FAT32_SECTOR_SIZE);
-    uint32_t entry_offset = fat_offset % FAT32_SECTOR_SIZE;
-
-    // Read the FAT sector
-    RETURN_ON_ERROR(read_sector(fat_sector, sector_buffer));
-
-    // Write the FAT entry
-    *(uint32_t *)(sector_buffer + entry_offset) &= 0xF0000000;
-    *(uint32_t *)(sector_buffer + entry_offset) |= value & 0x0FFFFFFF;
-
-    // Write the modified sector back
-    RETURN_ON_ERROR(write_sector(fat_sector, sector_buffer));
-
+    uint32_t *entry;
+    RETURN_ON_ERROR(fat_entry(cluster, true, &entry));
+    *entry &= 0xF0000000;
+    *entry |= value & 0x0FFFFFFF;
     return FAT32_OK;
 }
 
@@ -227,9 +517,15 @@ static fat32_error_t get_next_free_cluster(uint32_t *cluster)
 {
     // Start searching from next free or first data cluster
     uint32_t start_cluster = fsinfo.next_free != 0xFFFFFFFF ? fsinfo.next_free : 2;
+    if (start_cluster < 2 || start_cluster >= cluster_count + 2)
+    {
+        start_cluster = 2;
+    }
 
-    // Iterate through the FAT to find a free cluster
-    for (uint32_t i = start_cluster; i < cluster_count + 2; i++)
+    // Iterate through the FAT to find a free cluster, to its end and then
+    // from its start
+    uint32_t i = start_cluster;
+    do
     {
         uint32_t value;
         RETURN_ON_ERROR(read_cluster_fat_entry(i, &value));
@@ -237,58 +533,78 @@ static fat32_error_t get_next_free_cluster(uint32_t *cluster)
         if (value == FAT32_FAT_ENTRY_FREE)
         {
             *cluster = i;
-            return FAT32_OK; // Found a free cluster
+            fsinfo.next_free = i + 1; // The next search starts after it, not over the clusters just used
+            return FAT32_OK;          // Found a free cluster
         }
-    }
+        if (++i == cluster_count + 2)
+        {
+            i = 2;
+        }
+    } while (i != start_cluster);
     return FAT32_ERROR_DISK_FULL; // No free clusters found
 }
 
-static fat32_error_t release_cluster_chain(uint32_t start_cluster)
+// Cluster chains being freed. Their FAT sectors are written by the next
+// fat_flush, and FSInfo once at the end
+typedef struct
 {
-    uint32_t total_clusters = 0;
-    uint32_t lowest_cluster = 0xFFFFFFFF;
+    uint32_t total_clusters; // Freed so far
+    uint32_t lowest_cluster; // Lowest freed so far
+} chain_release_t;
 
-    if (start_cluster < 2)
-    {
-        return FAT32_ERROR_INVALID_PARAMETER;
-    }
+static void release_begin(chain_release_t *release)
+{
+    release_count++;
+    release->total_clusters = 0;
+    release->lowest_cluster = 0xFFFFFFFF;
+}
 
+static fat32_error_t release_chain(chain_release_t *release, uint32_t start_cluster)
+{
     uint32_t cluster = start_cluster;
-    while (cluster < FAT32_FAT_ENTRY_EOC)
-    {
-        uint32_t next_cluster;
-        RETURN_ON_ERROR(read_cluster_fat_entry(cluster, &next_cluster));
-        RETURN_ON_ERROR(write_cluster_fat_entry(cluster, FAT32_FAT_ENTRY_FREE));
-        total_clusters++;
-        if (cluster < lowest_cluster)
+    while (cluster >= 2 && cluster < cluster_count + 2)
+    {
+        uint32_t *entry;
+        RETURN_ON_ERROR(fat_entry(cluster, true, &entry));
+        uint32_t next_cluster = *entry & 0x0FFFFFFF;
+        *entry &= 0xF0000000; // FAT32_FAT_ENTRY_FREE
+        release->total_clusters++;
+        if (cluster < release->lowest_cluster)
         {
-            lowest_cluster = cluster; // Find the lowest cluster number in the chain
+            release->lowest_cluster = cluster; // Find the lowest cluster number in the chains
         }
         cluster = next_cluster;
     }
+    return FAT32_OK;
+}
 
-    // Update FSInfo with the new free count
-    fsinfo.free_count += total_clusters;
-    if (fsinfo.next_free > lowest_cluster)
+static fat32_error_t release_end(chain_release_t *release)
+{
+    if (release->total_clusters == 0)
     {
-        fsinfo.next_free = lowest_cluster; // Update next free cluster if needed
+        return FAT32_OK;
     }
-    // Write the updated FSInfo sector back to disk
-    RETURN_ON_ERROR(write_sector(boot_sector.fat32_info, (const uint8_t *)&fsinfo));
 
-    return FAT32_OK;
+    // Update FSInfo with the new free count
+    fsinfo.free_count += release->total_clusters;
+    if (fsinfo.next_free > release->lowest_cluster)
+    {
+        fsinfo.next_free = release->lowest_cluster; // Update next free cluster if needed
+    }
+    return update_fsinfo();
 }
 
-static fat32_error_t find_last_cluster(uint32_t start_cluster, uint32_t count, uint32_t *last_cluster)
+static fat32_error_t release_cluster_chain(uint32_t start_cluster)
 {
-    *last_cluster = start_cluster;
-    for (uint32_t i = 1; i < count; i++)
+    if (start_cluster < 2)
     {
-        uint32_t next_cluster;
-        RETURN_ON_ERROR(read_cluster_fat_entry(*last_cluster, &next_cluster));
-        *last_cluster = next_cluster;
+        return FAT32_ERROR_INVALID_PARAMETER;
     }
-    return FAT32_OK;
+
+    chain_release_t release;
+    release_begin(&release);
+    RETURN_ON_ERROR(release_chain(&release, start_cluster));
+    return release_end(&release);
 }
 
 static fat32_error_t allocate_and_link_cluster(uint32_t last_cluster, uint32_t *new_cluster)
@@ -306,6 +622,96 @@ static fat32_error_t allocate_and_link_cluster(uint32_t last_cluster, uint32_t *
     return FAT32_OK;
 }
 
+// Finds up to *count free clusters in a row, from *first when it is free or
+// else from the one get_next_free_cluster finds. Returns the run found in
+// *first and *count
+static fat32_error_t find_free_run(uint32_t *first, uint32_t *count)
+{
+    uint32_t value = FAT32_FAT_ENTRY_EOC;
+    if (*first >= 2 && *first < cluster_count + 2)
+    {
+        RETURN_ON_ERROR(read_cluster_fat_entry(*first, &value));
+    }
+    if (value != FAT32_FAT_ENTRY_FREE)
+    {
+        RETURN_ON_ERROR(get_next_free_cluster(first));
+    }
+
+    uint32_t found = 1;
+    while (found < *count && *first + found < cluster_count + 2)
+    {
+        uint32_t *entry;
+        RETURN_ON_ERROR(fat_entry(*first + found, false, &entry));
+        if ((*entry & 0x0FFFFFFF) != FAT32_FAT_ENTRY_FREE)
+        {
+            break;
+        }
+        found++;
+    }
+    *count = found;
+    return FAT32_OK;
+}
+
+// Chains count clusters from first one after the other, the last one ending
+// the chain. Each FAT sector is written once, whatever the number of entries
+static fat32_error_t link_run(uint32_t first, uint32_t count)
+{
+    for (uint32_t cluster = first; cluster < first + count; cluster++)
+    {
+        RETURN_ON_ERROR(write_cluster_fat_entry(cluster, cluster + 1 < first + count ? cluster + 1 : FAT32_FAT_ENTRY_EOC));
+    }
+    return FAT32_OK;
+}
+
+// Adds free clusters in a row to the end of the chain of file, right after its
+// last cluster when they are free, so that the file stays in one piece: as
+// many as its size hint still needs, or without one twice as many as the time
+// before, up to FAT32_RESERVE_MAX. The ones the file does not reach are freed
+// once it is closed for good (see reserve_hint). Returns the first one added
+// in first
+static fat32_error_t grow_chain(fat32_file_t *file, uint32_t *first)
+{
+    uint32_t count = file->run_clusters ? file->run_clusters : 1;
+    uint32_t hinted = (file->size_hint + bytes_per_cluster - 1) / bytes_per_cluster;
+    if (file->size_hint)
+    {
+        count = hinted > file->cluster_total ? hinted - file->cluster_total : 1;
+    }
+    else
+    {
+        uint32_t most = FAT32_RESERVE_MAX / bytes_per_cluster;
+        file->run_clusters = count * 2 <= most ? count * 2 : (most ? most : 1);
+    }
+
+    *first = file->last_cluster + 1;
+    RETURN_ON_ERROR(find_free_run(first, &count));
+    RETURN_ON_ERROR(link_run(*first, count));
+    if (file->last_cluster)
+    {
+        RETURN_ON_ERROR(write_cluster_fat_entry(file->last_cluster, *first));
+    }
+    else
+    {
+        file->start_cluster = *first; // An empty file without a cluster
+    }
+
+    fsinfo.next_free = *first + count;
+    if (fsinfo.free_count != 0xFFFFFFFF)
+    {
+        fsinfo.free_count -= count;
+    }
+    RETURN_ON_ERROR(update_fsinfo());
+
+    file->last_cluster = *first + count - 1;
+    file->run_first = *first;
+    file->cluster_total += count;
+    if (count > 1)
+    {
+        file->reserved = true;
+    }
+    return FAT32_OK;
+}
+
 static fat32_error_t clear_cluster(uint32_t cluster)
 {
     uint32_t sector = cluster_to_sector(cluster);
@@ -334,6 +740,94 @@ static fat32_error_t seek_to_cluster(uint32_t start_cluster, uint32_t offset, ui
     return FAT32_OK;
 }
 
+// Notes that the chain of file ends with cluster, its total-th. The run
+// grow_chain linked is kept if cluster is in it
+static void file_chain_end(fat32_file_t *file, uint32_t cluster, uint32_t total)
+{
+    if (!file->last_cluster || cluster < file->run_first || cluster > file->last_cluster)
+    {
+        file->run_first = cluster;
+    }
+    file->last_cluster = cluster;
+    file->cluster_total = total;
+}
+
+// Moves the cluster cursor of file (current_cluster, cluster_index) to the
+// index-th cluster of its chain. The walk starts from the cursor, the cluster
+// before it (stdio reads from a block boundary before writing) or the end of
+// the chain when known, so reading or writing on costs one FAT read per
+// cluster. With extend, clusters are added to the chain as needed
+static fat32_error_t file_seek_cluster(fat32_file_t *file, uint32_t index, bool extend)
+{
+    if (file->releases != release_count)
+    {
+        file->current_cluster = 0;
+        file->last_cluster = 0;
+        file->releases = release_count;
+    }
+    if (index + 1 == file->cluster_index && file->previous_cluster >= 2)
+    {
+        file->current_cluster = file->previous_cluster;
+        file->cluster_index = index;
+        file->previous_cluster = 0;
+    }
+    if (file->current_cluster < 2 || index < file->cluster_index)
+    {
+        file->current_cluster = file->start_cluster;
+        file->cluster_index = 0;
+        file->previous_cluster = 0;
+    }
+
+    if (file->start_cluster < 2)
+    {
+        // An empty file without a cluster
+        if (!extend)
+        {
+            return FAT32_ERROR_INVALID_POSITION;
+        }
+        file->last_cluster = 0;
+        file->cluster_total = 0;
+        RETURN_ON_ERROR(grow_chain(file, &file->current_cluster));
+    }
+
+    if (file->last_cluster && index + 1 >= file->cluster_total && file->cluster_index + 1 < file->cluster_total)
+    {
+        file->current_cluster = file->last_cluster;
+        file->cluster_index = file->cluster_total - 1;
+        file->previous_cluster = 0;
+    }
+
+    while (file->cluster_index < index)
+    {
+        uint32_t next_cluster;
+        if (file->last_cluster && file->current_cluster >= file->run_first && file->current_cluster < file->last_cluster)
+        {
+            // In the run grow_chain linked, no need to read the FAT
+            file->previous_cluster = file->current_cluster++;
+            file->cluster_index++;
+            continue;
+        }
+        RETURN_ON_ERROR(read_cluster_fat_entry(file->current_cluster, &next_cluster));
+        if (next_cluster >= FAT32_FAT_ENTRY_EOC)
+        {
+            file_chain_end(file, file->current_cluster, file->cluster_index + 1);
+            if (!extend)
+            {
+                return FAT32_ERROR_INVALID_POSITION;
+            }
+            RETURN_ON_ERROR(grow_chain(file, &next_cluster));
+        }
+        else if (file->current_cluster == file->last_cluster)
+        {
+            file->last_cluster = 0; // Grown by another handle
+        }
+        file->previous_cluster = file->current_cluster;
+        file->current_cluster = next_cluster;
+        file->cluster_index++;
+    }
+    return FAT32_OK;
+}
+
 //
 // Mount the SD Card functions
 //
@@ -417,6 +911,10 @@ fat32_error_t fat32_mount(void)
     }
 
     current_dir_cluster = boot_sector.root_cluster; // Start at root directory
+    chain_hint.start_cluster = 0;                   // Of the card before, if any
+    reserve_hint.reserved = false;                  // Likewise
+    fat_drop();                                     // Likewise
+    dir_changed(true);                              // Likewise
 
     // Cache the FSInfo sector
     RETURN_ON_ERROR(read_sector(boot_sector.fat32_info, sector_buffer));
@@ -430,6 +928,7 @@ fat32_error_t fat32_mount(void)
     }
 
     fat32_mounted = true;
+    mount_count++;
     return FAT32_OK;
 }
 
@@ -443,6 +942,9 @@ void fat32_unmount(void)
     cluster_count = 0;
     bytes_per_cluster = 0;
     current_dir_cluster = 0;
+    reserve_hint.reserved = false; // Gone with the card
+    fat_drop();
+    dir_changed(true);
 }
 
 bool fat32_is_mounted(void)
@@ -450,6 +952,11 @@ bool fat32_is_mounted(void)
     return fat32_mounted;
 }
 
+uint32_t fat32_mount_count(void)
+{
+    return mount_count;
+}
+
 bool fat32_is_ready(void)
 {
     if (sd_card_present())
@@ -494,10 +1001,11 @@ fat32_error_t fat32_get_free_space(uint64_t *free_space)
     }
 
     // If FSInfo is not valid, we will count free clusters manually
+    RETURN_ON_ERROR(fat_flush());
     uint64_t free_clusters = 0;
     for (uint32_t sector = 0; sector < boot_sector.fat_size_32; sector++)
     {
-        RETURN_ON_ERROR(read_sector(boot_sector.reserved_sectors + sector, sector_buffer));
+        RETURN_ON_ERROR(read_sector(fat_copy_start(fat_active()) + sector, sector_buffer));
         for (int i = 0; i < FAT32_SECTOR_SIZE; i += 4)
         {
             uint32_t entry = *(uint32_t *)(sector_buffer + i) & 0x0FFFFFFF;
@@ -536,6 +1044,72 @@ uint32_t fat32_get_cluster_size(void)
     return boot_sector.sectors_per_cluster * FAT32_SECTOR_SIZE;
 }
 
+void fat32_get_io_stats(uint32_t *reads, uint32_t *writes)
+{
+    // Sectors transferred since power up, for benchmarking
+    *reads = sectors_read;
+    *writes = sectors_written;
+}
+
+void fat32_get_fat_stats(uint32_t *hits, uint32_t *misses)
+{
+    // FAT sector lookups since power up, by whether a buffer had the sector
+    *hits = fat_hits;
+    *misses = fat_misses;
+}
+
+void fat32_io_capture(fat32_io_record_t *records, uint32_t capacity)
+{
+    // Logs every sector access into records, until capacity; NULL stops logging.
+    // The log is kept until the next capture starts.
+    io_logging = false;
+    if (records)
+    {
+        io_log = records;
+        io_log_capacity = capacity;
+        io_log_count = 0;
+        io_log_dropped = 0;
+        io_log_start = time_us_32();
+        io_logging = true;
+    }
+}
+
+uint32_t fat32_io_captured(uint32_t *dropped)
+{
+    if (dropped)
+    {
+        *dropped = io_log_dropped;
+    }
+    return io_log_count;
+}
+
+void fat32_io_write_log(FILE *file)
+{
+    // One "time_us,op,sector,caller" line per access, for host/bench/ioreplay.py.
+    // Logging is paused meanwhile, so that the log does not record its own writes.
+    // Lines are gathered into whole sectors before they are written.
+    bool logging = io_logging;
+    char chunk[FAT32_SECTOR_SIZE + 64];
+    size_t length;
+
+    io_logging = false;
+    length = snprintf(chunk, sizeof(chunk), "# runcpm sector log, volume start %lu, cluster %lu bytes, %lu dropped\n",
+                      (unsigned long)volume_start_block, (unsigned long)bytes_per_cluster, (unsigned long)io_log_dropped);
+    for (uint32_t i = 0; i < io_log_count; i++)
+    {
+        fat32_io_record_t *record = &io_log[i];
+        length += snprintf(chunk + length, sizeof(chunk) - length, "%lu,%c,%lu,%s\n", (unsigned long)record->time_us,
+                           record->op, (unsigned long)record->sector, record->caller);
+        if (length >= FAT32_SECTOR_SIZE)
+        {
+            fwrite(chunk, 1, length, file);
+            length = 0;
+        }
+    }
+    fwrite(chunk, 1, length, file);
+    io_logging = logging;
+}
+
 fat32_error_t fat32_get_volume_name(char *name, size_t name_len)
 {
     if (!name || name_len < 12)
@@ -624,14 +1198,16 @@ static void filename_to_shortname(const char *filename, char *shortname)
     }
 }
 
-static void shortname_to_filename(const char *shortname, char *filename)
+// The nt_res flags say which parts of an 8.3 entry without a long name are
+// shown in lower case
+static void shortname_to_filename(const char *shortname, uint8_t nt_res, char *filename)
 {
     int pos = 0;
 
     // Copy name part
     for (int i = 0; i < 8 && shortname[i] != ' '; i++)
     {
-        filename[pos++] = tolower(shortname[i]);
+        filename[pos++] = (nt_res & FAT32_NT_LOWER_BASE) ? tolower(shortname[i]) : shortname[i];
     }
 
     // Copy extension part
@@ -645,7 +1221,7 @@ static void shortname_to_filename(const char *shortname, char *filename)
                 filename[pos++] = '.';
                 has_ext = true;
             }
-            filename[pos++] = tolower(shortname[i]);
+            filename[pos++] = (nt_res & FAT32_NT_LOWER_EXT) ? tolower(shortname[i]) : shortname[i];
         }
     }
 
@@ -770,121 +1346,151 @@ static bool shortname_exists(const char *shortname, fat32_file_t *dir)
     return false;
 }
 
-static fat32_error_t unique_shortname(fat32_file_t *dir, const char *longname, char *shortname)
+// Numeric tails ~1 to ~(SHORTNAME_TAILS - 1) that one directory pass keeps
+// track of. Beyond them each candidate costs a directory scan
+#define SHORTNAME_TAILS (256)
+
+// The short name of a long name: its basis, made from the long name as
+// Windows does, and what the entries of the directory already use of it
+typedef struct
 {
-    // Generates a unique FAT 8.3 short name for a given long filename in a directory
-    // dir: open directory to check for collisions
-    // longname: input long filename (UTF-8, ASCII only here)
-    // shortname: output buffer, must be at least 12 bytes (11 chars + null terminator)
+    char basis[12];   // 8.3 name without a numeric tail, space padded
+    uint8_t base_len; // Characters in the name part of basis
+    bool lossy;       // The long name lost characters in basis, a tail is needed
+    bool basis_used;  // An entry has basis as its short name
+    uint8_t tails_used[SHORTNAME_TAILS / 8];
+} shortname_gen_t;
+
+static inline bool shortname_char_valid(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c && strchr("$%'-_@~`!(){}^#&", c));
+}
 
-    // Step 1: Uppercase and Step 2: Convert to OEM (ASCII only here)
-    char upper[FAT32_MAX_FILENAME_LEN + 1];
-    size_t len = strlen(longname);
-    for (size_t i = 0; i < len && i < FAT32_MAX_FILENAME_LEN; ++i)
-    {
-        upper[i] = toupper((unsigned char)longname[i]);
-    }
-    upper[len] = '\0';
+static void shortname_basis(const char *longname, shortname_gen_t *gen)
+{
+    memset(gen, 0, sizeof(shortname_gen_t));
 
-    // Step 3: Strip leading/embedded spaces
+    // Uppercase (and OEM, ASCII only here), stripping spaces
     char temp[FAT32_MAX_FILENAME_LEN + 1];
     size_t j = 0;
-    for (size_t i = 0; i < len; ++i)
+    for (size_t i = 0; longname[i] && j < FAT32_MAX_FILENAME_LEN; ++i)
     {
-        if (upper[i] != ' ')
+        if (longname[i] != ' ')
         {
-            temp[j++] = upper[i];
+            temp[j++] = toupper((unsigned char)longname[i]);
+        }
+        else
+        {
+            gen->lossy = true;
         }
     }
     temp[j] = '\0';
 
-    // Step 4: Strip leading periods
+    // Strip leading periods
     char *p = temp;
     while (*p == '.')
+    {
         p++;
+        gen->lossy = true;
+    }
 
-    // Step 5: Copy up to 8 chars before dot, replace invalids with '_'
-    size_t name_len = 0;
-    size_t ext_len = 0;
-    int lossy = 0;
     char *dot = strrchr(p, '.');
     if (dot == p)
+    {
         dot = NULL; // ignore leading dot
+    }
 
-    char base[9] = {0};
-    for (size_t i = 0; p[i] && &p[i] != dot && name_len < 8; ++i)
+    // Up to 8 characters before the dot and 3 after it, invalid ones as '_'
+    memset(gen->basis, ' ', 11);
+    size_t i = 0;
+    for (; p[i] && &p[i] != dot && gen->base_len < 8; ++i)
     {
-        char c = p[i];
-        if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
-            strchr("$%'-_@~`!(){}^#&", c))
-        {
-            base[name_len++] = c;
-        }
-        else
-        {
-            base[name_len++] = '_';
-            lossy = 1;
-        }
+        bool valid = shortname_char_valid(p[i]);
+        gen->basis[gen->base_len++] = valid ? p[i] : '_';
+        gen->lossy |= !valid;
     }
-    base[name_len] = '\0';
+    gen->lossy |= p[i] && &p[i] != dot; // Name truncated
 
-    // Extension
-    char ext[4] = {0};
-    if (dot && *(dot + 1))
+    if (dot)
     {
-        for (size_t i = 1; i <= 3 && dot[i]; ++i)
+        for (i = 1; i <= 3 && dot[i]; ++i)
         {
-            char c = dot[i];
-            if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
-                strchr("$%'-_@~`!(){}^#&", c))
-            {
-                ext[ext_len++] = c;
-            }
-            else
-            {
-                ext[ext_len++] = '_';
-                lossy = 1;
-            }
+            bool valid = shortname_char_valid(dot[i]);
+            gen->basis[8 + i - 1] = valid ? dot[i] : '_';
+            gen->lossy |= !valid;
         }
+        gen->lossy |= dot[i] != '\0'; // Extension truncated
     }
-    ext[ext_len] = '\0';
+}
 
-    // Compose initial candidate
-    char candidate[12];
-    memset(candidate, ' ', 11);
-    memcpy(candidate, base, strlen(base));
-    memcpy(candidate + 8, ext, strlen(ext));
-    candidate[11] = '\0';
+// The basis with the numeric tail ~n, cutting the name part to make room
+static void shortname_tail(const shortname_gen_t *gen, uint32_t n, char *shortname)
+{
+    char tail[8];
+    size_t tail_len = snprintf(tail, sizeof(tail), "~%lu", (unsigned long)n);
+    size_t base_len = 8 - tail_len;
+    if (base_len > gen->base_len)
+    {
+        base_len = gen->base_len;
+    }
 
-    // Check if numeric tail is needed
-    bool need_tail = lossy || name_len > 8 || ext_len > 3 || shortname_exists(candidate, dir);
+    memcpy(shortname, gen->basis, 12);
+    memset(shortname, ' ', 8);
+    memcpy(shortname, gen->basis, base_len);
+    memcpy(shortname + base_len, tail, tail_len);
+}
 
-    if (!need_tail)
+// Notes the short name of a directory entry, when it is the basis or the
+// basis with a numeric tail
+static void shortname_note(shortname_gen_t *gen, const char *shortname)
+{
+    if (memcmp(shortname + 8, gen->basis + 8, 3) != 0)
     {
-        memcpy(shortname, candidate, 12);
-        return FAT32_OK;
+        return; // Another extension
     }
-
-    // Numeric tail generation: try ~1 to ~999999
-    for (int n = 1; n < 1000000; n++)
+    if (memcmp(shortname, gen->basis, 8) == 0)
     {
-        char tail[8];
-        snprintf(tail, sizeof(tail), "~%d", n);
-        size_t tail_len = strlen(tail);
+        gen->basis_used = true;
+        return;
+    }
 
-        size_t base_len = 8 - tail_len;
-        if (base_len > strlen(base))
-            base_len = strlen(base);
+    const char *tilde = memchr(shortname, '~', 8);
+    if (!tilde)
+    {
+        return;
+    }
+    uint32_t n = 0;
+    const char *c = tilde + 1;
+    for (; c < shortname + 8 && *c >= '0' && *c <= '9'; c++)
+    {
+        n = n * 10 + (*c - '0');
+    }
+    if (n > 0 && n < SHORTNAME_TAILS)
+    {
+        char candidate[12];
+        shortname_tail(gen, n, candidate);
+        if (memcmp(candidate, shortname, 11) == 0)
+        {
+            gen->tails_used[n / 8] |= 1 << (n % 8);
+        }
+    }
+}
 
-        memset(candidate, ' ', 11);
-        memcpy(candidate, base, base_len);
-        memcpy(candidate + base_len, tail, tail_len);
-        memcpy(candidate + 8, ext, strlen(ext));
-        candidate[11] = '\0';
+// Puts in shortname the basis, or when it needs one, the basis with the first
+// numeric tail that no entry of dir uses
+static fat32_error_t shortname_pick(const shortname_gen_t *gen, fat32_file_t *dir, char *shortname)
+{
+    if (!gen->lossy && !gen->basis_used)
+    {
+        memcpy(shortname, gen->basis, 12);
+        return FAT32_OK;
+    }
 
-        if (!shortname_exists(candidate, dir))
+    for (uint32_t n = 1; n < 1000000; n++)
+    {
+        shortname_tail(gen, n, shortname);
+        if (n < SHORTNAME_TAILS ? !(gen->tails_used[n / 8] & (1 << (n % 8))) : !shortname_exists(shortname, dir))
         {
-            memcpy(shortname, candidate, 12);
             return FAT32_OK;
         }
     }
@@ -893,6 +1499,38 @@ static fat32_error_t unique_shortname(fat32_file_t *dir, const char *longname, c
     return FAT32_ERROR_DISK_FULL;
 }
 
+// Whether a valid 8.3 name can go without a long name entry: its name and
+// its extension are each in one case. The lower case ones are flagged in
+// nt_res, as Windows does
+static bool shortname_case(const char *filename, uint8_t *nt_res)
+{
+    const char *dot = strchr(filename, '.');
+    const uint8_t flags[2] = {FAT32_NT_LOWER_BASE, FAT32_NT_LOWER_EXT};
+    const char *part[2] = {filename, dot ? dot + 1 : ""};
+    size_t len[2] = {dot ? (size_t)(dot - filename) : strlen(filename), dot ? strlen(dot + 1) : 0};
+
+    *nt_res = 0;
+    for (int p = 0; p < 2; p++)
+    {
+        bool upper = false;
+        bool lower = false;
+        for (size_t i = 0; i < len[p]; i++)
+        {
+            upper |= isupper((unsigned char)part[p][i]) != 0;
+            lower |= islower((unsigned char)part[p][i]) != 0;
+        }
+        if (upper && lower)
+        {
+            return false;
+        }
+        if (lower)
+        {
+            *nt_res |= flags[p];
+        }
+    }
+    return true;
+}
+
 static uint8_t shortname_checksum(const char *shortname)
 {
     // Calculate checksum for 8.3 filename
@@ -923,6 +1561,102 @@ static void lfn_to_str(fat32_lfn_entry_t *lfn_entry, char *buffer)
     *(buffer++) = utf16_to_utf8(lfn_entry->name3[1]);
 }
 
+//
+// CP/M tree index
+//
+
+static void dir_from_cluster(fat32_file_t *dir, uint32_t cluster)
+{
+    memset(dir, 0, sizeof(fat32_file_t));
+    dir->is_open = true;
+    dir->attributes = FAT32_ATTR_DIRECTORY;
+    dir->start_cluster = cluster;
+    dir->current_cluster = cluster;
+}
+
+// The drive (0 = A:) or user area a one character folder name stands for,
+// 0xFF for none
+static uint8_t cpm_folder(char name, bool drive)
+{
+    char c = toupper((unsigned char)name);
+    if (drive)
+    {
+        return c >= 'A' && c <= 'P' ? c - 'A' : 0xFF;
+    }
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    return c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0xFF;
+}
+
+// Puts in clusters the first folder of the directory at cluster named after
+// each drive, or user area, as find_entry would find it
+static fat32_error_t cpm_scan(uint32_t cluster, bool drive, uint32_t clusters[16])
+{
+    fat32_file_t dir;
+    fat32_entry_t entry;
+    fat32_error_t result;
+
+    memset(clusters, 0, 16 * sizeof(uint32_t));
+    dir_from_cluster(&dir, cluster);
+    while ((result = fat32_dir_read(&dir, &entry)) == FAT32_OK && entry.filename[0])
+    {
+        uint8_t index = entry.filename[1] ? 0xFF : cpm_folder(entry.filename[0], drive);
+        if (index != 0xFF && (entry.attr & FAT32_ATTR_DIRECTORY) && entry.start_cluster && !clusters[index])
+        {
+            clusters[index] = entry.start_cluster;
+        }
+    }
+    return result;
+}
+
+static fat32_error_t cpm_index(uint8_t drive)
+{
+    if (!cpm_root_indexed)
+    {
+        RETURN_ON_ERROR(cpm_scan(boot_sector.root_cluster, true, cpm_drive_clusters));
+        cpm_root_indexed = true;
+        cpm_drives_indexed = 0;
+    }
+    if (!(cpm_drives_indexed & (1 << drive)))
+    {
+        if (cpm_drive_clusters[drive])
+        {
+            RETURN_ON_ERROR(cpm_scan(cpm_drive_clusters[drive], false, cpm_dirs[drive]));
+        }
+        else
+        {
+            memset(cpm_dirs[drive], 0, sizeof(cpm_dirs[drive]));
+        }
+        cpm_drives_indexed |= 1 << drive;
+    }
+    return FAT32_OK;
+}
+
+// The cluster of the user folder /X/U that path starts with, from the index,
+// with rest what follows it. 0 for other paths and folders not on the card
+static uint32_t cpm_path_cluster(const char *path, const char **rest)
+{
+    if (path[0] != '/' || !path[1] || path[2] != '/' || !path[3] || (path[4] && path[4] != '/'))
+    {
+        return 0;
+    }
+    uint8_t drive = cpm_folder(path[1], true);
+    uint8_t user = cpm_folder(path[3], false);
+    if (drive == 0xFF || user == 0xFF || cpm_index(drive) != FAT32_OK)
+    {
+        return 0;
+    }
+    *rest = path[4] ? path + 5 : path + 4;
+    return cpm_dirs[drive][user];
+}
+
+uint32_t fat32_dir_generation(void)
+{
+    return dir_generation;
+}
+
 static fat32_error_t find_entry(fat32_entry_t *dir_entry, const char *path)
 {
     if (!dir_entry || !path)
@@ -958,6 +1692,15 @@ static fat32_error_t find_entry(fat32_entry_t *dir_entry, const char *path)
         cluster = boot_sector.root_cluster;
     }
 
+    // Below a user folder of a CP/M drive, the walk starts in it
+    const char *rest;
+    uint32_t indexed = cpm_path_cluster(path, &rest);
+    if (indexed && *rest)
+    {
+        cluster = indexed;
+        path = rest;
+    }
+
     // Copy path and tokenize
     char path_copy[FAT32_MAX_PATH_LEN];
     strncpy(path_copy, path + (path[0] == '/' ? 1 : 0), sizeof(path_copy) - 1);
@@ -972,12 +1715,8 @@ static fat32_error_t find_entry(fat32_entry_t *dir_entry, const char *path)
         next_token = strtok_r(NULL, "/", &saveptr);
 
         // Open the current directory cluster
-        fat32_file_t dir = {0};
-        dir.is_open = true;
-        dir.attributes = FAT32_ATTR_DIRECTORY;
-        dir.start_cluster = cluster;
-        dir.current_cluster = cluster;
-        dir.position = 0;
+        fat32_file_t dir;
+        dir_from_cluster(&dir, cluster);
 
         bool found = false;
         fat32_entry_t entry;
@@ -1012,44 +1751,42 @@ static fat32_error_t find_entry(fat32_entry_t *dir_entry, const char *path)
     return FAT32_ERROR_FILE_NOT_FOUND; // Not found
 }
 
-static fat32_error_t unlink_entry(fat32_entry_t *entry)
+// Marks the 8.3 entry at offset of the directory sector in buffer, and the
+// LFN entries before it in the same sector, as deleted
+static void mark_entry_free(uint8_t *buffer, uint32_t offset)
 {
-    if (!entry || entry->start_cluster == 0)
-    {
-        return FAT32_ERROR_INVALID_PARAMETER;
-    }
-
-    // Mark the entry as deleted
-    uint32_t sector = entry->sector;
-    uint32_t offset = entry->offset;
-
-    RETURN_ON_ERROR(read_sector(sector, sector_buffer));
-
     // Scan backwards for LFN entries
-    int lfn_count = 0;
-    for (int i = 1; i <= MAX_LFN_PART; i++)
+    for (uint32_t i = 1; i <= MAX_LFN_PART; i++)
     {
         if (offset < i * 32)
         {
             break;
         }
-        fat32_dir_entry_t *lfn_entry = (fat32_dir_entry_t *)(sector_buffer + offset - i * 32);
-        if (lfn_entry->attr == FAT32_ATTR_LONG_NAME)
-        {
-            lfn_entry->shortname[0] = FAT32_DIR_ENTRY_FREE;
-            lfn_count++;
-        }
-        else
+        fat32_dir_entry_t *lfn_entry = (fat32_dir_entry_t *)(buffer + offset - i * 32);
+        if (lfn_entry->attr != FAT32_ATTR_LONG_NAME)
         {
             break;
         }
+        lfn_entry->shortname[0] = FAT32_DIR_ENTRY_FREE;
     }
 
     // Mark 8.3 entry as deleted
-    fat32_dir_entry_t *dir_entry = (fat32_dir_entry_t *)(sector_buffer + offset);
+    fat32_dir_entry_t *dir_entry = (fat32_dir_entry_t *)(buffer + offset);
     dir_entry->shortname[0] = FAT32_DIR_ENTRY_FREE;
+}
+
+static fat32_error_t unlink_entry(fat32_entry_t *entry)
+{
+    // An empty file has no cluster, start_cluster 0 is fine
+    if (!entry || entry->offset >= FAT32_SECTOR_SIZE)
+    {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
 
-    RETURN_ON_ERROR(write_sector(sector, sector_buffer));
+    RETURN_ON_ERROR(read_sector(entry->sector, sector_buffer));
+    mark_entry_free(sector_buffer, entry->offset);
+    RETURN_ON_ERROR(write_sector(entry->sector, sector_buffer));
+    dir_changed(entry->attr & FAT32_ATTR_DIRECTORY);
 
     return FAT32_OK;
 }
@@ -1066,17 +1803,6 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
         return mount_status;
     }
 
-    fat32_entry_t temp_entry;
-    fat32_error_t result = find_entry(&temp_entry, path);
-    if (result != FAT32_ERROR_FILE_NOT_FOUND)
-    {
-        if (result == FAT32_OK)
-        {
-            return FAT32_ERROR_FILE_EXISTS;
-        }
-        return result;
-    }
-
     // Split path into parent and filename
     char path_copy[FAT32_MAX_PATH_LEN];
     strncpy(path_copy, path, sizeof(path_copy) - 1);
@@ -1096,31 +1822,56 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
 
     // Open parent directory
     fat32_file_t dir;
-    RETURN_ON_ERROR(fat32_open(&dir, parent_path));
+    fat32_error_t result = fat32_open(&dir, parent_path);
+    if (result != FAT32_OK)
+    {
+        return result == FAT32_ERROR_FILE_NOT_FOUND ? FAT32_ERROR_DIR_NOT_FOUND : result;
+    }
+    if (!(dir.attributes & FAT32_ATTR_DIRECTORY))
+    {
+        fat32_close(&dir);
+        return FAT32_ERROR_NOT_A_DIRECTORY;
+    }
 
-    // Prepare short and long file names
-    // We always use long files names to preserve case and special characters
+    // Prepare short and long file names. A valid 8.3 name in one case per
+    // part (all CP/M names) is its own short name, with no long name entries.
+    // Others get long name entries, to preserve case and special characters
     char shortname[12];
-    size_t needed_entries = filename_to_lfn(filename);
+    uint8_t nt_res = 0;
+    size_t needed_entries = 0;
+    bool short_only = valid_shortname(filename);
+    shortname_gen_t gen;
 
-    if (valid_shortname(filename))
+    if (short_only)
     {
         filename_to_shortname(filename, shortname);
+        if (!shortname_case(filename, &nt_res))
+        {
+            needed_entries = filename_to_lfn(filename);
+        }
     }
     else
     {
-        CLOSE_AND_RETURN_ON_ERROR(unique_shortname(&dir, filename, shortname));
+        shortname_basis(filename, &gen);
+        needed_entries = filename_to_lfn(filename);
     }
 
-    // Find enough free directory entries (LFN + 8.3)
+    // One pass over the directory: the name must not be there, the short
+    // names in the way of a numeric tail are noted, and a run of free entries
+    // is found for the long name and 8.3 entries. Long names are put together
+    // only for a name that needs one. A directory without room gets a cluster
+    char longname[FAT32_MAX_FILENAME_LEN + 1];
+    uint8_t expected_checksum = 0;
+    longname[0] = '\0';
+
     uint32_t free_entry_pos = 0;
-    uint32_t free_entry_cluster = dir.current_cluster;
+    uint32_t free_entry_cluster = dir.start_cluster;
     size_t free_count = 0;
     bool found = false;
-    dir.position = 0;
+    bool ended = false; // End marker seen, no names past it
     uint32_t entry_pos = 0;
-    uint32_t cluster = dir.current_cluster;
-    while (!found)
+    uint32_t cluster = dir.start_cluster;
+    while (!(found && ended))
     {
         uint32_t cluster_offset = entry_pos % bytes_per_cluster;
         uint32_t sector_in_cluster = cluster_offset / FAT32_SECTOR_SIZE;
@@ -1128,29 +1879,85 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
 
         CLOSE_AND_RETURN_ON_ERROR(read_sector(sector, sector_buffer));
 
-        for (uint32_t i = 0; i < FAT32_SECTOR_SIZE; i += 32)
-        {
-            fat32_dir_entry_t *entry_ptr = (fat32_dir_entry_t *)(sector_buffer + i);
-            if (entry_ptr->shortname[0] == FAT32_DIR_ENTRY_FREE || entry_ptr->shortname[0] == FAT32_DIR_ENTRY_END_MARKER)
+        for (uint32_t i = 0; i < FAT32_SECTOR_SIZE && !(found && ended); i += 32)
+        {
+            fat32_dir_entry_t *entry_ptr = (fat32_dir_entry_t *)(sector_buffer + i);
+            uint8_t first = entry_ptr->shortname[0];
+            ended |= first == FAT32_DIR_ENTRY_END_MARKER;
+
+            if (first == FAT32_DIR_ENTRY_FREE || first == FAT32_DIR_ENTRY_END_MARKER)
+            {
+                longname[0] = '\0';
+                if (found)
+                {
+                    continue;
+                }
+                if (free_count == 0)
+                {
+                    free_entry_pos = entry_pos + i;
+                    free_entry_cluster = cluster;
+                }
+                free_count++;
+                found = free_count > needed_entries;
+                continue;
+            }
+
+            if (!found)
+            {
+                free_count = 0;
+            }
+            if (ended)
+            {
+                continue; // Not a name, past the end marker
+            }
+
+            if (entry_ptr->attr == FAT32_ATTR_LONG_NAME)
+            {
+                if (!short_only)
+                {
+                    fat32_lfn_entry_t *lfn_entry = (fat32_lfn_entry_t *)entry_ptr;
+                    if (lfn_entry->seq & 0x40)
+                    {
+                        memset(longname, 0, sizeof(longname));
+                        expected_checksum = lfn_entry->checksum;
+                    }
+                    if (lfn_entry->checksum == expected_checksum)
+                    {
+                        int offset = ((lfn_entry->seq & 0x3F) - 1) * FAT32_DIR_LFN_PART_SIZE;
+                        lfn_to_str(lfn_entry, longname + offset);
+                    }
+                }
+                continue;
+            }
+
+            bool exists;
+            if (short_only)
             {
-                if (free_count == 0)
+                exists = memcmp(entry_ptr->shortname, shortname, 11) == 0;
+            }
+            else
+            {
+                char entry_name[FAT32_MAX_FILENAME_LEN + 1];
+                if (longname[0] != '\0' && expected_checksum == shortname_checksum(entry_ptr->shortname))
                 {
-                    free_entry_pos = entry_pos + i;
-                    free_entry_cluster = cluster;
+                    strcpy(entry_name, longname);
                 }
-                free_count++;
-                if (free_count > needed_entries)
+                else
                 {
-                    found = true;
-                    break;
+                    shortname_to_filename(entry_ptr->shortname, entry_ptr->nt_res, entry_name);
                 }
+                exists = strcasecmp(entry_name, filename) == 0;
+                shortname_note(&gen, entry_ptr->shortname);
             }
-            else
+            longname[0] = '\0';
+
+            if (exists)
             {
-                free_count = 0;
+                fat32_close(&dir);
+                return FAT32_ERROR_FILE_EXISTS;
             }
         }
-        if (found)
+        if (found && ended)
         {
             break;
         }
@@ -1159,14 +1966,19 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
         if ((entry_pos % bytes_per_cluster) == 0)
         {
             uint32_t next_cluster;
-            result = read_cluster_fat_entry(cluster, &next_cluster);
-            if (result != FAT32_OK || next_cluster >= FAT32_FAT_ENTRY_EOC)
+            CLOSE_AND_RETURN_ON_ERROR(read_cluster_fat_entry(cluster, &next_cluster));
+            if (next_cluster >= FAT32_FAT_ENTRY_EOC)
             {
+                if (found)
+                {
+                    break; // The whole directory was scanned
+                }
                 // Allocate a new cluster for the directory
                 uint32_t new_dir_cluster = 0;
                 CLOSE_AND_RETURN_ON_ERROR(allocate_and_link_cluster(cluster, &new_dir_cluster));
                 CLOSE_AND_RETURN_ON_ERROR(clear_cluster(new_dir_cluster));
                 cluster = new_dir_cluster;
+                ended = true;
             }
             else
             {
@@ -1175,53 +1987,9 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
         }
     }
 
-    // Update the directory entry with the new cluster
-    uint8_t checksum = shortname_checksum(shortname);
-
-    // Write LFN entries in reverse order (last entry first)
-    for (int i = 0; i < needed_entries; i++)
+    if (!short_only)
     {
-        uint8_t index = needed_entries - i - 1;
-
-        // Calculate position for this LFN entry
-        uint32_t entry_offset = free_entry_pos + (i * 32);
-        uint32_t entry_cluster_offset = entry_offset % bytes_per_cluster;
-        uint32_t entry_sector_in_cluster = entry_cluster_offset / FAT32_SECTOR_SIZE;
-        uint32_t entry_byte_in_sector = entry_cluster_offset % FAT32_SECTOR_SIZE;
-        uint32_t current_cluster = free_entry_cluster;
-
-        // Check if we need to move to next cluster
-        while (entry_sector_in_cluster >= boot_sector.sectors_per_cluster)
-        {
-            uint32_t next_cluster;
-            result = read_cluster_fat_entry(current_cluster, &next_cluster);
-            if (result != FAT32_OK || next_cluster >= FAT32_FAT_ENTRY_EOC)
-            {
-                fat32_close(&dir);
-                return FAT32_ERROR_DISK_FULL;
-            }
-            current_cluster = next_cluster;
-            entry_sector_in_cluster -= boot_sector.sectors_per_cluster;
-        }
-
-        uint32_t entry_sector = cluster_to_sector(current_cluster) + entry_sector_in_cluster;
-
-        // Read the sector if needed
-        CLOSE_AND_RETURN_ON_ERROR(read_sector(entry_sector, sector_buffer));
-
-        // Set up the LFN entry with checksum and sequence number
-        fat32_lfn_entry_t *lfn_entry = &lfn_buffer[index];
-        lfn_entry->seq = (i == 0) ? (index + 1) | 0x40 : (index + 1); // Set last entry flag
-        lfn_entry->attr = FAT32_ATTR_LONG_NAME;
-        lfn_entry->type = 0;
-        lfn_entry->checksum = checksum;
-        lfn_entry->first_clus = 0;
-
-        // Copy LFN entry to sector buffer
-        memcpy(sector_buffer + entry_byte_in_sector, lfn_entry, sizeof(fat32_lfn_entry_t));
-
-        // Write the sector back
-        CLOSE_AND_RETURN_ON_ERROR(write_sector(entry_sector, sector_buffer));
+        CLOSE_AND_RETURN_ON_ERROR(shortname_pick(&gen, &dir, shortname));
     }
 
     // Allocate a new cluster for the file, if needed
@@ -1237,11 +2005,11 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
         }
     }
 
-    // Write 8.3 entry
+    // 8.3 entry
     fat32_dir_entry_t dir_entry = {0};
     memcpy(dir_entry.shortname, shortname, 11);
     dir_entry.attr = entry->attr; // Normal file
-    dir_entry.nt_res = 0;
+    dir_entry.nt_res = nt_res;
     dir_entry.crt_time_tenth = 0;
     dir_entry.crt_time = 0;
     dir_entry.crt_date = 0;
@@ -1252,12 +2020,65 @@ static fat32_error_t link_entry(fat32_entry_t *entry, const char *path)
     dir_entry.fst_clus_lo = entry->start_cluster & 0xFFFF;
     dir_entry.file_size = entry->size;
 
-    uint32_t raw_offset = free_entry_pos + (needed_entries * 32);
-    entry->sector = cluster_to_sector(free_entry_cluster) + ((raw_offset % bytes_per_cluster) / FAT32_SECTOR_SIZE);
-    entry->offset = (raw_offset % FAT32_SECTOR_SIZE);
-    CLOSE_AND_RETURN_ON_ERROR(read_sector(entry->sector, sector_buffer));
-    memcpy(sector_buffer + entry->offset, &dir_entry, sizeof(dir_entry));
-    CLOSE_AND_RETURN_ON_ERROR(write_sector(entry->sector, sector_buffer));
+    // Write the LFN entries in reverse order (last part first) and then the
+    // 8.3 entry, one write per directory sector, once the FAT is. The run of
+    // free entries may go on in the next cluster of the directory
+    CLOSE_AND_RETURN_ON_ERROR(fat_flush());
+    uint8_t checksum = shortname_checksum(shortname);
+    uint32_t slot_cluster = free_entry_cluster;
+    uint32_t slot_offset = free_entry_pos % bytes_per_cluster;
+    uint32_t slot_sector = 0; // In sector_buffer, 0 for none
+    for (size_t i = 0; i <= needed_entries; i++, slot_offset += 32)
+    {
+        if (slot_offset == bytes_per_cluster)
+        {
+            CLOSE_AND_RETURN_ON_ERROR(write_sector(slot_sector, sector_buffer));
+            slot_sector = 0;
+
+            uint32_t next_cluster;
+            CLOSE_AND_RETURN_ON_ERROR(read_cluster_fat_entry(slot_cluster, &next_cluster));
+            if (next_cluster >= FAT32_FAT_ENTRY_EOC)
+            {
+                fat32_close(&dir);
+                return FAT32_ERROR_DISK_FULL;
+            }
+            slot_cluster = next_cluster;
+            slot_offset = 0;
+        }
+
+        uint32_t sector = cluster_to_sector(slot_cluster) + slot_offset / FAT32_SECTOR_SIZE;
+        if (sector != slot_sector)
+        {
+            if (slot_sector)
+            {
+                CLOSE_AND_RETURN_ON_ERROR(write_sector(slot_sector, sector_buffer));
+            }
+            CLOSE_AND_RETURN_ON_ERROR(read_sector(sector, sector_buffer));
+            slot_sector = sector;
+        }
+
+        uint8_t *slot = sector_buffer + slot_offset % FAT32_SECTOR_SIZE;
+        if (i < needed_entries)
+        {
+            // Set up the LFN entry with checksum and sequence number
+            uint8_t index = needed_entries - i - 1;
+            fat32_lfn_entry_t *lfn_entry = &lfn_buffer[index];
+            lfn_entry->seq = (i == 0) ? (index + 1) | 0x40 : (index + 1); // Set last entry flag
+            lfn_entry->attr = FAT32_ATTR_LONG_NAME;
+            lfn_entry->type = 0;
+            lfn_entry->checksum = checksum;
+            lfn_entry->first_clus = 0;
+            memcpy(slot, lfn_entry, sizeof(fat32_lfn_entry_t));
+        }
+        else
+        {
+            memcpy(slot, &dir_entry, sizeof(dir_entry));
+            entry->sector = sector;
+            entry->offset = slot_offset % FAT32_SECTOR_SIZE;
+        }
+    }
+    CLOSE_AND_RETURN_ON_ERROR(write_sector(slot_sector, sector_buffer));
+    dir_changed(entry->attr & FAT32_ATTR_DIRECTORY);
 
     fat32_close(&dir);
 
@@ -1273,6 +2094,14 @@ static fat32_error_t new_entry(fat32_file_t *file, const char *path, uint8_t att
 
     memset(file, 0, sizeof(fat32_file_t));
 
+    // A user folder of a CP/M drive is made on every change of user, it is
+    // mostly there already
+    const char *rest;
+    if (cpm_path_cluster(path, &rest) && !*rest)
+    {
+        return FAT32_ERROR_FILE_EXISTS;
+    }
+
     fat32_entry_t entry;
     memset(&entry, 0, sizeof(fat32_entry_t));
     entry.attr = attr;
@@ -1289,6 +2118,41 @@ static fat32_error_t new_entry(fat32_file_t *file, const char *path, uint8_t att
     return FAT32_OK; // Successfully created new file
 }
 
+// Deletes count found entries, sorted by sector as a directory scan finds
+// them: one write per directory sector, then the cluster chains of all of
+// them freed together
+static fat32_error_t delete_entries(const fat32_unlink_t *entries, uint32_t count)
+{
+    bool folder = false;
+    for (uint32_t i = 0; i < count;)
+    {
+        uint32_t sector = entries[i].sector;
+        RETURN_ON_ERROR(read_sector(sector, sector_buffer));
+        for (; i < count && entries[i].sector == sector; i++)
+        {
+            if (entries[i].offset >= FAT32_SECTOR_SIZE)
+            {
+                return FAT32_ERROR_INVALID_PARAMETER;
+            }
+            folder |= ((fat32_dir_entry_t *)(sector_buffer + entries[i].offset))->attr & FAT32_ATTR_DIRECTORY;
+            mark_entry_free(sector_buffer, entries[i].offset);
+        }
+        RETURN_ON_ERROR(write_sector(sector, sector_buffer));
+    }
+    if (count)
+    {
+        dir_changed(folder);
+    }
+
+    chain_release_t release;
+    release_begin(&release);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        RETURN_ON_ERROR(release_chain(&release, entries[i].start_cluster));
+    }
+    return release_end(&release);
+}
+
 static fat32_error_t delete_entry(const char *path)
 {
     fat32_entry_t entry;
@@ -1314,13 +2178,9 @@ static fat32_error_t delete_entry(const char *path)
         fat32_close(&dir);
     }
 
-    // Unlink the entry
-    RETURN_ON_ERROR(unlink_entry(&entry));
-
-    // Free the clusters used by the entry
-    RETURN_ON_ERROR(release_cluster_chain(entry.start_cluster));
-
-    return FAT32_OK;
+    // Unlink the entry and free its clusters
+    fat32_unlink_t unlink = {entry.sector, entry.offset, entry.start_cluster};
+    return delete_entries(&unlink, 1);
 }
 
 //
@@ -1346,6 +2206,16 @@ fat32_error_t fat32_open(fat32_file_t *file, const char *path)
 
     memset(file, 0, sizeof(fat32_file_t));
 
+    // A user folder of a CP/M drive comes from the index
+    const char *rest;
+    uint32_t indexed = cpm_path_cluster(path, &rest);
+    if (indexed && !*rest)
+    {
+        dir_from_cluster(file, indexed);
+        file->releases = release_count;
+        return FAT32_OK;
+    }
+
     fat32_entry_t entry;
     RETURN_ON_ERROR(find_entry(&entry, path));
 
@@ -1370,23 +2240,127 @@ fat32_error_t fat32_open(fat32_file_t *file, const char *path)
     file->attributes = entry.attr;
     file->dir_entry_sector = entry.sector;
     file->dir_entry_offset = entry.offset;
+    file->releases = release_count;
+
+    // Opened again, it carries on from where the chain was left
+    if (file->start_cluster >= 2 && chain_hint.start_cluster == file->start_cluster &&
+        chain_hint.dir_entry_sector == entry.sector && chain_hint.dir_entry_offset == entry.offset &&
+        chain_hint.releases == release_count)
+    {
+        file->current_cluster = chain_hint.current_cluster;
+        file->cluster_index = chain_hint.cluster_index;
+        file->previous_cluster = chain_hint.previous_cluster;
+        file->last_cluster = chain_hint.last_cluster;
+        file->run_first = chain_hint.run_first;
+        file->cluster_total = chain_hint.cluster_total;
+        file->size_hint = chain_hint.size_hint;
+        file->run_clusters = chain_hint.run_clusters; // Grown again, by runs as large
+    }
+
+    // Its reservation too, which is the open file's to free from now on
+    if (reserve_hint.reserved && reserve_hint.start_cluster == file->start_cluster &&
+        reserve_hint.dir_entry_sector == entry.sector && reserve_hint.dir_entry_offset == entry.offset)
+    {
+        if (reserve_hint.releases == release_count)
+        {
+            file->current_cluster = reserve_hint.current_cluster;
+            file->cluster_index = reserve_hint.cluster_index;
+            file->previous_cluster = reserve_hint.previous_cluster;
+            file->last_cluster = reserve_hint.last_cluster;
+            file->run_first = reserve_hint.run_first;
+            file->cluster_total = reserve_hint.cluster_total;
+        }
+        file->size_hint = reserve_hint.size_hint;
+        file->run_clusters = reserve_hint.run_clusters;
+        file->reserved = true;
+        reserve_hint.reserved = false;
+    }
 
     return FAT32_OK;
 }
 
 fat32_error_t fat32_create(fat32_file_t *file, const char *path)
 {
-    return new_entry(file, path, FAT32_ATTR_ARCHIVE);
+    return fat_commit(new_entry(file, path, FAT32_ATTR_ARCHIVE));
+}
+
+// Frees the clusters of the chain of file past its end, that grow_chain
+// reserved and the file did not reach. The first cluster is kept even for an
+// empty file, as fat32_truncate does
+static fat32_error_t trim_reservation(fat32_file_t *file)
+{
+    uint32_t needed_clusters = (file->file_size == 0) ? 1 : (file->file_size + bytes_per_cluster - 1) / bytes_per_cluster;
+    RETURN_ON_ERROR(file_seek_cluster(file, needed_clusters - 1, false));
+
+    uint32_t first_cluster_to_free;
+    RETURN_ON_ERROR(read_cluster_fat_entry(file->current_cluster, &first_cluster_to_free));
+    if (first_cluster_to_free >= 2 && first_cluster_to_free < FAT32_FAT_ENTRY_EOC)
+    {
+        RETURN_ON_ERROR(write_cluster_fat_entry(file->current_cluster, FAT32_FAT_ENTRY_EOC));
+        RETURN_ON_ERROR(release_cluster_chain(first_cluster_to_free));
+    }
+
+    // The chain ends here now, the cursor is still good
+    file->releases = release_count;
+    file_chain_end(file, file->current_cluster, needed_clusters);
+    file->reserved = false;
+    return FAT32_OK;
+}
+
+// Frees the clusters reserved for the file of reserve_hint
+static fat32_error_t trim_hint(void)
+{
+    fat32_error_t result = FAT32_OK;
+
+    if (reserve_hint.reserved)
+    {
+        reserve_hint.reserved = false;
+        result = trim_reservation(&reserve_hint);
+        if (result == FAT32_OK && chain_hint.start_cluster == reserve_hint.start_cluster &&
+            chain_hint.dir_entry_sector == reserve_hint.dir_entry_sector &&
+            chain_hint.dir_entry_offset == reserve_hint.dir_entry_offset)
+        {
+            chain_hint = reserve_hint; // Where its chain ends now
+        }
+    }
+    return result;
+}
+
+fat32_error_t fat32_sync(void)
+{
+    if (!fat32_is_ready())
+    {
+        return mount_status;
+    }
+    return fat_commit(trim_hint());
 }
 
 fat32_error_t fat32_close(fat32_file_t *file)
 {
+    fat32_error_t result = FAT32_OK;
+
     if (file && file->is_open)
     {
+        if (file->reserved && fat32_is_ready())
+        {
+            // Kept for when it is opened again, the file before gives way
+            if (reserve_hint.reserved && (reserve_hint.start_cluster != file->start_cluster ||
+                                          reserve_hint.dir_entry_sector != file->dir_entry_sector ||
+                                          reserve_hint.dir_entry_offset != file->dir_entry_offset))
+            {
+                result = trim_hint();
+            }
+            reserve_hint = *file;
+        }
+        if (!(file->attributes & FAT32_ATTR_DIRECTORY) && file->start_cluster >= 2)
+        {
+            chain_hint = *file;
+        }
         memset(file, 0, sizeof(fat32_file_t));
+        result = fat_commit(result);
     }
 
-    return FAT32_OK;
+    return result;
 }
 
 fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *bytes_read)
@@ -1423,10 +2397,7 @@ fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *
     }
 
     // Ensure current_cluster is correct for current file position
-    uint32_t cluster = 0;
-    uint32_t cluster_offset = file->position / bytes_per_cluster;
-    RETURN_ON_ERROR(seek_to_cluster(file->start_cluster, cluster_offset, &cluster));
-    file->current_cluster = cluster;
+    RETURN_ON_ERROR(file_seek_cluster(file, file->position / bytes_per_cluster, false));
 
     size_t total_read = 0;
     uint8_t *dest = (uint8_t *)buffer;
@@ -1438,16 +2409,31 @@ fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *
         uint32_t byte_in_sector = cluster_offset % FAT32_SECTOR_SIZE;
 
         uint32_t sector = cluster_to_sector(file->current_cluster) + sector_in_cluster;
+        size_t bytes_to_copy;
 
-        RETURN_ON_ERROR(read_sector(sector, sector_buffer));
-
-        size_t bytes_to_copy = FAT32_SECTOR_SIZE - byte_in_sector;
-        if (bytes_to_copy > size - total_read)
+        if (byte_in_sector == 0 && size - total_read >= FAT32_SECTOR_SIZE)
         {
-            bytes_to_copy = size - total_read;
+            // Whole sectors up to the end of the cluster go straight to the caller's buffer
+            uint32_t count = (size - total_read) / FAT32_SECTOR_SIZE;
+            if (count > boot_sector.sectors_per_cluster - sector_in_cluster)
+            {
+                count = boot_sector.sectors_per_cluster - sector_in_cluster;
+            }
+            RETURN_ON_ERROR(read_sectors(sector, count, dest + total_read));
+            bytes_to_copy = count * FAT32_SECTOR_SIZE;
         }
+        else
+        {
+            RETURN_ON_ERROR(read_sector(sector, sector_buffer));
 
-        memcpy(dest + total_read, sector_buffer + byte_in_sector, bytes_to_copy);
+            bytes_to_copy = FAT32_SECTOR_SIZE - byte_in_sector;
+            if (bytes_to_copy > size - total_read)
+            {
+                bytes_to_copy = size - total_read;
+            }
+
+            memcpy(dest + total_read, sector_buffer + byte_in_sector, bytes_to_copy);
+        }
         total_read += bytes_to_copy;
         file->position += bytes_to_copy;
 
@@ -1461,7 +2447,9 @@ fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *
                 // End of cluster chain or error
                 break;
             }
+            file->previous_cluster = file->current_cluster;
             file->current_cluster = next_cluster;
+            file->cluster_index++;
         }
     }
 
@@ -1472,7 +2460,7 @@ fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *
     return FAT32_OK;
 }
 
-fat32_error_t fat32_write(fat32_file_t *file, const void *buffer, size_t size, size_t *bytes_written)
+static fat32_error_t file_write(fat32_file_t *file, const void *buffer, size_t size, size_t *bytes_written)
 {
     if (!file || !file->is_open || !buffer)
     {
@@ -1495,108 +2483,56 @@ fat32_error_t fat32_write(fat32_file_t *file, const void *buffer, size_t size, s
     }
 
     uint32_t old_file_size = file->file_size;
-
-    // Ensure current_cluster is correct for current file position
-    uint32_t cluster = file->start_cluster;
-    uint32_t cluster_offset = file->position / bytes_per_cluster;
-    for (uint32_t i = 0; i < cluster_offset; i++)
-    {
-        uint32_t next_cluster;
-        RETURN_ON_ERROR(read_cluster_fat_entry(cluster, &next_cluster));
-        if (next_cluster >= FAT32_FAT_ENTRY_EOC)
-        {
-            // Allocate a new cluster and link it
-            uint32_t new_cluster = 0;
-            RETURN_ON_ERROR(allocate_and_link_cluster(cluster, &new_cluster));
-            next_cluster = new_cluster;
-        }
-        cluster = next_cluster;
-    }
-    file->current_cluster = cluster;
+    fat32_error_t result = FAT32_OK;
 
     size_t total_written = 0;
     const uint8_t *src = (const uint8_t *)buffer;
 
-    // Calculate how many clusters are needed for the write
-    uint32_t end_pos = file->position + size;
-    uint32_t needed_clusters = (end_pos + bytes_per_cluster - 1) / bytes_per_cluster;
-    uint32_t current_clusters = file->file_size == 0 ? 1 : (file->file_size + bytes_per_cluster - 1) / bytes_per_cluster;
-
-    // Find last cluster in chain
-    cluster = file->start_cluster;
-    uint32_t last_cluster = cluster;
-    if (current_clusters > 0)
+    size_t pos_in_file = file->position;
+    while (total_written < size)
     {
-        RETURN_ON_ERROR(find_last_cluster(cluster, current_clusters, &last_cluster));
-    }
+        // The cluster for pos_in_file, the chain grows as it goes past its end
+        result = file_seek_cluster(file, pos_in_file / bytes_per_cluster, true);
+        if (result != FAT32_OK)
+        {
+            break; // What was written is kept
+        }
 
-    // Allocate clusters if needed
-    for (uint32_t i = current_clusters; i < needed_clusters; i++)
-    {
-        uint32_t new_cluster = 0;
+        uint32_t offset_in_cluster = pos_in_file % bytes_per_cluster;
+        uint32_t sector_in_cluster = offset_in_cluster / FAT32_SECTOR_SIZE;
+        uint32_t byte_in_sector = offset_in_cluster % FAT32_SECTOR_SIZE;
+        uint32_t sector = cluster_to_sector(file->current_cluster) + sector_in_cluster;
+        size_t bytes_to_write;
 
-        if (current_clusters > 0 || i > 0)
+        if (byte_in_sector == 0 && size - total_written >= FAT32_SECTOR_SIZE)
         {
-            RETURN_ON_ERROR(allocate_and_link_cluster(last_cluster, &new_cluster));
+            // Whole sectors up to the end of the cluster are written from the caller's buffer,
+            // there is nothing in them to keep
+            uint32_t count = (size - total_written) / FAT32_SECTOR_SIZE;
+            if (count > boot_sector.sectors_per_cluster - sector_in_cluster)
+            {
+                count = boot_sector.sectors_per_cluster - sector_in_cluster;
+            }
+            RETURN_ON_ERROR(write_sectors(sector, count, src + total_written));
+            bytes_to_write = count * FAT32_SECTOR_SIZE;
         }
         else
         {
-            // First cluster for empty file
-            RETURN_ON_ERROR(get_next_free_cluster(&new_cluster));
-            RETURN_ON_ERROR(write_cluster_fat_entry(new_cluster, FAT32_FAT_ENTRY_EOC));
+            RETURN_ON_ERROR(read_sector(sector, sector_buffer));
 
-            if (fsinfo.free_count != 0xFFFFFFFF)
+            bytes_to_write = FAT32_SECTOR_SIZE - byte_in_sector;
+            if (bytes_to_write > size - total_written)
             {
-                fsinfo.free_count--;
-                update_fsinfo();
+                bytes_to_write = size - total_written;
             }
 
-            file->start_cluster = new_cluster;
-        }
-        last_cluster = new_cluster;
-    }
-
-    // Find cluster for file->position
-    cluster = 0;
-    cluster_offset = file->position / bytes_per_cluster;
-    RETURN_ON_ERROR(seek_to_cluster(file->start_cluster, cluster_offset, &cluster));
-    file->current_cluster = cluster;
-
-    size_t pos_in_file = file->position;
-    while (total_written < size)
-    {
-        uint32_t offset_in_cluster = pos_in_file % bytes_per_cluster;
-        uint32_t sector_in_cluster = offset_in_cluster / FAT32_SECTOR_SIZE;
-        uint32_t byte_in_sector = offset_in_cluster % FAT32_SECTOR_SIZE;
-        uint32_t sector = cluster_to_sector(cluster) + sector_in_cluster;
-
-        RETURN_ON_ERROR(read_sector(sector, sector_buffer));
+            memcpy(sector_buffer + byte_in_sector, src + total_written, bytes_to_write);
 
-        size_t bytes_to_write = FAT32_SECTOR_SIZE - byte_in_sector;
-        if (bytes_to_write > size - total_written)
-        {
-            bytes_to_write = size - total_written;
+            RETURN_ON_ERROR(write_sector(sector, sector_buffer));
         }
 
-        memcpy(sector_buffer + byte_in_sector, src + total_written, bytes_to_write);
-
-        RETURN_ON_ERROR(write_sector(sector, sector_buffer));
-
         total_written += bytes_to_write;
         pos_in_file += bytes_to_write;
-
-        // Move to next cluster if needed
-        if ((pos_in_file % bytes_per_cluster) == 0 && total_written < size)
-        {
-            uint32_t next_cluster;
-            fat32_error_t fat_res = read_cluster_fat_entry(cluster, &next_cluster);
-            if (fat_res != FAT32_OK || next_cluster >= FAT32_FAT_ENTRY_EOC)
-            {
-                return FAT32_ERROR_DISK_FULL;
-            }
-            cluster = next_cluster;
-            file->current_cluster = cluster;
-        }
     }
 
     file->position = pos_in_file;
@@ -1645,19 +2581,26 @@ fat32_error_t fat32_write(fat32_file_t *file, const void *buffer, size_t size, s
         }
     }
 
-    // Update directory entry file size on disk
-    // After updating file->file_size:
+    // Update directory entry file size on disk, once the FAT is
     if (file->dir_entry_sector && file->dir_entry_offset < FAT32_SECTOR_SIZE)
     {
+        RETURN_ON_ERROR(fat_flush());
         RETURN_ON_ERROR(read_sector(file->dir_entry_sector, sector_buffer));
 
         fat32_dir_entry_t *dir_entry = (fat32_dir_entry_t *)(sector_buffer + file->dir_entry_offset);
         dir_entry->file_size = file->file_size;
+        dir_entry->fst_clus_hi = file->start_cluster >> 16; // The first cluster of an empty file is new
+        dir_entry->fst_clus_lo = file->start_cluster & 0xFFFF;
 
         RETURN_ON_ERROR(write_sector(file->dir_entry_sector, sector_buffer));
     }
 
-    return FAT32_OK;
+    return result;
+}
+
+fat32_error_t fat32_write(fat32_file_t *file, const void *buffer, size_t size, size_t *bytes_written)
+{
+    return fat_commit(file_write(file, buffer, size, bytes_written));
 }
 
 fat32_error_t fat32_seek(fat32_file_t *file, uint32_t position)
@@ -1672,6 +2615,86 @@ fat32_error_t fat32_seek(fat32_file_t *file, uint32_t position)
     return FAT32_OK;
 }
 
+static fat32_error_t file_truncate(fat32_file_t *file, uint32_t size)
+{
+    if (!file || !file->is_open)
+    {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (file->attributes & FAT32_ATTR_DIRECTORY)
+    {
+        return FAT32_ERROR_NOT_A_FILE; // Cannot truncate a directory
+    }
+
+    if (!fat32_is_ready())
+    {
+        return mount_status;
+    }
+
+    if (size >= file->file_size)
+    {
+        return FAT32_OK; // Nothing to cut
+    }
+
+    // The first cluster is kept even for an empty file, as fat32_create does
+    uint32_t needed_clusters = (size == 0) ? 1 : (size + bytes_per_cluster - 1) / bytes_per_cluster;
+    uint32_t current_clusters = (file->file_size + bytes_per_cluster - 1) / bytes_per_cluster;
+
+    if (needed_clusters < current_clusters && file->start_cluster >= 2)
+    {
+        uint32_t first_cluster_to_free;
+        RETURN_ON_ERROR(file_seek_cluster(file, needed_clusters - 1, false));
+        uint32_t last_cluster_to_keep = file->current_cluster;
+        RETURN_ON_ERROR(read_cluster_fat_entry(last_cluster_to_keep, &first_cluster_to_free));
+        RETURN_ON_ERROR(write_cluster_fat_entry(last_cluster_to_keep, FAT32_FAT_ENTRY_EOC));
+        if (first_cluster_to_free >= 2 && first_cluster_to_free < FAT32_FAT_ENTRY_EOC)
+        {
+            RETURN_ON_ERROR(release_cluster_chain(first_cluster_to_free));
+        }
+        file->releases = release_count;
+        file->reserved = false;
+        file_chain_end(file, last_cluster_to_keep, needed_clusters);
+    }
+
+    file->file_size = size;
+    if (file->position > size)
+    {
+        file->position = size;
+    }
+    file->current_cluster = file->start_cluster;
+    file->cluster_index = 0;
+    file->previous_cluster = 0;
+
+    if (file->dir_entry_sector && file->dir_entry_offset < FAT32_SECTOR_SIZE)
+    {
+        RETURN_ON_ERROR(fat_flush());
+        RETURN_ON_ERROR(read_sector(file->dir_entry_sector, sector_buffer));
+
+        fat32_dir_entry_t *dir_entry = (fat32_dir_entry_t *)(sector_buffer + file->dir_entry_offset);
+        dir_entry->file_size = file->file_size;
+
+        RETURN_ON_ERROR(write_sector(file->dir_entry_sector, sector_buffer));
+    }
+
+    return FAT32_OK;
+}
+
+fat32_error_t fat32_truncate(fat32_file_t *file, uint32_t size)
+{
+    return fat_commit(file_truncate(file, size));
+}
+
+// Tells that file is going to be written up to size bytes, so that its chain
+// grows in one run of clusters rather than a few at a time
+void fat32_reserve(fat32_file_t *file, uint32_t size)
+{
+    if (file && file->is_open)
+    {
+        file->size_hint = size;
+    }
+}
+
 inline uint32_t fat32_tell(fat32_file_t *file)
 {
     return file ? file->position : 0;
@@ -1697,7 +2720,22 @@ fat32_error_t fat32_delete(const char *path)
     {
         return mount_status;
     }
-    return delete_entry(path);
+    RETURN_ON_ERROR(fat_commit(trim_hint())); // Its chain may be the one going
+    return fat_commit(delete_entry(path));
+}
+
+fat32_error_t fat32_delete_entries(const fat32_unlink_t *entries, uint32_t count)
+{
+    if (!entries && count)
+    {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    if (!fat32_is_ready())
+    {
+        return mount_status;
+    }
+    RETURN_ON_ERROR(fat_commit(trim_hint())); // Likewise
+    return fat_commit(delete_entries(entries, count));
 }
 
 fat32_error_t fat32_rename(const char *old_path, const char *new_path)
@@ -1711,6 +2749,9 @@ fat32_error_t fat32_rename(const char *old_path, const char *new_path)
         return mount_status;
     }
 
+    // The reservation is found by the directory entry, which moves
+    RETURN_ON_ERROR(fat_commit(trim_hint()));
+
     // Find the old entry
     fat32_entry_t entry;
     RETURN_ON_ERROR(find_entry(&entry, old_path));
@@ -1729,9 +2770,7 @@ fat32_error_t fat32_rename(const char *old_path, const char *new_path)
 
     // Rename by deleting the old entry and creating a new one with the same start cluster
     RETURN_ON_ERROR(unlink_entry(&entry));
-    RETURN_ON_ERROR(link_entry(&entry, new_path));
-
-    return FAT32_OK;
+    return fat_commit(link_entry(&entry, new_path));
 }
 
 //
@@ -1927,6 +2966,11 @@ fat32_error_t fat32_dir_read(fat32_file_t *dir, fat32_entry_t *dir_entry)
             // End of directory
             dir->last_entry_read = true; // Mark that we reached the end
         }
+        else if (entry->shortname[0] == FAT32_DIR_ENTRY_FREE)
+        {
+            // Deleted entry, long name parts included (their sequence number is overwritten)
+            filename[0] = '\0';
+        }
         else if (entry->attr == FAT32_ATTR_LONG_NAME)
         {
             // Populate long filename buffer with this entry's name contents
@@ -1946,7 +2990,7 @@ fat32_error_t fat32_dir_read(fat32_file_t *dir, fat32_entry_t *dir_entry)
                 lfn_to_str(lfn_entry, filename + offset);
             }
         }
-        else if (entry->shortname[0] != FAT32_DIR_ENTRY_FREE)
+        else
         {
             uint8_t checksum = shortname_checksum(entry->shortname);
             // Now check to see if this is the entry we are looking for
@@ -1956,7 +3000,7 @@ fat32_error_t fat32_dir_read(fat32_file_t *dir, fat32_entry_t *dir_entry)
             }
             else
             {
-                shortname_to_filename(entry->shortname, dir_entry->filename);
+                shortname_to_filename(entry->shortname, entry->nt_res, dir_entry->filename);
             }
             dir_entry->attr = entry->attr;
             dir_entry->start_cluster = (entry->fst_clus_hi << 16) | entry->fst_clus_lo;
@@ -1996,7 +3040,7 @@ fat32_error_t fat32_dir_create(fat32_file_t *dir, const char *path)
     fat32_error_t result = new_entry(&file, path, FAT32_ATTR_DIRECTORY);
     if (result != FAT32_OK)
     {
-        return result; // Error creating directory
+        return fat_commit(result); // Error creating directory
     }
 
     // Initialize directory struct
@@ -2070,7 +3114,7 @@ fat32_error_t fat32_dir_create(fat32_file_t *dir, const char *path)
 
     RETURN_ON_ERROR(write_sector(cluster_to_sector(dir->start_cluster), sector_buffer));
 
-    return FAT32_OK;
+    return fat_commit(FAT32_OK);
 }
 
 const char *fat32_error_string(fat32_error_t error)
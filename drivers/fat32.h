@@ -1,10 +1,18 @@
 #pragma once
 
+#include <stdio.h>
+
 // FAT32 constants
 #define FAT32_SECTOR_SIZE (SD_BLOCK_SIZE) // Standard sector size
 #define FAT32_MAX_FILENAME_LEN (255)
 #define FAT32_MAX_PATH_LEN (260)
 #define MAX_LFN_PART (20) // Maximum number of LFN parts (13 UTF-16 chars each)
+#ifndef FAT32_RESERVE_MAX
+#define FAT32_RESERVE_MAX (64 * 1024) // Largest run of clusters a growing file gets without a size hint, in bytes
+#endif
+#ifndef FAT32_FAT_BUFFERS
+#define FAT32_FAT_BUFFERS (4) // FAT sectors kept in RAM, changes to them are written together (in order while one change fits)
+#endif
 
 // File attributes
 #define FAT32_ATTR_READ_ONLY (0x01)
@@ -24,6 +32,8 @@
 #define FAT32_DIR_ENTRY_FREE (0xE5)       // Free entry marker
 #define FAT32_DIR_ENTRY_END_MARKER (0x00) // End of directory entry marker
 #define FAT32_DIR_LFN_PART_SIZE (13)      // Size of each LFN part in bytes
+#define FAT32_NT_LOWER_BASE (0x08)        // nt_res: the name of an 8.3 entry is lower case
+#define FAT32_NT_LOWER_EXT (0x10)         // nt_res: the extension of an 8.3 entry is lower case
 
 // Error codes
 typedef enum
@@ -63,6 +73,15 @@ typedef struct
     uint32_t position;
     uint32_t dir_entry_sector; // Sector containing the directory entry
     uint32_t dir_entry_offset; // Byte offset within the sector
+    uint32_t cluster_index;    // Of current_cluster in the chain of a file
+    uint32_t previous_cluster; // Before current_cluster, 0 if not known
+    uint32_t last_cluster;     // Of the chain of a file, 0 until known
+    uint32_t cluster_total;    // In the chain of a file, when last_cluster is known
+    uint32_t releases;         // Chains freed when the three above were found, stale after another
+    uint32_t size_hint;        // Size the file is expected to reach, see fat32_reserve
+    uint32_t run_clusters;     // The chain grows by so many clusters next, twice as many each time
+    uint32_t run_first;        // The chain goes from it to last_cluster in a row, 0 if not known
+    bool reserved;             // The chain has clusters past the end of the file, see fat32_sync
 } fat32_file_t;
 
 // Directory entry structure
@@ -165,16 +184,40 @@ typedef struct
     uint16_t name3[2];   // Last 2 characters (UTF-16)
 } __attribute__((packed)) fat32_lfn_entry_t;
 
+// A file found by fat32_dir_read, to delete with fat32_delete_entries
+typedef struct
+{
+    uint32_t sector;        // Of its 8.3 entry
+    uint32_t offset;        // Of its 8.3 entry in the sector
+    uint32_t start_cluster; // 0 for an empty file
+} fat32_unlink_t;
+
+// Sector access log record (see fat32_io_capture)
+typedef struct
+{
+    uint32_t time_us;   // since the capture started
+    uint32_t sector;    // volume relative
+    const char *caller; // fat32.c function that accessed the sector
+    char op;            // 'R' or 'W'
+} fat32_io_record_t;
+
 // File system functions
 bool fat32_is_ready(void);
 fat32_error_t fat32_mount(void);
 void fat32_unmount(void);
 bool fat32_is_mounted(void);
+uint32_t fat32_mount_count(void);
+uint32_t fat32_dir_generation(void);
 fat32_error_t fat32_get_status(void);
 fat32_error_t fat32_get_free_space(uint64_t *free_space);
 fat32_error_t fat32_get_total_space(uint64_t *total_space);
 fat32_error_t fat32_get_volume_name(char *name, size_t name_len);
 uint32_t fat32_get_cluster_size(void);
+void fat32_get_io_stats(uint32_t *reads, uint32_t *writes);
+void fat32_get_fat_stats(uint32_t *hits, uint32_t *misses);
+void fat32_io_capture(fat32_io_record_t *records, uint32_t capacity);
+uint32_t fat32_io_captured(uint32_t *dropped);
+void fat32_io_write_log(FILE *file);
 
 // File operations
 fat32_error_t fat32_open(fat32_file_t *file, const char *path);
@@ -183,10 +226,14 @@ fat32_error_t fat32_close(fat32_file_t *file);
 fat32_error_t fat32_read(fat32_file_t *file, void *buffer, size_t size, size_t *bytes_read);
 fat32_error_t fat32_write(fat32_file_t *file, const void *buffer, size_t size, size_t *bytes_written);
 fat32_error_t fat32_seek(fat32_file_t *file, uint32_t position);
+fat32_error_t fat32_truncate(fat32_file_t *file, uint32_t size);
+void fat32_reserve(fat32_file_t *file, uint32_t size);
+fat32_error_t fat32_sync(void);
 uint32_t fat32_tell(fat32_file_t *file);
 uint32_t fat32_size(fat32_file_t *file);
 bool fat32_eof(fat32_file_t *file);
 fat32_error_t fat32_delete(const char *path);
+fat32_error_t fat32_delete_entries(const fat32_unlink_t *entries, uint32_t count);
 fat32_error_t fat32_rename(const char *old_path, const char *new_path);
 
 // Directory operations
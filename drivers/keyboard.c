@@ -20,9 +20,11 @@
 #include "keyboard.h"
 #include "display.h"
 #include "southbridge.h"
+#include "trace.h"
 
 extern volatile bool user_interrupt;
 extern volatile bool user_freeze;
+extern volatile bool user_hibernate;
 
 keyboard_key_available_callback_t keyboard_key_available_callback = NULL;
 
@@ -38,6 +40,10 @@ static volatile uint16_t rx_head = 0;
 static volatile uint16_t rx_tail = 0;
 static repeating_timer_t key_timer;
 
+// The battery is read by the timer too, so that nothing waits on the I2C bus for it
+static volatile int16_t battery_level = -1;  // last level read, -1 until the first read
+static uint16_t battery_countdown = 0;       // timer ticks to the next read
+
 //
 //  Keyboard Driver
 //
@@ -48,6 +54,7 @@ static repeating_timer_t key_timer;
 
 void keyboard_poll()
 {
+    uint32_t start = trace_begin();
     uint16_t key = sb_read_keyboard();
     uint8_t key_state = (key >> 8) & 0xFF;
     uint8_t key_code = key & 0xFF;
@@ -78,6 +85,7 @@ void keyboard_poll()
             }
 	    else if (key_code == 0x85) user_freeze = true ; 
 	    else if (key_code == 0x84) user_freeze = false ;
+	    else if (key_code == KEY_F10) user_hibernate = true ; // saved at the next BDOS call or key wait
             else
             {
                 // If a key is released, we return the key code
@@ -125,6 +133,7 @@ void keyboard_poll()
             }
         }
     }
+    trace_end(TRACE_KEYBOARD, 0, start);
 }
 
 static bool on_keyboard_timer(repeating_timer_t *rt)
@@ -136,6 +145,13 @@ static bool on_keyboard_timer(repeating_timer_t *rt)
 
     keyboard_poll();
 
+    if (battery_countdown == 0)
+    {
+        battery_level = sb_read_battery();
+        battery_countdown = KEYBOARD_BATTERY_MS / KEYBOARD_POLL_MS;
+    }
+    battery_countdown--;
+
     return true; // continue the timer
 }
 
@@ -162,6 +178,12 @@ char keyboard_get_key()
 }
 
 
+// Battery level and charging flag (0x80) from the last background read, -1 before the first one
+int16_t keyboard_battery_level()
+{
+    return battery_level;
+}
+
 //
 // Keyboard Callback Setters
 //
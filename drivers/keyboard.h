@@ -50,8 +50,11 @@
 #define KEY_POWER           (0x91)
 
 // Keyboard defaults
-#define KBD_BUFFER_SIZE     (32)
+#ifndef KBD_BUFFER_SIZE
+#define KBD_BUFFER_SIZE     (32)  // a power of 2
+#endif
 #define KEYBOARD_POLL_MS    (100) // poll keyboard every 100 ms
+#define KEYBOARD_BATTERY_MS (30000) // read the battery level every 30 s
 
 
 // Callback function type for when a key becomes available
@@ -64,3 +67,4 @@ void keyboard_set_background_poll(bool enable);
 void keyboard_poll(void);
 bool keyboard_key_available(void);
 char keyboard_get_key(void);
+int16_t keyboard_battery_level(void);
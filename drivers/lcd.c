@@ -19,6 +19,7 @@
 #include "hardware/spi.h"
 
 #include "lcd.h"
+#include "trace.h"
 
 static bool lcd_initialised = false; // flag to indicate if the LCD is initialised
 
@@ -39,8 +40,14 @@ const font_t *font = &font_8x10; // default font is 8x10
 static uint16_t char_buffer[8 * GLYPH_HEIGHT] __attribute__((aligned(4)));
 static uint16_t line_buffer[WIDTH * GLYPH_HEIGHT] __attribute__((aligned(4)));
 
+// Text shadow, the characters on the screen by row and column, so that the
+// screen can be saved and drawn again (lcd_get_text). Colours and attributes
+// are not kept.
+static uint8_t text_shadow[ROWS][TEXT_COLUMNS];
+
 // Background processing
 static uint32_t irq_state;
+static uint64_t bytes_sent = 0; // bytes sent over the LCD SPI bus
 static repeating_timer_t cursor_timer;
 
 static void lcd_disable_interrupts()
@@ -138,6 +145,7 @@ void lcd_write_cmd(uint8_t cmd)
     gpio_put(LCD_CSX, 0);
     spi_write_blocking(LCD_SPI, &cmd, 1);
     gpio_put(LCD_CSX, 1);
+    bytes_sent++;
 }
 
 // Send 8-bit data (byte)
@@ -154,6 +162,7 @@ void lcd_write_data(uint8_t len, ...)
     }
     gpio_put(LCD_CSX, 1);
     va_end(args);
+    bytes_sent += len;
 }
 
 // Send 16-bit data (half-word)
@@ -176,6 +185,7 @@ void lcd_write16_data(uint8_t len, ...)
     }
     gpio_put(LCD_CSX, 1);
     va_end(args);
+    bytes_sent += 2 * len;
 
     spi_set_format(LCD_SPI, 8, 0, 0, SPI_MSB_FIRST);
 }
@@ -191,10 +201,17 @@ void lcd_write16_buf(const uint16_t *buffer, size_t len)
     gpio_put(LCD_CSX, 0);
     spi_write16_blocking(LCD_SPI, buffer, len);
     gpio_put(LCD_CSX, 1);
+    bytes_sent += 2 * len;
 
     spi_set_format(LCD_SPI, 8, 0, 0, SPI_MSB_FIRST);
 }
 
+// Bytes sent to the LCD since power up, for benchmarking
+uint64_t lcd_get_bytes_sent(void)
+{
+    return bytes_sent;
+}
+
 //
 //  ST7365P LCD controller functions
 //
@@ -232,6 +249,8 @@ static void lcd_set_window(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 
 void lcd_blit(const uint16_t *pixels, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
 {
+    uint32_t start = trace_begin();
+
     lcd_disable_interrupts();
     if (y >= lcd_scroll_top && y < HEIGHT - lcd_scroll_bottom)
     {
@@ -252,6 +271,7 @@ void lcd_blit(const uint16_t *pixels, uint16_t x, uint16_t y, uint16_t width, ui
 
     lcd_write16_buf((uint16_t *)pixels, width * height);
     lcd_enable_interrupts();
+    trace_end(TRACE_LCD_BLIT, width * height, start);
 }
 
 // Draw a solid rectangle on the display
@@ -327,6 +347,7 @@ void lcd_scroll_clear()
 
     // Clear the scrolling area
     lcd_solid_rectangle(background, 0, lcd_scroll_top, WIDTH, lcd_memory_scroll_height);
+    memset(text_shadow[lcd_scroll_top / GLYPH_HEIGHT], ' ', (ROWS - lcd_scroll_top / GLYPH_HEIGHT) * TEXT_COLUMNS);
 }
 
 // Scroll the screen up one line (make space at the bottom)
@@ -347,6 +368,10 @@ void lcd_scroll_up()
 
     // Clear the new line at the bottom
     lcd_solid_rectangle(background, 0, HEIGHT - GLYPH_HEIGHT, WIDTH, GLYPH_HEIGHT);
+
+    uint8_t top_row = lcd_scroll_top / GLYPH_HEIGHT;
+    memmove(text_shadow[top_row], text_shadow[top_row + 1], (MAX_ROW - top_row) * TEXT_COLUMNS);
+    memset(text_shadow[MAX_ROW], ' ', TEXT_COLUMNS);
 }
 
 // Scroll the screen down one line (making space at the top)
@@ -367,6 +392,10 @@ void lcd_scroll_down()
 
     // Clear the new line at the top
     lcd_solid_rectangle(background, 0, lcd_scroll_top, WIDTH, GLYPH_HEIGHT);
+
+    uint8_t top_row = lcd_scroll_top / GLYPH_HEIGHT;
+    memmove(text_shadow[top_row + 1], text_shadow[top_row], (MAX_ROW - top_row) * TEXT_COLUMNS);
+    memset(text_shadow[top_row], ' ', TEXT_COLUMNS);
 }
 
 //
@@ -378,11 +407,16 @@ void lcd_clear_screen()
 {
     lcd_scroll_reset(); // Reset the scrolling area to the top
     lcd_solid_rectangle(background, 0, 0, WIDTH, FRAME_HEIGHT);
+    memset(text_shadow, ' ', sizeof(text_shadow));
 }
 
 void lcd_erase_line(uint8_t row, uint8_t col_start, uint8_t col_end)
 {
     lcd_solid_rectangle(background, col_start * font->width, row * GLYPH_HEIGHT, (col_end - col_start + 1) * font->width, GLYPH_HEIGHT);
+    if (row < ROWS && col_start <= col_end && col_end < TEXT_COLUMNS)
+    {
+        memset(&text_shadow[row][col_start], ' ', col_end - col_start + 1);
+    }
 }
 
 // Draw a character at the specified position
@@ -391,6 +425,11 @@ void lcd_putc(uint8_t column, uint8_t row, uint8_t c)
     const uint8_t *glyph = &font->glyphs[c * GLYPH_HEIGHT];
     uint16_t *buffer = char_buffer;
 
+    if (row < ROWS && column < TEXT_COLUMNS)
+    {
+        text_shadow[row][column] = c;
+    }
+
     if (font->width == 8)
     {
         for (uint8_t i = 0; i < GLYPH_HEIGHT; i++, glyph++)
@@ -476,6 +515,11 @@ void lcd_putstr(uint8_t column, uint8_t row, const char *str)
 {
     int len = strlen(str);
     int pos = 0;
+
+    if (row < ROWS && column < TEXT_COLUMNS)
+    {
+        memcpy(&text_shadow[row][column], str, MIN(len, TEXT_COLUMNS - column));
+    }
     while (*str)
     {
         uint16_t *buffer = line_buffer + (pos++ * font->width);
@@ -545,6 +589,31 @@ void lcd_putstr(uint8_t column, uint8_t row, const char *str)
     }
 }
 
+// The characters on the screen, ROWS rows of TEXT_COLUMNS
+const uint8_t *lcd_get_text(void)
+{
+    return &text_shadow[0][0];
+}
+
+// Clear the screen and draw the characters saved by lcd_get_text, in the current colours and font
+void lcd_restore_text(const uint8_t *text)
+{
+    uint8_t columns = lcd_get_columns();
+
+    lcd_clear_screen();
+    for (uint8_t row = 0; row < ROWS; row++)
+    {
+        for (uint8_t column = 0; column < columns; column++)
+        {
+            uint8_t c = text[row * TEXT_COLUMNS + column];
+            if (c != ' ')
+            {
+                lcd_putc(column, row, c);
+            }
+        }
+    }
+}
+
 
 //
 // The cursor
@@ -64,6 +64,7 @@
 #define FRAME_HEIGHT    (480)           // frame memory height in pixels
 #define ROWS            (HEIGHT/GLYPH_HEIGHT) // number of lines that fit on the LCD
 #define MAX_ROW         (ROWS - 1)      // maximum row index (0-based)
+#define TEXT_COLUMNS    (WIDTH/4)       // columns in the narrowest font
 
 // Handy macros
 #define RGB(r,g,b)      ((uint16_t)(((r) >> 3) << 11 | ((g) >> 2) << 5 | ((b) >> 3)))
@@ -92,6 +93,7 @@ void lcd_write_cmd(uint8_t cmd);
 void lcd_write_data(uint8_t len, ...);
 void lcd_write16_data(uint8_t len, ...);
 void lcd_write16_buf(const uint16_t *buffer, size_t len);
+uint64_t lcd_get_bytes_sent(void);
 
 // Display window and drawing functions
 void lcd_blit(const uint16_t *pixels, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
@@ -107,6 +109,8 @@ void lcd_scroll_down(void);
 // Character and cursor functions
 void lcd_putc(uint8_t column, uint8_t row, uint8_t c);
 void lcd_putstr(uint8_t column, uint8_t row, const char *str);
+const uint8_t *lcd_get_text(void);
+void lcd_restore_text(const uint8_t *text);
 void lcd_move_cursor(uint8_t x, uint8_t y);
 void lcd_draw_cursor(void);
 void lcd_erase_cursor(void);
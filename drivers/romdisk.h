@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// The flash drive: .COM files packed into the firmware at build time by
+// tools/romdisk.py (see romdisk.cmake). The data is const, so it stays
+// in XIP flash and is read in place
+
+typedef struct {
+    char name[13];          // Host name, NAME.EXT
+    uint32_t offset;        // Of the file in romdisk_data
+    uint32_t size;          // In bytes
+} romdisk_file_t;
+
+extern const romdisk_file_t romdisk_files[]; // Sorted by name
+extern const uint16_t romdisk_count;
+extern const uint8_t romdisk_data[];
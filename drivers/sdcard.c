@@ -18,6 +18,7 @@
 #include "hardware/spi.h"
 
 #include "sdcard.h"
+#include "trace.h"
 
 // Global state
 static bool sd_initialised = false;
@@ -135,7 +136,7 @@ bool sd_is_sdhc(void)
 // Block-level read/write operations
 //
 
-sd_error_t sd_read_block(uint32_t block, uint8_t *buffer)
+static sd_error_t sd_read_block_spi(uint32_t block, uint8_t *buffer)
 {
     int32_t addr = is_sdhc ? block : block * SD_BLOCK_SIZE;
     uint8_t response = sd_send_command(SD_CMD17, addr);
@@ -170,7 +171,7 @@ sd_error_t sd_read_block(uint32_t block, uint8_t *buffer)
     return SD_OK;
 }
 
-sd_error_t sd_write_block(uint32_t block, const uint8_t *buffer)
+static sd_error_t sd_write_block_spi(uint32_t block, const uint8_t *buffer)
 {
     uint32_t addr = is_sdhc ? block : block * SD_BLOCK_SIZE;
     uint8_t response = sd_send_command(SD_CMD24, addr);
@@ -207,30 +208,147 @@ sd_error_t sd_write_block(uint32_t block, const uint8_t *buffer)
     return SD_OK;
 }
 
-sd_error_t sd_read_blocks(uint32_t start_block, uint32_t num_blocks, uint8_t *buffer)
+sd_error_t sd_read_block(uint32_t block, uint8_t *buffer)
 {
-    for (uint32_t i = 0; i < num_blocks; i++)
+    uint32_t start = trace_begin();
+    sd_error_t result = sd_read_block_spi(block, buffer);
+
+    trace_end(TRACE_SD_READ, block, start);
+    return result;
+}
+
+sd_error_t sd_write_block(uint32_t block, const uint8_t *buffer)
+{
+    uint32_t start = trace_begin();
+    sd_error_t result = sd_write_block_spi(block, buffer);
+
+    trace_end(TRACE_SD_WRITE, block, start);
+    return result;
+}
+
+// Multiple block transfers send one command for the run of blocks (CMD18 and
+// CMD25), which saves the command overhead and the card's per-command access
+// time on every block but the first.
+
+static sd_error_t sd_read_blocks_spi(uint32_t start_block, uint32_t num_blocks, uint8_t *buffer)
+{
+    uint32_t addr = is_sdhc ? start_block : start_block * SD_BLOCK_SIZE;
+    sd_error_t result = SD_OK;
+    uint8_t response = sd_send_command(SD_CMD18, addr);
+    if (response != 0)
+    {
+        sd_cs_deselect();
+        return SD_ERROR_READ_FAILED;
+    }
+
+    for (uint32_t i = 0; i < num_blocks && result == SD_OK; i++)
     {
-        sd_error_t result = sd_read_block(start_block + i, buffer + (i * SD_BLOCK_SIZE));
-        if (result != SD_OK)
+        // Wait for the data token of the next block
+        uint32_t timeout = 100000;
+        do
+        {
+            response = sd_spi_write_read(0xFF);
+            timeout--;
+        } while (response != SD_DATA_START_BLOCK && timeout > 0);
+
+        if (timeout == 0)
         {
-            return result;
+            result = SD_ERROR_READ_FAILED;
+            break;
         }
+
+        sd_spi_read_buf(buffer + (i * SD_BLOCK_SIZE), SD_BLOCK_SIZE);
+
+        // Read CRC (ignore it)
+        sd_spi_write_read(0xFF);
+        sd_spi_write_read(0xFF);
     }
-    return SD_OK;
+
+    // Stop the transmission, CS is still low. The byte after CMD12 is a stuff byte,
+    // then comes the R1 response and the card is busy for a while.
+    uint8_t packet[6] = {0x40 | SD_CMD12, 0, 0, 0, 0, 0xFF};
+    sd_spi_write_buf(packet, 6);
+    sd_spi_write_read(0xFF);
+    for (uint8_t retry = 0; retry < 64 && (sd_spi_write_read(0xFF) & 0x80); retry++)
+        ;
+    sd_wait_ready();
+    sd_cs_deselect();
+
+    return result;
 }
 
-sd_error_t sd_write_blocks(uint32_t start_block, uint32_t num_blocks, const uint8_t *buffer)
+static sd_error_t sd_write_blocks_spi(uint32_t start_block, uint32_t num_blocks, const uint8_t *buffer)
 {
+    uint32_t addr = is_sdhc ? start_block : start_block * SD_BLOCK_SIZE;
+    sd_error_t result = SD_OK;
+    uint8_t response = sd_send_command(SD_CMD25, addr);
+    if (response != 0)
+    {
+        sd_cs_deselect();
+        return SD_ERROR_WRITE_FAILED;
+    }
+
     for (uint32_t i = 0; i < num_blocks; i++)
     {
-        sd_error_t result = sd_write_block(start_block + i, buffer + (i * SD_BLOCK_SIZE));
-        if (result != SD_OK)
+        // Send data token
+        sd_spi_write_read(SD_DATA_START_BLOCK_MULT);
+
+        // Send data
+        sd_spi_write_buf(buffer + (i * SD_BLOCK_SIZE), SD_BLOCK_SIZE);
+
+        // Send dummy CRC
+        sd_spi_write_read(0xFF);
+        sd_spi_write_read(0xFF);
+
+        // Check data response, then wait for programming to finish
+        response = sd_spi_write_read(0xFF) & 0x1F;
+        if (response != 0x05 || !sd_wait_ready())
         {
-            return result;
+            result = SD_ERROR_WRITE_FAILED;
+            break;
         }
     }
-    return SD_OK;
+
+    // Stop token, the card is busy until the last block is written
+    sd_spi_write_read(SD_DATA_STOP_MULT);
+    sd_spi_write_read(0xFF);
+    if (!sd_wait_ready())
+    {
+        result = SD_ERROR_WRITE_FAILED;
+    }
+    sd_cs_deselect();
+
+    return result;
+}
+
+sd_error_t sd_read_blocks(uint32_t start_block, uint32_t num_blocks, uint8_t *buffer)
+{
+    uint32_t start;
+    sd_error_t result;
+
+    if (num_blocks == 1)
+    {
+        return sd_read_block(start_block, buffer);
+    }
+    start = trace_begin();
+    result = sd_read_blocks_spi(start_block, num_blocks, buffer);
+    trace_end(TRACE_SD_READ, start_block, start);
+    return result;
+}
+
+sd_error_t sd_write_blocks(uint32_t start_block, uint32_t num_blocks, const uint8_t *buffer)
+{
+    uint32_t start;
+    sd_error_t result;
+
+    if (num_blocks == 1)
+    {
+        return sd_write_block(start_block, buffer);
+    }
+    start = trace_begin();
+    result = sd_write_blocks_spi(start_block, num_blocks, buffer);
+    trace_end(TRACE_SD_WRITE, start_block, start);
+    return result;
 }
 
 //
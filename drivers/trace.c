@@ -0,0 +1,193 @@
+//
+//  Timeline trace recorder
+//
+//  Spans of the emulator (BDOS and BIOS calls) and of the drivers (FAT32
+//  sectors, SD blocks, LCD blits, terminal output and keyboard polls) are
+//  kept in a ring buffer of TRACE_CAPACITY events, and written out in the
+//  Chrome trace-event format, which Perfetto (ui.perfetto.dev) and
+//  chrome://tracing open. Each subsystem gets a track of its own.
+//
+//  Spans are recorded from the main loop and from timer callbacks. The
+//  RP2040 has no atomic read-modify-write, so a slot is claimed with
+//  interrupts masked for the few instructions it takes to fill it in.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+
+#include "trace.h"
+
+#ifdef RUNCPM_TRACE
+
+typedef struct
+{
+    uint32_t start;     // time_us_32() at the start of the span
+    uint32_t duration;  // in microseconds
+    uint32_t arg;
+    uint8_t event;      // trace_event_t
+} trace_record_t;
+
+volatile bool trace_recording = false;
+
+static trace_record_t ring[TRACE_CAPACITY];
+static uint32_t ring_next = 0;      // slot written next
+static uint32_t ring_count = 0;     // slots in use
+static int32_t last_display = -1;   // slot of the display burst being extended
+
+static const char *event_names[TRACE_EVENT_TYPES] = {
+    "BDOS", "BIOS", "read_sector", "write_sector", "sd_read_block", "sd_write_block",
+    "lcd_blit", "display_emit", "keyboard_poll"};
+
+static const char *event_args[TRACE_EVENT_TYPES] = {
+    "function", "function", "sector", "sector", "block", "block", "pixels", "chars", NULL};
+
+void trace_end(trace_event_t event, uint32_t arg, uint32_t start)
+{
+    uint32_t now;
+    uint32_t irq_state;
+    trace_record_t *record;
+
+    if (!start)
+    {
+        return; // the span started while not recording
+    }
+    now = time_us_32();
+
+    irq_state = save_and_disable_interrupts();
+    if (event == TRACE_DISPLAY && last_display >= 0)
+    {
+        // Characters output back to back are one burst
+        record = &ring[last_display];
+        if (start - (record->start + record->duration) < TRACE_BURST_GAP_US)
+        {
+            record->duration = now - record->start;
+            record->arg += arg;
+            restore_interrupts(irq_state);
+            return;
+        }
+    }
+    record = &ring[ring_next];
+    if (last_display == (int32_t)ring_next)
+    {
+        last_display = -1; // the burst being extended is overwritten
+    }
+    if (event == TRACE_DISPLAY)
+    {
+        last_display = ring_next;
+    }
+    ring_next = (ring_next + 1) % TRACE_CAPACITY;
+    if (ring_count < TRACE_CAPACITY)
+    {
+        ring_count++;
+    }
+    record->start = start;
+    record->duration = now - start;
+    record->arg = arg;
+    record->event = event;
+    restore_interrupts(irq_state);
+}
+
+void trace_start(void)
+{
+    trace_recording = true;
+}
+
+void trace_stop(void)
+{
+    trace_recording = false;
+}
+
+void trace_clear(void)
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+    ring_next = 0;
+    ring_count = 0;
+    last_display = -1;
+    restore_interrupts(irq_state);
+}
+
+uint32_t trace_count(void)
+{
+    return ring_count;
+}
+
+bool trace_is_recording(void)
+{
+    return trace_recording;
+}
+
+// Output is gathered in whole sectors, fat32.c writes them faster than small pieces
+static char out_buffer[4096];
+static size_t out_length;
+
+static void out_printf(FILE *file, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    if (out_length > sizeof(out_buffer) - 256)
+    {
+        fwrite(out_buffer, 1, out_length, file);
+        out_length = 0;
+    }
+    va_start(args, format);
+    length = vsnprintf(out_buffer + out_length, sizeof(out_buffer) - out_length, format, args);
+    va_end(args);
+    if (length > 0)
+    {
+        out_length += length;
+    }
+}
+
+// Writes the recorded spans, oldest first, as a Chrome trace-event JSON document.
+// Recording is paused meanwhile, so that writing the file does not trace itself.
+void trace_write_json(FILE *file)
+{
+    bool recording = trace_recording;
+    uint32_t first = (ring_next + TRACE_CAPACITY - ring_count) % TRACE_CAPACITY;
+    uint32_t base = ring[first].start;
+
+    trace_recording = false;
+    for (uint32_t i = 0; i < ring_count; i++)
+    {
+        // Spans are stored as they end, the earliest start is the time origin
+        uint32_t start = ring[(first + i) % TRACE_CAPACITY].start;
+        if ((int32_t)(start - base) < 0)
+        {
+            base = start;
+        }
+    }
+
+    out_length = 0;
+    out_printf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int i = 0; i < TRACE_EVENT_TYPES; i++)
+    {
+        out_printf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}},\n",
+                   i + 1, event_names[i]);
+    }
+    for (uint32_t i = 0; i < ring_count; i++)
+    {
+        trace_record_t *record = &ring[(first + i) % TRACE_CAPACITY];
+
+        out_printf(file, "{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lu,\"dur\":%lu,\"name\":\"%s",
+                   record->event + 1, (unsigned long)(record->start - base), (unsigned long)record->duration,
+                   event_names[record->event]);
+        if (record->event == TRACE_BDOS || record->event == TRACE_BIOS)
+        {
+            out_printf(file, " %lu", (unsigned long)record->arg);
+        }
+        out_printf(file, "\"");
+        if (event_args[record->event])
+        {
+            out_printf(file, ",\"args\":{\"%s\":%lu}", event_args[record->event], (unsigned long)record->arg);
+        }
+        out_printf(file, "},\n");
+    }
+    out_printf(file, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"RunCPM\"}}\n]}\n");
+    fwrite(out_buffer, 1, out_length, file);
+    trace_recording = recording;
+}
+
+#endif // ifdef RUNCPM_TRACE
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+
+//
+//  Timeline trace recorder
+//
+//  Built when RUNCPM_TRACE is defined (CMake option RUNCPM_TRACE, always on in
+//  runcpm-host). Without it the calls below compile to nothing.
+//
+//  A span is timed by taking a start stamp with trace_begin() and recording
+//  it with trace_end(). Recording is off until trace_start() is called.
+//
+
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY      (2048)      // events kept, the oldest are overwritten
+#endif
+#define TRACE_BURST_GAP_US  (200)       // display_emit calls closer than this make one burst
+
+typedef enum
+{
+    TRACE_BDOS = 0,         // arg: function number
+    TRACE_BIOS,             // arg: function number
+    TRACE_SECTOR_READ,      // fat32.c read_sector, arg: sector
+    TRACE_SECTOR_WRITE,     // fat32.c write_sector, arg: sector
+    TRACE_SD_READ,          // sd_read_block, arg: block
+    TRACE_SD_WRITE,         // sd_write_block, arg: block
+    TRACE_LCD_BLIT,         // arg: pixels
+    TRACE_DISPLAY,          // display_emit burst, arg: characters
+    TRACE_KEYBOARD,         // keyboard_poll
+    TRACE_EVENT_TYPES
+} trace_event_t;
+
+#ifdef RUNCPM_TRACE
+
+extern volatile bool trace_recording;
+
+// Returns the start stamp of a span, 0 if not recording
+static inline uint32_t trace_begin(void)
+{
+    uint32_t now;
+
+    if (!trace_recording)
+        return 0;
+    now = time_us_32();
+    return now ? now : 1;
+}
+
+void trace_end(trace_event_t event, uint32_t arg, uint32_t start);
+
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+uint32_t trace_count(void);
+bool trace_is_recording(void);
+void trace_write_json(FILE *file);
+
+#else
+
+static inline uint32_t trace_begin(void) { return 0; }
+static inline void trace_end(trace_event_t event, uint32_t arg, uint32_t start) {}
+
+#endif
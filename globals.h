@@ -122,11 +122,36 @@
 
 // #define STREAMIO					// Will enable command line flags to read
 //  console input from file and to log console output to file
-//  Should be passed externally per-platform with -DSTREAMIO
+//  Should be passed externally per-platform with -DSTREAMIO, runcpm-host has it (see _host_init)
 
 // #define PROFILE					// For measuring time taken to run a CP/M command
 //  This should be enabled only for debugging purposes when trying to improve emulation speed
 
+// #define BENCHMARK				// Adds the BENCH command, which runs a script of workloads and reports
+//  wall time, emulated cycles, BDOS/BIOS calls, SD and LCD traffic per workload as JSON
+//  Costs a table lookup per emulated instruction. The host build (runcpm-host) always has it
+
+// #define PCSAMPLE				// Adds the SAMPLE command, a sampling profiler of the emulated program counter
+//  Uses 24 KB of RAM for the histogram and a test per emulated instruction. The host build always has it
+
+// #define IOLOG					// Adds the IOLOG command, which logs every SD sector access of the FAT32 driver
+//  for host/bench/ioreplay.py. The log holds IOLOG_CAPACITY accesses, 16 bytes each. The host build always has it
+#ifndef IOLOG_CAPACITY
+#define IOLOG_CAPACITY 2048
+#endif
+
+#define HIBERNATE				// Adds the SUSPEND command and the F10 key, which save the whole machine to
+//  the SNAPSHOT file. The next boot restores it instead of starting CP/M afresh (see snapshot.h)
+
+#define OVERLAY				// Adds the OVERLAY command, which keeps the drives as they are and sends the writes
+//  to a scratch tree on the card, to be discarded or committed later (see abstraction_picocalc.h)
+
+#define DISKIMAGE				// Lets a drive B: to P: be a CP/M disk image in the root of the card, C.DSK for C:,
+//  with a real directory and allocation, BIOS sector access and a write back cache (see diskimg.h)
+
+// #define ROMDISK 'P'				// The read-only flash drive, its letter. Set by the build, which packs its files
+//  into the firmware when RUNCPM_ROMDISK_DIR is given. It hides the card folder of that letter (see romdisk.cmake)
+
 #define NOHIGHUSER // Prevents the creation of user folders above 'F' (15) by programs
                    // Original CP/M BDOS allows it, but I prefer to keep the folders clean
 
@@ -247,6 +272,10 @@ static uint8 RAM[MEMSIZE];
 
 /* Definition of global variables */
 static uint8 filename[17];      // Current filename in host filesystem format
+static uint32 fileChanges = 0;  // Files created, deleted or renamed so far, for the caches of lookups
+static uint32 batchDeletes = 0; // BDOS deletes of $$$.SUB so far, each one stops the batch running
+enum { CACHE_IMAGE, CACHE_COMMAND, CACHE_COUNT }; // Caches counted for the host BDOS call (see host.h)
+static uint32 cacheHits[CACHE_COUNT], cacheMisses[CACHE_COUNT];
 static uint8 newname[17];       // New filename in host filesystem format
 static uint8 fcbname[13];       // Current filename in CP/M format
 static uint8 pattern[13];       // File matching pattern in CP/M format
@@ -278,6 +307,32 @@ static uint8 firstBoot = TRUE;  // True if this is the first boot
 
 static uint32 timer;
 
+#ifdef BENCHMARK
+static uint64 benchCycles = 0;           // Emulated T-states (see Z80run)
+static uint64 benchInstructions = 0;     // Emulated instructions
+static uint32 benchBdosCalls = 0;        // Number of BDOS calls
+static uint32 benchBiosCalls = 0;        // Number of BIOS calls
+static const uint8 *benchKeys;           // Scripted console input for the running workload
+#endif
+
+#ifdef PCSAMPLE
+#ifndef PCS_SHIFT
+#define PCS_SHIFT 4                          // Bucket size of the PC histogram, 16 bytes
+#endif
+#define PCS_BUCKETS (0x10000 >> PCS_SHIFT)
+static uint32 pcsCounts[PCS_BUCKETS];        // Samples per bucket
+static uint16 pcsLastPC[PCS_BUCKETS];        // Last address sampled in each bucket
+static uint32 pcsPeriod = 0;                 // Instructions between samples, 0 = off
+static uint32 pcsCountdown = 0;
+#endif
+
+#ifdef HIBERNATE
+#define SNAPSHOT "SNAPSHOT.SYS"          // Machine state file, in the root of the SD card
+static uint8 snapGuest = FALSE;          // True while the internal CCP runs a program
+static uint8 snapResumed = FALSE;        // True when booting from a snapshot
+static uint8 snapHibernated = FALSE;     // True once the snapshot is saved, the machine then stops
+#endif
+
 #ifdef STREAMIO
     #include <stdio.h>
 static FILE *streamInputFile = NULL;
@@ -305,6 +360,13 @@ extern void _mockupDirEntry(uint8 mode);
 extern uint8 match(uint8 *fcbname, uint8 *pattern);
 
 extern void _puts(const char *str);
+extern uint8 _SyncDisks(void);
+
+#ifdef HIBERNATE
+extern uint8 _snapTrap(void);
+extern uint8 _snapHibernate(uint8 compress);
+extern uint8 _snapResume(void);
+#endif
 
 #ifdef __cplusplus // If building on Arduino
 }
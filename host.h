@@ -1,8 +1,174 @@
 #ifndef HOST_H
 #define HOST_H
 
+/* Host specific BDOS call (C = 231)
+
+   DE points to a parameter block whose first byte selects the service. The
+   result is returned in HL (A = L), 0xFF for an unknown service.
+
+   0x01 Profiler control, byte 1: 0 = off, 1 = on, 2 = clear, 3 = print report
+        Returns the previous state, 0 = off, 1 = on
+   0x02 Profiler entry, byte 1: 0 = BDOS, 1 = BIOS, byte 2: function number
+        Bytes 4-7 receive the call count, bytes 8-11 the total time in us and
+        bytes 12-75 the 16 histogram buckets (see profiler.h), all 32 bit little
+        endian. Returns 0, or 0xFF if the function has no entry
+   0x03 Hibernate at the next BDOS or BIOS call (see snapshot.h). Returns 0
+   0x04 Performance counters, byte 1 receives the number of counters and bytes
+        4 onwards the counters, 64 bit little endian, in the order of HostCounter.
+        Counters added later go at the end. Returns 0 (support_files/PERF.Z80
+        prints them)
+   0x05 Cache counters, byte 1 receives the number of caches and bytes 4
+        onwards the hits then the misses of each, 64 bit little endian, in the
+        order of HostCache. Caches added later go at the end. Returns 0
+        (PERF.Z80 prints these too)
+
+   New services take the next number. The block is usually the DMA buffer, so
+   a service should return at most 128 bytes, parameters included.
+*/
+
+#define HOST_PROFILE 0x01
+#define HOST_PROFENTRY 0x02
+#define HOST_HIBERNATE 0x03
+#define HOST_COUNTERS 0x04
+#define HOST_CACHES 0x05
+
+enum HostCounter {
+    HC_UPTIME,          // us since power up
+    HC_INSTRUCTIONS,    // Z80 instructions, BENCHMARK builds only (0 otherwise)
+    HC_CYCLES,          // Z80 T-states, BENCHMARK builds only (0 otherwise)
+    HC_BDOS,            // BDOS calls
+    HC_BDOS_CONSOLE,    // of which console and devices, functions 1-11
+    HC_BDOS_FILE,       // disk and file, 13-40 and 98-102
+    HC_BDOS_RUNCPM,     // RunCPM extensions, 220 and up
+    HC_BIOS,            // BIOS calls
+    HC_SD_READ,         // SD sectors read
+    HC_SD_WRITE,        // SD sectors written
+    HC_LCD_BYTES,       // bytes sent to the LCD
+    HC_COUNT
+};
+
+enum HostCache {
+    HK_FAT,             // FAT sectors, in the fat32.c buffers
+    HK_IMAGE,           // Disk image lines, DISKIMAGE builds only (0 otherwise)
+    HK_COMMAND,         // Places of commands, CCP_INTERNAL builds only (0 otherwise)
+    HK_COUNT
+};
+
+static uint32 hostBdosCalls[4]; // All calls, then by class as HC_BDOS_*
+static uint32 hostBiosCalls;
+
+// Counts a BDOS call in its class, cheap enough to always be on
+void _hostCountBdos(uint8 ch) {
+    ++hostBdosCalls[0];
+    if (ch >= 1 && ch <= 11)
+        ++hostBdosCalls[HC_BDOS_CONSOLE - HC_BDOS];
+    else if ((ch >= 13 && ch <= 40) || (ch >= 98 && ch <= 102))
+        ++hostBdosCalls[HC_BDOS_FILE - HC_BDOS];
+    else if (ch >= 220)
+        ++hostBdosCalls[HC_BDOS_RUNCPM - HC_BDOS];
+}
+
+void _hostPut32(uint16 address, uint32 value) {
+    for (uint8 i = 0; i < 4; ++i) {
+        _RamWrite(address + i, value & 0xff);
+        value >>= 8;
+    }
+}
+
+void _hostPut64(uint16 address, uint64 value) {
+    _hostPut32(address, (uint32)value);
+    _hostPut32(address + 4, (uint32)(value >> 32));
+}
+
+void _hostCounters(uint16 address) {
+    uint64 counters[HC_COUNT] = {0};
+    uint32 reads, writes;
+
+    counters[HC_UPTIME] = time_us_64();
+#ifdef BENCHMARK
+    counters[HC_INSTRUCTIONS] = benchInstructions;
+    counters[HC_CYCLES] = benchCycles;
+#endif
+    for (uint8 i = 0; i < 4; ++i)
+        counters[HC_BDOS + i] = hostBdosCalls[i];
+    counters[HC_BIOS] = hostBiosCalls;
+    fat32_get_io_stats(&reads, &writes);
+    counters[HC_SD_READ] = reads;
+    counters[HC_SD_WRITE] = writes;
+    counters[HC_LCD_BYTES] = lcd_get_bytes_sent();
+
+    _RamWrite(address + 1, HC_COUNT);
+    for (uint8 i = 0; i < HC_COUNT; ++i)
+        _hostPut64(address + 4 + 8 * i, counters[i]);
+}
+
+void _hostCaches(uint16 address) {
+    uint32 hits[HK_COUNT], misses[HK_COUNT];
+
+    fat32_get_fat_stats(&hits[HK_FAT], &misses[HK_FAT]);
+    hits[HK_IMAGE] = cacheHits[CACHE_IMAGE];
+    misses[HK_IMAGE] = cacheMisses[CACHE_IMAGE];
+    hits[HK_COMMAND] = cacheHits[CACHE_COMMAND];
+    misses[HK_COMMAND] = cacheMisses[CACHE_COMMAND];
+
+    _RamWrite(address + 1, HK_COUNT);
+    for (uint8 i = 0; i < HK_COUNT; ++i) {
+        _hostPut64(address + 4 + 16 * i, hits[i]);
+        _hostPut64(address + 12 + 16 * i, misses[i]);
+    }
+}
+
 uint8 hostbdos(uint16 dmaaddr) {
-    return (0x00);
+    uint8 result = 0xFF;
+
+    switch (_RamRead(dmaaddr)) {
+        case HOST_PROFILE: {
+            result = profEnabled;
+            switch (_RamRead(dmaaddr + 1)) {
+                case 0:
+                    profEnabled = FALSE;
+                    break;
+                case 1:
+                    profEnabled = TRUE;
+                    break;
+                case 2:
+                    _profClear();
+                    break;
+                case 3:
+                    _profReport();
+                    break;
+                default:
+                    result = 0xFF;
+            }
+            break;
+        }
+        case HOST_PROFENTRY: {
+            ProfEntry *e = _profEntry(_RamRead(dmaaddr + 1), _RamRead(dmaaddr + 2));
+            if (!e)
+                break;
+            _hostPut32(dmaaddr + 4, e->calls);
+            _hostPut32(dmaaddr + 8, (uint32)e->us);
+            for (uint8 b = 0; b < PROF_BUCKETS; ++b)
+                _hostPut32(dmaaddr + 12 + 4 * b, e->hist[b]);
+            result = 0;
+            break;
+        }
+#ifdef HIBERNATE
+        case HOST_HIBERNATE:
+            user_hibernate = TRUE;
+            result = 0;
+            break;
+#endif
+        case HOST_COUNTERS:
+            _hostCounters(dmaaddr);
+            result = 0;
+            break;
+        case HOST_CACHES:
+            _hostCaches(dmaaddr);
+            result = 0;
+            break;
+    }
+    return (result);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+#  RunCPM parallel batch runner
+#
+#  Runs many CP/M jobs, each one on a runcpm-host of its own, as many at a time
+#  as the host has cores. A job is a directory laid out as the SD card
+#  (A/0/PROG.PAS, B/0/...) with a JOB.SUB at its top: the commands to run, from
+#  A0>. The files of --common (the compilers, say) are put under every job,
+#  the job's own files win.
+#
+#  Every job gets an SD image of its own, AUTOEXEC.TXT starts JOB.SUB and its
+#  last line is EXIT. The LCD is not rendered (-n). The keyboard is left empty, so a program waiting for a
+#  key runs into --timeout. The results go to OUT/<job>/ :
+#    console.txt  what the job printed
+#    card/        the files the job created or changed, as on the card
+#  and OUT/summary.json has the status and time of every job. A job fails when
+#  runcpm-host does not end cleanly, runs out of time, or prints a line that
+#  matches --fail.
+#
+#  The emulator keeps its machine in globals, as on the device, so a machine
+#  is a process: that isolates them and spreads them over the cores the same.
+#
+#  Usage:
+#    batch.py [--common DIR] [--jobs N] [--out DIR] [--fail REGEX] [--timeout S] JOBDIR...
+#
+
+import argparse
+import concurrent.futures
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+import bench
+
+JOB_SUB = 'JOB.SUB'
+
+
+def read_tree(root):
+    # The files under root as {'A/0/NAME.EXT': bytes}, names in upper case as CP/M has them
+    tree = {}
+    for path, _, names in os.walk(root):
+        for name in names:
+            relative = os.path.relpath(os.path.join(path, name), root).replace(os.sep, '/')
+            with open(os.path.join(path, name), 'rb') as file:
+                tree[relative.upper()] = file.read()
+    return tree
+
+
+def job_tree(job, common):
+    tree = dict(common)
+    tree.update(read_tree(job))
+    script = tree.pop(JOB_SUB, None)
+    if script is None:
+        raise SystemExit('batch: %s has no %s' % (job, JOB_SUB))
+    lines = script.split(b'\x1a')[0].replace(b'\r\n', b'\n').splitlines()
+    tree['A/0/' + JOB_SUB] = b''.join(line + b'\r\n' for line in lines + [b'EXIT']) + b'\x1a'
+    tree['AUTOEXEC.TXT'] = b'JOB\r\n'
+    return tree
+
+
+def run_job(binary, job, common, out, fail, timeout):
+    name = os.path.basename(os.path.normpath(job))
+    result = {'job': name, 'status': 'ok', 'seconds': 0.0, 'files': 0}
+    tree = job_tree(job, common)
+    with tempfile.TemporaryDirectory() as tmp:
+        image = os.path.join(tmp, 'sdcard.img')
+        bench.fat32_image(image, tree)
+        env = dict(os.environ, RUNCPM_SD_IMAGE=image)
+        start = time.monotonic()
+        try:
+            proc = subprocess.run([binary, '-n'], env=env, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                                  stderr=subprocess.STDOUT, timeout=timeout)
+            console = proc.stdout
+            if proc.returncode:
+                result['status'] = 'exit %d' % proc.returncode
+        except subprocess.TimeoutExpired as expired:
+            console = expired.stdout or b''
+            result['status'] = 'timeout'
+        result['seconds'] = round(time.monotonic() - start, 3)
+        card = bench.fat32_tree(image)
+
+    directory = os.path.join(out, name)
+    os.makedirs(directory, exist_ok=True)
+    with open(os.path.join(directory, 'console.txt'), 'wb') as file:
+        file.write(console)
+    for path, data in card.items():
+        if tree.get(path) != data and path != 'CLOCK.CFG':
+            target = os.path.join(directory, 'card', path)
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            with open(target, 'wb') as file:
+                file.write(data)
+            result['files'] += 1
+
+    if fail and result['status'] == 'ok':
+        text = re.sub(r'\x1b\[[0-9;]*[A-Za-z]|\r', '', console.decode('latin-1'))
+        match = re.search(fail, text, re.MULTILINE)
+        if match:
+            result['status'] = 'failed'
+            result['match'] = match.group(0).strip()
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run CP/M jobs in parallel on runcpm-host')
+    parser.add_argument('jobs', nargs='+', metavar='JOBDIR', help='card tree of a job, with its JOB.SUB')
+    parser.add_argument('--common', help='card tree put under every job, the tools')
+    parser.add_argument('--binary', default=os.path.join(bench.REPO, 'build', 'host', 'runcpm-host'))
+    parser.add_argument('--jobs', '-j', dest='parallel', type=int, default=os.cpu_count(),
+                        help='jobs run at a time (default: one per core)')
+    parser.add_argument('--out', default='batch', help='results directory (default batch)')
+    parser.add_argument('--fail', help='regular expression, a job printing a match has failed')
+    parser.add_argument('--timeout', type=int, default=600, help='seconds a job may take')
+    args = parser.parse_args()
+
+    common = read_tree(args.common) if args.common else {}
+    start = time.monotonic()
+    # Processes, not threads: building and reading back the images is Python work
+    with concurrent.futures.ProcessPoolExecutor(max_workers=max(1, args.parallel)) as pool:
+        futures = [pool.submit(run_job, args.binary, job, common, args.out, args.fail, args.timeout)
+                   for job in args.jobs]
+        results = [future.result() for future in futures]
+    elapsed = time.monotonic() - start
+
+    summary = {'jobs': results, 'parallel': args.parallel, 'seconds': round(elapsed, 3)}
+    with open(os.path.join(args.out, 'summary.json'), 'w') as file:
+        json.dump(summary, file, indent=2)
+
+    print('%-20s %-10s %9s %6s' % ('job', 'status', 'seconds', 'files'))
+    for result in results:
+        print('%-20s %-10s %9.2f %6d  %s' % (result['job'], result['status'], result['seconds'],
+                                             result['files'], result.get('match', '')))
+    failed = sum(result['status'] != 'ok' for result in results)
+    total = sum(result['seconds'] for result in results)
+    print('%d jobs, %d failed, %.2f s (%.2f s of jobs, %.1fx)' % (len(results), failed, elapsed, total,
+                                                                   total / elapsed if elapsed else 0))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
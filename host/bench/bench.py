@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+#
+#  RunCPM end-to-end benchmark harness
+#
+#  Builds an SD card image with the benchmark workloads of support_files/BENCH.TXT,
+#  boots runcpm-host on it (AUTOEXEC.TXT starts BENCH) and collects the JSON
+#  report: wall time, emulated cycles, BDOS/BIOS calls, SD and LCD bytes per
+#  workload.
+#
+#  With --runs N the card is built once and runcpm-host runs on it N times with
+#  -w, the drives overlaid: every run starts from the same card without writing
+#  it again, and the report keeps the fastest run of each workload.
+#
+#  The CP/M programs the workloads use (M80, L80, TURBO, MBASIC, PIP) are not
+#  part of this repository; point --tools at a directory holding them. Workloads
+#  whose program is missing are left out of the run.
+#
+#  Usage:
+#    bench.py [--tools DIR] [--out FILE] [--compare BASELINE] [--runs N]   run on the host
+#    bench.py --prepare DIR [--tools DIR]                       card tree for the device
+#
+
+import argparse
+import json
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.normpath(os.path.join(HERE, '..', '..'))
+SUPPORT = os.path.join(REPO, 'support_files')
+
+INTERNAL = {'DIR', 'ERA', 'TYPE', 'SAVE', 'REN', 'USER', 'CLS', 'COPY', 'LDIR', 'DEL',
+            'ECHO', 'EXIT', 'PAGE', 'POKE', 'VER', 'DUMP', 'VOL', 'BENCH'}
+PRODUCED_BY = {'TPBENCH': 'TURBO'}  # programs built by an earlier workload
+SOURCES = ['ASMBENCH.MAC', 'BASBENCH.BAS', 'TPBENCH.PAS', 'WRBENCH.COM']
+METRICS = ['wall_us', 'cycles', 'bdos_calls', 'bios_calls', 'sd_read_bytes', 'sd_write_bytes', 'lcd_bytes']
+
+BIGFILE_LINES = 2048  # TYPE / PIP workload, 64 bytes per line
+DIR_FILES = 256       # DIR workload, on B: user 0
+
+
+#
+#  Card contents
+#
+
+def workload_tree(tools, for_host):
+    tree = {}
+    if tools:
+        for name in sorted(os.listdir(tools)):
+            path = os.path.join(tools, name)
+            if os.path.isfile(path):
+                tree['A/0/' + name.upper()] = open(path, 'rb').read()
+    for name in SOURCES:
+        tree['A/0/' + name] = open(os.path.join(SUPPORT, name), 'rb').read()
+
+    text = b''.join(b'%05d The quick brown fox jumps over the lazy dog, 0123456789.\r\n' % i
+                    for i in range(BIGFILE_LINES))
+    tree['A/0/BIGFILE.TXT'] = text + b'\x1a'
+    for i in range(DIR_FILES):
+        tree['B/0/F%04d.DAT' % i] = b'%d\r\n\x1a' % i
+
+    script, skipped = filter_script(open(os.path.join(SUPPORT, 'BENCH.TXT'), 'rb').read(), tree)
+    if for_host:
+        script += b'|EXIT\r\n'
+    tree['A/0/BENCH.TXT'] = script
+    tree['AUTOEXEC.TXT'] = b'BENCH\r\n'
+    return tree, skipped
+
+
+def filter_script(script, tree):
+    # Drops the workloads whose program is not on the card
+    def available(program):
+        if program in INTERNAL:
+            return True
+        if program in PRODUCED_BY:
+            return available(PRODUCED_BY[program])
+        return ('A/0/%s.COM' % program) in tree
+
+    lines, skipped = [], []
+    for line in script.split(b'\x1a')[0].decode('ascii').splitlines():
+        fields = line.split('|')
+        if line.startswith(';') or len(fields) < 2 or not fields[1].strip():
+            lines.append(line)
+            continue
+        program = fields[1].split()[0].upper()
+        if available(program):
+            lines.append(line)
+        else:
+            skipped.append(fields[0] or fields[1])
+    return ('\r\n'.join(lines) + '\r\n').encode('ascii'), skipped
+
+
+#
+#  FAT32 image writer (two FATs, 512 byte clusters, 8.3 names only)
+#
+
+def fat32_image(path, tree, sectors=131072):
+    reserved, fats, fat_sectors = 32, 2, 1010
+    data_start = reserved + fats * fat_sectors
+    img = bytearray(sectors * 512)
+    fat = [0x0FFFFFF8, 0x0FFFFFFF]
+
+    def alloc(data):
+        count = max(1, (len(data) + 511) // 512)
+        first = len(fat)
+        for i in range(count):
+            fat.append(first + i + 1 if i < count - 1 else 0x0FFFFFFF)
+        offset = (data_start + first - 2) * 512
+        img[offset:offset + len(data)] = data
+        return first
+
+    def entry(name, attr, cluster, size):
+        base, _, ext = name.partition('.')
+        return (base.ljust(8).encode() + ext.ljust(3).encode() + bytes([attr, 0, 0]) +
+                bytes(6) + struct.pack('<H', cluster >> 16) + struct.pack('<HH', 0, 0x21) +
+                struct.pack('<HI', cluster & 0xFFFF, size))
+
+    def write_dir(prefix, parent):
+        names = sorted({p[len(prefix):].split('/')[0] for p in tree if p.startswith(prefix)})
+        entries = []
+        if prefix:
+            entries += [(None, '.'), (None, '..')]
+        entries += [(n, n) for n in names]
+        size = (len(entries) + 1) * 32
+        cluster = alloc(bytes(size))  # filled in below, once the children have clusters
+        body = bytearray()
+        for full, name in entries:
+            if full is None:
+                body += entry(name, 0x10, cluster if name == '.' else parent, 0)
+            elif (prefix + full) in tree:
+                data = tree[prefix + full]
+                body += entry(name, 0x20, alloc(data), len(data))
+            else:
+                body += entry(name, 0x10, write_dir(prefix + full + '/', cluster), 0)
+        offset = (data_start + cluster - 2) * 512
+        img[offset:offset + len(body)] = body
+        return cluster
+
+    write_dir('', 0)
+    clusters = (sectors - data_start)
+
+    bs = bytearray(512)
+    bs[0:3] = b'\xEB\x58\x90'
+    bs[3:11] = b'MSWIN4.1'
+    struct.pack_into('<HBHBHHBHHHII', bs, 11, 512, 1, reserved, fats, 0, 0, 0xF8, 0, 32, 64, 0, sectors)
+    struct.pack_into('<IHHIHH', bs, 36, fat_sectors, 0, 0, 2, 1, 6)
+    bs[64], bs[66] = 0x80, 0x29
+    bs[71:82] = b'RUNCPM     '
+    bs[82:90] = b'FAT32   '
+    bs[510:512] = b'\x55\xAA'
+    img[0:512] = bs
+    img[6 * 512:7 * 512] = bs
+
+    fsinfo = bytearray(512)
+    struct.pack_into('<I', fsinfo, 0, 0x41615252)
+    struct.pack_into('<III', fsinfo, 484, 0x61417272, clusters - len(fat) + 2, len(fat))
+    struct.pack_into('<I', fsinfo, 508, 0xAA550000)
+    img[512:1024] = fsinfo
+
+    table = struct.pack('<%dI' % len(fat), *fat)
+    for f in range(fats):
+        offset = (reserved + f * fat_sectors) * 512
+        img[offset:offset + len(table)] = table
+    with open(path, 'wb') as file:
+        file.write(img)
+
+
+def fat32_tree(path):
+    # The files of a FAT32 image (or whole card dump) as {'A/0/NAME.EXT': bytes}, by their short names
+    img = open(path, 'rb').read()
+    start = 0
+    if img[82:87] != b'FAT32':
+        start = struct.unpack_from('<I', img, 0x1C6)[0] * 512  # first partition of a card dump
+    sector, per_cluster, reserved, fats = struct.unpack_from('<HBHB', img, start + 11)
+    fat_sectors, = struct.unpack_from('<I', img, start + 36)
+    root, = struct.unpack_from('<I', img, start + 44)
+    fat = start + reserved * sector
+    data = start + (reserved + fats * fat_sectors) * sector
+    cluster_size = per_cluster * sector
+
+    def chain(cluster, size=None):
+        body = bytearray()
+        while 2 <= cluster < 0x0FFFFFF8 and (size is None or len(body) < size):
+            offset = data + (cluster - 2) * cluster_size
+            body += img[offset:offset + cluster_size]
+            cluster = struct.unpack_from('<I', img, fat + cluster * 4)[0] & 0x0FFFFFFF
+        return bytes(body if size is None else body[:size])
+
+    tree = {}
+
+    def read_dir(prefix, cluster):
+        body = chain(cluster)
+        for i in range(0, len(body), 32):
+            raw = body[i:i + 32]
+            if raw[0] == 0:
+                break
+            if raw[0] == 0xE5 or raw[11] == 0x0F or raw[11] & 0x08:
+                continue  # deleted, long name or volume label
+            base, ext = raw[0:8].decode('latin-1').rstrip(), raw[8:11].decode('latin-1').rstrip()
+            if not base or base.startswith('.'):
+                continue  # . and .. (fat32_image leaves their names blank)
+            name = base + ('.' + ext if ext else '')
+            first = struct.unpack_from('<H', raw, 20)[0] << 16 | struct.unpack_from('<H', raw, 26)[0]
+            if raw[11] & 0x10:
+                read_dir(prefix + name + '/', first)
+            else:
+                tree[prefix + name] = chain(first, struct.unpack_from('<I', raw, 28)[0])
+
+    read_dir('', root)
+    return tree
+
+
+#
+#  Running and reporting
+#
+
+def run_host(binary, image, timeout, overlay=False):
+    env = dict(os.environ, RUNCPM_SD_IMAGE=image)
+    proc = subprocess.run([binary] + (['-w'] if overlay else []), env=env, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                          timeout=timeout)
+    return proc.stdout.decode('latin-1')
+
+
+def parse_report(text):
+    # The report is interleaved with the workloads' own console output; each
+    # workload record is printed on a line of its own
+    text = re.sub(r'\x1b\[[0-9;]*[A-Za-z]', '', text)
+    start = text.rfind('{"runcpm"')
+    if start < 0 or text.find(']}', start) < 0:
+        raise SystemExit('bench: no complete benchmark report in the console output')
+    header = text[start:text.index('[', start)] + '[]}'
+    report = json.loads(header)
+    for line in text[start:].splitlines():
+        if line.startswith('{"name"'):
+            report['workloads'].append(json.loads(line))
+    return report
+
+
+def print_report(report, baseline):
+    base = {w['name']: w for w in baseline['workloads']} if baseline else {}
+    print('%-8s' % 'workload' + ''.join('%16s' % m for m in METRICS))
+    for w in report['workloads']:
+        row = '%-8s' % w['name']
+        for m in METRICS:
+            cell = '%d' % w[m]
+            old = base.get(w['name'], {}).get(m)
+            if old:
+                cell += ' %+.0f%%' % (100.0 * (w[m] - old) / old)
+            row += '%16s' % cell
+        print(row)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='RunCPM end-to-end benchmark')
+    parser.add_argument('--tools', help='directory with M80.COM, L80.COM, TURBO.COM, MBASIC.COM, PIP.COM ...')
+    parser.add_argument('--binary', default=os.path.join(REPO, 'build', 'host', 'runcpm-host'))
+    parser.add_argument('--out', default='bench.json', help='JSON report (default bench.json)')
+    parser.add_argument('--compare', help='earlier JSON report to compare against')
+    parser.add_argument('--prepare', metavar='DIR', help='only write the card tree to DIR, for the device')
+    parser.add_argument('--timeout', type=int, default=600)
+    parser.add_argument('--runs', type=int, default=1, help='runs on the same card, the fastest of each workload is kept')
+    args = parser.parse_args()
+
+    tree, skipped = workload_tree(args.tools, not args.prepare)
+    for name in skipped:
+        print('bench: skipping %s, its program is not in --tools' % name, file=sys.stderr)
+
+    if args.prepare:
+        for name, data in tree.items():
+            path = os.path.join(args.prepare, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, 'wb') as file:
+                file.write(data)
+        return
+
+    with tempfile.TemporaryDirectory() as tmp:
+        image = os.path.join(tmp, 'sdcard.img')
+        fat32_image(image, tree)
+        report = parse_report(run_host(args.binary, image, args.timeout, args.runs > 1))
+        for _ in range(args.runs - 1):
+            again = parse_report(run_host(args.binary, image, args.timeout, True))
+            best = {w['name']: w for w in again['workloads']}
+            report['workloads'] = [min(w, best.get(w['name'], w), key=lambda r: r['wall_us'])
+                                   for w in report['workloads']]
+
+    with open(args.out, 'w') as file:
+        json.dump(report, file, indent=2)
+    baseline = json.load(open(args.compare)) if args.compare else None
+    print_report(report, baseline)
+
+
+if __name__ == '__main__':
+    main()
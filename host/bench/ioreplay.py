@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+#
+#  RunCPM SD sector log replay
+#
+#  Replays a sector access log (IOLOG SAVE on the device, or RUNCPM_IOLOG with
+#  runcpm-host) through models of a block cache between fat32.c and the SD
+#  card, and predicts the time the card would spend on each. Policies are
+#  compared in one run:
+#
+#    none            every access is an SD command, as fat32.c does today
+#    lru:N           N sector read cache, writes go through
+#    wb:N            N sector cache, writes are held until evicted (write back)
+#    ...,ra:K        a read miss also fetches the K-1 following sectors
+#
+#  The SD card is modelled as a fixed cost per command plus the transfer time
+#  of each block at SD_BAUDRATE. With --multiblock, read-ahead and write-back
+#  runs use one multiple block command (CMD18/CMD25), as sdcard.c could.
+#
+#  Usage:
+#    ioreplay.py IOLOG.CSV [--policy lru:64 --policy wb:64,ra:8 ...] [--image sdcard.img] [--callers]
+#
+
+import argparse
+import collections
+import struct
+
+SD_BAUDRATE = 25000000   # drivers/sdcard.h
+BLOCK_BYTES = 512 + 2 + 1  # data, CRC, token
+DEFAULT_POLICIES = ['none', 'lru:32', 'lru:128', 'lru:32,ra:4', 'wb:128', 'wb:128,ra:8']
+
+
+class SdModel:
+    def __init__(self, args):
+        self.read_cmd_us = args.read_cmd_us
+        self.write_cmd_us = args.write_cmd_us
+        self.block_us = BLOCK_BYTES * 8 * 1e6 / args.baud
+        self.multiblock = args.multiblock
+        self.commands = 0
+        self.blocks_read = 0
+        self.blocks_written = 0
+        self.us = 0.0
+
+    def read(self, count):
+        commands = 1 if self.multiblock else count
+        self.commands += commands
+        self.blocks_read += count
+        self.us += commands * self.read_cmd_us + count * self.block_us
+
+    def write(self, count):
+        commands = 1 if self.multiblock else count
+        self.commands += commands
+        self.blocks_written += count
+        self.us += commands * self.write_cmd_us + count * self.block_us
+
+
+class Cache:
+    def __init__(self, policy, sd):
+        self.name = policy
+        self.sd = sd
+        self.size = 0
+        self.write_back = False
+        self.readahead = 1
+        for part in policy.split(','):
+            kind, _, value = part.partition(':')
+            if kind == 'lru':
+                self.size = int(value)
+            elif kind == 'wb':
+                self.size = int(value)
+                self.write_back = True
+            elif kind == 'ra':
+                self.readahead = max(1, int(value))
+            elif kind != 'none':
+                raise SystemExit('ioreplay: unknown policy %r' % part)
+        self.lines = collections.OrderedDict()  # sector -> dirty
+        self.hits = 0
+        self.reads = 0
+
+    def _insert(self, sector, dirty):
+        self.lines[sector] = dirty or self.lines.get(sector, False)
+        self.lines.move_to_end(sector)
+        evicted = []
+        while len(self.lines) > self.size:
+            old, old_dirty = self.lines.popitem(last=False)
+            if old_dirty:
+                evicted.append(old)
+        self._write_runs(evicted)
+
+    def _write_runs(self, sectors):
+        # Contiguous dirty sectors go out together
+        run = []
+        for sector in sorted(sectors):
+            if run and sector != run[-1] + 1:
+                self.sd.write(len(run))
+                run = []
+            run.append(sector)
+        if run:
+            self.sd.write(len(run))
+
+    def access(self, op, sector):
+        if op == 'R':
+            self.reads += 1
+            if sector in self.lines:
+                self.hits += 1
+                self.lines.move_to_end(sector)
+                return
+            count = 1
+            while count < self.readahead and sector + count not in self.lines:
+                count += 1
+            self.sd.read(count)
+            if self.size:
+                for s in range(sector, sector + count):
+                    self._insert(s, False)
+        else:
+            if not self.size:
+                self.sd.write(1)
+            elif self.write_back:
+                self._insert(sector, True)
+            else:
+                self.sd.write(1)
+                self._insert(sector, False)
+
+    def flush(self):
+        self._write_runs([s for s, dirty in self.lines.items() if dirty])
+        for s in self.lines:
+            self.lines[s] = False
+
+
+def load_log(path):
+    header, records = '', []
+    with open(path, 'rb') as file:
+        data = file.read().split(b'\x1a')[0].decode('ascii', 'replace')
+    for line in data.splitlines():
+        if line.startswith('#'):
+            header = line
+            continue
+        fields = line.strip().split(',')
+        if len(fields) == 4:
+            records.append((int(fields[0]), fields[1], int(fields[2]), fields[3]))
+    return header, records
+
+
+def volume_regions(image, volume_start):
+    # Sector ranges of the reserved area, the FATs and the data region
+    with open(image, 'rb') as file:
+        file.seek(volume_start * 512)
+        bs = file.read(512)
+    reserved = struct.unpack_from('<H', bs, 14)[0]
+    fats = bs[16]
+    fat_sectors = struct.unpack_from('<I', bs, 36)[0]
+    return [('reserved', 0, reserved), ('fat', reserved, reserved + fats * fat_sectors),
+            ('data', reserved + fats * fat_sectors, 1 << 32)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a RunCPM sector log through block cache models')
+    parser.add_argument('log', help='IOLOG.CSV from the device, or the RUNCPM_IOLOG file of runcpm-host')
+    parser.add_argument('--policy', action='append', help='cache policy (repeatable), default: a standard set')
+    parser.add_argument('--image', help='SD image the log was taken on, to split accesses by FAT32 region')
+    parser.add_argument('--callers', action='store_true', help='break the accesses down by fat32.c function')
+    parser.add_argument('--baud', type=float, default=SD_BAUDRATE, help='SPI clock (default SD_BAUDRATE)')
+    parser.add_argument('--read-cmd-us', type=float, default=100.0, help='fixed cost of a read command')
+    parser.add_argument('--write-cmd-us', type=float, default=300.0, help='fixed cost of a write command')
+    parser.add_argument('--multiblock', action='store_true', help='runs of sectors take one command')
+    args = parser.parse_args()
+
+    header, records = load_log(args.log)
+    if not records:
+        raise SystemExit('ioreplay: no accesses in %s' % args.log)
+    reads = sum(1 for r in records if r[1] == 'R')
+    span_ms = (records[-1][0] - records[0][0]) / 1000.0
+    print('%s' % header.lstrip('# '))
+    print('%d accesses, %d reads, %d writes, %d distinct sectors, %.1f ms captured' %
+          (len(records), reads, len(records) - reads, len({r[2] for r in records}), span_ms))
+
+    if args.image:
+        volume_start = 0
+        if 'volume start' in header:
+            volume_start = int(header.split('volume start')[1].split(',')[0])
+        regions = volume_regions(args.image, volume_start)
+        counts = collections.Counter()
+        for _, op, sector, _ in records:
+            for name, first, end in regions:
+                if first <= sector < end:
+                    counts[name, op] += 1
+        print('by region: ' + ', '.join('%s %s %d' % (name, op, n) for (name, op), n in sorted(counts.items())))
+
+    if args.callers:
+        counts = collections.Counter((r[3], r[1]) for r in records)
+        for (caller, op), n in counts.most_common():
+            print('  %-28s %s %9d' % (caller, op, n))
+
+    print()
+    print('%-18s %9s %10s %10s %10s %12s %8s' %
+          ('policy', 'hit rate', 'commands', 'blk read', 'blk write', 'device ms', 'vs none'))
+    baseline = None
+    for policy in ['none'] + [p for p in (args.policy or DEFAULT_POLICIES) if p != 'none']:
+        sd = SdModel(args)
+        cache = Cache(policy, sd)
+        for _, op, sector, _ in records:
+            cache.access(op, sector)
+        cache.flush()
+        baseline = baseline or sd.us
+        hit_rate = 100.0 * cache.hits / cache.reads if cache.reads else 0.0
+        print('%-18s %8.1f%% %10d %10d %10d %12.1f %7.0f%%' %
+              (policy, hit_rate, sd.commands, sd.blocks_read, sd.blocks_written, sd.us / 1000.0,
+               100.0 * (sd.us - baseline) / baseline if baseline else 0.0))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+#
+#  RunCPM static RAM report
+#
+#  Reads the GNU ld map file of the firmware (picocalc-runcpm.elf.map, written
+#  by pico_add_extra_outputs) or of runcpm-host, and breaks the static RAM
+#  (.data, .bss and the other sections loaded in SRAM) down by subsystem. The
+#  objects are compiled with -fdata-sections, so every variable has an input
+#  section of its own and is attributed by its name, or else by the source file
+#  it comes from.
+#
+#  With --budget, the exit status is 1 when the total is over it, which fails
+#  the firmware build (see ram_budget.cmake).
+#
+#  Usage:
+#    ramreport.py MAP [--budget BYTES] [--profile NAME] [--top N] [--summary] [--remove FILE]
+#
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+# Output sections that take SRAM. .heap and the stacks are what is left over, not counted
+RAM_SECTIONS = {'.data', '.bss', '.uninitialized_data', '.ram_vector_table', '.tdata', '.tbss',
+                '.scratch_x', '.scratch_y'}
+
+# Variables of the single translation unit runcpm.c, by name
+SYMBOL_RULES = [
+    (r'^RAM$', 'Z80 memory'),
+    (r'Table$', 'Z80 flag tables'),
+    (r'^pcs', 'sampler'),
+    (r'^prof', 'profiler'),
+    (r'^ioLog$', 'IOLOG'),
+    (r'^(snap|Snap)', 'hibernate'),
+    (r'^boot', 'boot'),
+    (r'^submit', 'SUBMIT'),
+    (r'^dsk', 'disk images'),
+    (r'^bench', 'benchmark'),
+    (r'^(files|initialized)$', 'clib files'),
+]
+
+# Everything else, by source file
+FILE_RULES = [
+    (r'drivers/(lcd|display|font[-\w]*|picocalc)\.c', 'display'),
+    (r'drivers/fat32\.c', 'FAT32'),
+    (r'drivers/sdcard\.c|sdcard_host\.c', 'SD card'),
+    (r'drivers/(keyboard|southbridge)\.c|board_host\.c', 'keyboard'),
+    (r'drivers/trace\.c', 'trace'),
+    (r'drivers/(audio|onboard_led|serial)\.c', 'audio, LED, serial'),
+    (r'(lcd|pico)_host\.c', 'host shims'),
+    (r'runcpm\.c', 'emulator'),
+    (r'libc|libg|libm|libnosys|newlib|libgcc', 'C library'),
+    (r'pico|tinyusb|hardware_|boot_stage2', 'Pico SDK'),
+]
+
+# An input section line, with or without the address and size wrapped to the next line
+SECTION_LINE = re.compile(r'^ (\.[\w.$]+|COMMON)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*))?$')
+WRAPPED_LINE = re.compile(r'^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$')
+OUTPUT_LINE = re.compile(r'^(\.[\w.]+)\b')
+
+
+def subsystem(name, source):
+    if 'runcpm.c' in source:
+        for pattern, group in SYMBOL_RULES:
+            if re.search(pattern, name):
+                return group
+    for pattern, group in FILE_RULES:
+        if re.search(pattern, source):
+            return group
+    return 'other'
+
+
+def load_map(path):
+    # Returns (output section, variable, source, size) for every input section in SRAM
+    records = []
+    output = None
+    pending = None
+    in_map = False
+    with open(path, errors='replace') as file:
+        for line in file:
+            line = line.rstrip('\n')
+            if not in_map:
+                in_map = line.startswith('Linker script and memory map')
+                continue
+            match = OUTPUT_LINE.match(line)
+            if match:
+                output = match.group(1)
+                pending = None
+                continue
+            if output not in RAM_SECTIONS:
+                continue
+            if pending:
+                match = WRAPPED_LINE.match(line)
+                if match:
+                    records.append((output, pending, match.group(3), int(match.group(2), 16)))
+                pending = None
+                continue
+            match = SECTION_LINE.match(line)
+            if not match:
+                continue
+            if match.group(2) is None:
+                pending = match.group(1)
+            else:
+                records.append((output, match.group(1), match.group(4), int(match.group(3), 16)))
+    # .bss.name, .data.name, .bss.name.0 (static locals) all give the variable name
+    return [(output, re.sub(r'^\.(t?bss|t?data|uninitialized_data|sdata|sbss)\.?', '', section).split('.')[0],
+             source, size) for output, section, source, size in records if size]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Break the static RAM of a RunCPM build down by subsystem')
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--budget', type=int, help='static RAM allowed, in bytes')
+    parser.add_argument('--profile', default='', help='RAM profile name, for the report')
+    parser.add_argument('--top', type=int, default=0, help='also list the N largest variables')
+    parser.add_argument('--summary', action='store_true', help='one line, for the build log')
+    parser.add_argument('--remove', help='file to delete when over budget, the firmware image')
+    args = parser.parse_args()
+
+    records = load_map(args.map)
+    if not records:
+        raise SystemExit('ramreport: no SRAM sections in %s' % args.map)
+    groups = collections.Counter()
+    for _, name, source, size in records:
+        groups[subsystem(name, source)] += size
+    total = sum(groups.values())
+    over = args.budget is not None and total > args.budget
+    profile = ', profile %s' % args.profile if args.profile else ''
+
+    if args.summary:
+        budget = ' of %d (%.0f%%)' % (args.budget, 100.0 * total / args.budget) if args.budget else ''
+        print('Static RAM: %d bytes%s%s' % (total, budget, profile))
+    else:
+        print('Static RAM of %s%s' % (os.path.basename(args.map), profile))
+        print('%-20s %9s %6s' % ('Subsystem', 'Bytes', '%'))
+        for group, size in groups.most_common():
+            print('%-20s %9d %5.1f%%' % (group, size, 100.0 * size / total))
+        print('%-20s %9d' % ('Total', total))
+        if args.budget:
+            print('%-20s %9d %5.1f%% used, %d bytes %s' % ('Budget', args.budget, 100.0 * total / args.budget,
+                                                        abs(args.budget - total), 'over' if over else 'free'))
+        if args.top:
+            print()
+            print('%-28s %9s  %s' % ('Variable', 'Bytes', 'Subsystem'))
+            for _, name, source, size in sorted(records, key=lambda r: -r[3])[:args.top]:
+                print('%-28s %9d  %s' % (name or '(unnamed)', size, subsystem(name, source)))
+
+    if over:
+        print('ramreport: %d bytes of static RAM, over the budget of %d%s' % (total, args.budget, profile),
+              file=sys.stderr)
+        if args.remove and os.path.exists(args.remove):
+            os.remove(args.remove)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,122 @@
+//
+//  Host stand-ins for the southbridge and audio drivers
+//
+//  The southbridge reports a full, discharging battery and remembers the
+//  backlight levels it is given; keys arrive through stdin (see pico_host.c),
+//  so the keyboard FIFO is always empty. Audio is silent.
+//
+
+#include "pico/stdlib.h"
+
+#include "southbridge.h"
+#include "audio.h"
+
+static uint8_t lcd_backlight = 0xFF;
+static uint8_t keyboard_backlight = 0x00;
+
+//
+//  Southbridge
+//
+
+void sb_init(void)
+{
+}
+
+bool sb_available(void)
+{
+    return true;
+}
+
+uint16_t sb_read_keyboard(void)
+{
+    return 0;
+}
+
+uint16_t sb_read_keyboard_state(void)
+{
+    return 0;
+}
+
+uint8_t sb_read_battery(void)
+{
+    return 100;
+}
+
+uint8_t sb_read_lcd_backlight(void)
+{
+    return lcd_backlight;
+}
+
+uint8_t sb_write_lcd_backlight(uint8_t brightness)
+{
+    lcd_backlight = brightness;
+    return lcd_backlight;
+}
+
+uint8_t sb_read_keyboard_backlight(void)
+{
+    return keyboard_backlight;
+}
+
+uint8_t sb_write_keyboard_backlight(uint8_t brightness)
+{
+    keyboard_backlight = brightness;
+    return keyboard_backlight;
+}
+
+bool sb_is_power_off_supported(void)
+{
+    return false;
+}
+
+bool sb_write_power_off_delay(uint8_t delay_seconds)
+{
+    (void)delay_seconds;
+    return false;
+}
+
+bool sb_reset(uint8_t delay_seconds)
+{
+    (void)delay_seconds;
+    return false;
+}
+
+//
+//  Audio
+//
+
+void audio_init(void)
+{
+}
+
+void audio_play_sound_blocking(uint32_t left_frequency, uint32_t right_frequency, uint32_t duration_ms)
+{
+    (void)left_frequency;
+    (void)right_frequency;
+    (void)duration_ms;
+}
+
+void audio_play_sound(uint32_t left_frequency, uint32_t right_frequency)
+{
+    (void)left_frequency;
+    (void)right_frequency;
+}
+
+void audio_play_note_blocking(const audio_note_t *note)
+{
+    (void)note;
+}
+
+void audio_play_song_blocking(const audio_song_t *song)
+{
+    (void)song;
+}
+
+void audio_stop(void)
+{
+}
+
+bool audio_is_playing(void)
+{
+    return false;
+}
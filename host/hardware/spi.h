@@ -0,0 +1,4 @@
+#pragma once
+
+// Host build: see pico/stdlib.h
+#include "pico/stdlib.h"
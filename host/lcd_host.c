@@ -0,0 +1,217 @@
+//
+//  Host model of the ST7789P LCD controller on SPI1
+//
+//  drivers/lcd.c drives the panel exactly as it does on the device; the bytes
+//  it clocks out are decoded here into a 320x480 RGB565 frame memory. Only the
+//  commands lcd.c relies on are modelled: CASET, RASET, RAMWR, VSCRDEF and
+//  VSCSAD. host_lcd_dump_ppm() renders the visible 320x320 window, with the
+//  vertical scroll applied, to a binary PPM file.
+//
+
+#include "pico/stdlib.h"
+
+#include "lcd.h"
+
+#undef fopen // the PPM goes to the Linux file system, not the SD image
+
+static uint16_t frame[FRAME_HEIGHT][WIDTH];
+
+static uint8_t command = LCD_CMD_NOP;   // last command received
+static uint8_t params[8];               // parameter bytes of the last command
+static uint8_t param_count = 0;
+
+static uint16_t x_start = 0, x_end = WIDTH - 1;        // CASET window
+static uint16_t y_start = 0, y_end = FRAME_HEIGHT - 1; // RASET window
+static uint16_t x_pos = 0, y_pos = 0;                  // RAMWR position
+
+static uint16_t scroll_top = 0;                         // VSCRDEF top fixed area
+static uint16_t scroll_bottom = 0;                      // VSCRDEF bottom fixed area
+static uint16_t scroll_start = 0;                       // VSCSAD
+
+static uint8_t pixel_high;                              // first byte of an 8-bit pixel
+static bool pixel_half = false;
+
+static void lcd_command(uint8_t cmd)
+{
+    command = cmd;
+    param_count = 0;
+    pixel_half = false;
+    if (cmd == LCD_CMD_RAMWR)
+    {
+        x_pos = x_start;
+        y_pos = y_start;
+    }
+}
+
+static void lcd_pixel(uint16_t colour)
+{
+    if (x_pos < WIDTH && y_pos < FRAME_HEIGHT)
+    {
+        frame[y_pos][x_pos] = colour;
+    }
+    if (++x_pos > x_end)
+    {
+        x_pos = x_start;
+        if (++y_pos > y_end)
+            y_pos = y_start;
+    }
+}
+
+static void lcd_param(uint8_t data)
+{
+    if (param_count < sizeof(params))
+    {
+        params[param_count++] = data;
+    }
+
+    switch (command)
+    {
+    case LCD_CMD_CASET:
+        if (param_count == 4)
+        {
+            x_start = params[0] << 8 | params[1];
+            x_end = params[2] << 8 | params[3];
+        }
+        break;
+    case LCD_CMD_RASET:
+        if (param_count == 4)
+        {
+            y_start = params[0] << 8 | params[1];
+            y_end = params[2] << 8 | params[3];
+        }
+        break;
+    case LCD_CMD_VSCRDEF:
+        if (param_count == 6)
+        {
+            scroll_top = params[0] << 8 | params[1];
+            scroll_bottom = params[4] << 8 | params[5];
+        }
+        break;
+    case LCD_CMD_VSCSAD:
+        if (param_count == 2)
+        {
+            scroll_start = params[0] << 8 | params[1];
+        }
+        break;
+    case LCD_CMD_RAMWR:
+        param_count = 0;
+        if (pixel_half)
+        {
+            lcd_pixel(pixel_high << 8 | data);
+        }
+        else
+        {
+            pixel_high = data;
+        }
+        pixel_half = !pixel_half;
+        break;
+    default:
+        break;
+    }
+}
+
+//
+//  SPI bus (the LCD is the only SPI device in the host build)
+//
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    spi->data_bits = 8;
+    return baudrate;
+}
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate)
+{
+    (void)spi;
+    return baudrate;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order)
+{
+    (void)cpol;
+    (void)cpha;
+    (void)order;
+    spi->data_bits = data_bits;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    if (spi != LCD_SPI || gpio_get(LCD_CSX))
+        return (int)len;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (gpio_get(LCD_DCX))
+            lcd_param(src[i]);
+        else
+            lcd_command(src[i]);
+    }
+    return (int)len;
+}
+
+int spi_write16_blocking(spi_inst_t *spi, const uint16_t *src, size_t len)
+{
+    if (spi != LCD_SPI || gpio_get(LCD_CSX) || !gpio_get(LCD_DCX))
+        return (int)len;
+
+    if (command == LCD_CMD_RAMWR)
+    {
+        for (size_t i = 0; i < len; i++)
+            lcd_pixel(src[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            lcd_param(UPPER8(src[i]));
+            lcd_param(LOWER8(src[i]));
+        }
+    }
+    return (int)len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    (void)spi;
+    memset(dst, repeated_tx_data, len);
+    return (int)len;
+}
+
+//
+//  Frame capture
+//
+
+// Map a panel line to the frame memory line shown on it. As in lcd_blit(),
+// the lines between the fixed areas form a ring of the whole frame memory.
+static uint16_t visible_line(uint16_t y)
+{
+    uint16_t ring = FRAME_HEIGHT - scroll_top - scroll_bottom;
+
+    if (y < scroll_top || y >= HEIGHT - scroll_bottom || scroll_top + scroll_bottom >= FRAME_HEIGHT)
+        return y;
+    return scroll_top + (scroll_start - scroll_top + y - scroll_top + ring) % ring;
+}
+
+void host_lcd_dump_ppm(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return;
+
+    fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+    for (uint16_t y = 0; y < HEIGHT; y++)
+    {
+        const uint16_t *line = frame[visible_line(y)];
+        for (uint16_t x = 0; x < WIDTH; x++)
+        {
+            uint16_t c = line[x];
+            uint8_t rgb[3] = {
+                (uint8_t)((c >> 11) << 3 | (c >> 13)),
+                (uint8_t)(((c >> 5) & 0x3F) << 2 | ((c >> 9) & 0x03)),
+                (uint8_t)((c & 0x1F) << 3 | ((c >> 2) & 0x07)),
+            };
+            fwrite(rgb, 1, sizeof(rgb), file);
+        }
+    }
+    fclose(file);
+}
@@ -0,0 +1,222 @@
+//
+//  Host (Linux) stand-in for the Pico SDK
+//
+//  The runcpm-host target compiles the firmware sources unchanged against this
+//  header. Every SDK header the drivers include (pico/multicore.h, hardware/spi.h,
+//  ...) forwards here. Time comes from the monotonic clock, repeating timers run
+//  on a background thread, "disabling interrupts" takes a lock shared with that
+//  thread, and the LCD SPI bus feeds an ST7789 frame memory model (lcd_host.c).
+//
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef EFTYPE
+#define EFTYPE EINVAL // newlib only: "inappropriate file type or format"
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((b) < (a) ? (b) : (a))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#endif
+
+// Return codes
+#define PICO_OK             (0)
+#define PICO_ERROR_NONE     (0)
+#define PICO_ERROR_TIMEOUT  (-1)
+#define PICO_ERROR_GENERIC  (-2)
+#define PICO_ERROR_NO_DATA  (-3)
+
+//
+//  Time
+//
+
+typedef uint64_t absolute_time_t;
+
+#define at_the_end_of_time  ((absolute_time_t)INT64_MAX)
+
+uint64_t time_us_64(void);
+absolute_time_t get_absolute_time(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t us);
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline void busy_wait_us_32(uint32_t us) { busy_wait_us(us); }
+static inline void tight_loop_contents(void) {}
+
+//
+//  Repeating timers (serviced by a host thread at 1 ms resolution)
+//
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer
+{
+    int64_t delay_us;
+    uint64_t next_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+    bool active;
+    repeating_timer_t *next;
+};
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out);
+bool cancel_repeating_timer(repeating_timer_t *timer);
+
+static inline bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out)
+{
+    return add_repeating_timer_us((int64_t)delay_ms * 1000, callback, user_data, out);
+}
+
+//
+//  Interrupts
+//
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+//
+//  GPIO
+//
+
+#define GPIO_IN             (false)
+#define GPIO_OUT            (true)
+
+enum gpio_function
+{
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+    GPIO_FUNC_NULL = 0x1f,
+};
+
+void gpio_init(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+static inline void gpio_set_dir(uint gpio, bool out) { (void)gpio; (void)out; }
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) { (void)gpio; (void)fn; }
+static inline void gpio_pull_up(uint gpio) { (void)gpio; }
+static inline void gpio_pull_down(uint gpio) { (void)gpio; }
+
+//
+//  SPI, I2C and UART instances
+//
+
+typedef struct spi_inst { int id; uint8_t data_bits; } spi_inst_t;
+typedef struct i2c_inst { int id; } i2c_inst_t;
+typedef struct uart_inst { int id; } uart_inst_t;
+
+extern spi_inst_t host_spi[2];
+extern i2c_inst_t host_i2c[2];
+extern uart_inst_t host_uart[2];
+
+#define spi0                (&host_spi[0])
+#define spi1                (&host_spi[1])
+#define i2c0                (&host_i2c[0])
+#define i2c1                (&host_i2c[1])
+#define uart0               (&host_uart[0])
+#define uart1               (&host_uart[1])
+#define UART0_IRQ           (20)
+#define UART1_IRQ           (21)
+
+typedef enum { SPI_CPHA_0 = 0, SPI_CPHA_1 = 1 } spi_cpha_t;
+typedef enum { SPI_CPOL_0 = 0, SPI_CPOL_1 = 1 } spi_cpol_t;
+typedef enum { SPI_LSB_FIRST = 0, SPI_MSB_FIRST = 1 } spi_order_t;
+typedef enum { UART_PARITY_NONE, UART_PARITY_EVEN, UART_PARITY_ODD } uart_parity_t;
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_write16_blocking(spi_inst_t *spi, const uint16_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+//
+//  On-board LED
+//
+
+static inline bool status_led_init(void) { return true; }
+static inline void status_led_set_state(bool on) { (void)on; }
+
+//
+//  stdio drivers
+//
+
+typedef struct stdio_driver stdio_driver_t;
+
+struct stdio_driver
+{
+    void (*out_chars)(const char *buf, int len);
+    void (*out_flush)(void);
+    int (*in_chars)(char *buf, int len);
+    void (*set_chars_available_callback)(void (*fn)(void *), void *param);
+    stdio_driver_t *next;
+    bool crlf_enabled;
+    bool last_ended_with_cr;
+};
+
+bool stdio_init_all(void);
+bool stdio_usb_init(void);
+void stdio_set_driver_enabled(stdio_driver_t *driver, bool enabled);
+void stdio_set_translate_crlf(stdio_driver_t *driver, bool translate);
+void stdio_set_chars_available_callback(void (*fn)(void *), void *param);
+void stdio_flush(void);
+int getchar_timeout_us(uint32_t timeout_us);
+int stdio_get_until(char *buf, int len, absolute_time_t until);
+int stdio_put_string(const char *s, int len, bool newline, bool cr_translation);
+
+int host_putchar(int c);
+int host_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+//
+//  newlib on the device routes fopen/stat/access/remove through the
+//  _open/_read/_write/_lseek/_close/_stat/_unlink syscalls in drivers/clib.c,
+//  and printf/putchar through the enabled stdio drivers. Mirror that here so
+//  CP/M file and console I/O reach fat32.c and display.c, not the Linux host.
+//
+
+FILE *host_fopen(const char *path, const char *mode);
+int host_access(const char *path, int mode);
+int host_stat(const char *path, struct stat *buf);
+int host_remove(const char *path);
+
+#undef putchar
+#define putchar(c)          host_putchar(c)
+#define printf(...)         host_printf(__VA_ARGS__)
+#define fopen(p, m)         host_fopen(p, m)
+#define access(p, m)        host_access(p, m)
+#define stat(p, b)          host_stat(p, b)
+#define remove(p)           host_remove(p)
+
+//
+//  Host configuration (environment, see host/pico_host.c)
+//
+
+const char *host_sd_image_path(void);
+const char *host_ppm_path(void);
+const char *host_trace_path(void);
+const char *host_iolog_path(void);
+FILE *host_fopen_native(const char *path, const char *mode); // a Linux file, for STREAMIO
+void host_lcd_dump_ppm(const char *path);
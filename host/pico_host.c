@@ -0,0 +1,714 @@
+//
+//  Host (Linux) implementation of the Pico SDK subset used by RunCPM
+//
+//  Configuration is taken from the environment:
+//      RUNCPM_SD_IMAGE   FAT32 image backing the SD card (default: sdcard.img)
+//      RUNCPM_PPM        if set, the LCD frame is written there as a PPM on exit
+//                        and whenever the process receives SIGUSR1
+//      RUNCPM_TRACE_JSON if set, the timeline trace (drivers/trace.c) records
+//                        from the start and is written there on exit, - for stdout
+//      RUNCPM_IOLOG      if set, every SD sector access is logged from the start
+//                        and the log is written there on exit (fat32_io_capture)
+//
+//  stdin plays the part of the USB serial port (and so of the keyboard),
+//  stdout receives everything the firmware prints, in addition to the
+//  picocalc stdio driver which renders it into the emulated LCD.
+//
+
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+
+#include "pico/stdlib.h"
+#include "trace.h"
+#include "fat32.h"
+
+// The implementation below needs the real C library calls
+#undef putchar
+#undef printf
+#undef fopen
+#undef access
+#undef stat
+#undef remove
+
+// Provided by drivers/clib.c (compiled as part of runcpm.c)
+extern int _open(const char *filename, int oflag, ...);
+extern int _close(int fd);
+extern off_t _lseek(int fd, off_t offset, int whence);
+extern int _read(int fd, char *buffer, int length);
+extern int _write(int fd, const char *buffer, int length);
+extern int _stat(const char *path, struct stat *buf);
+extern int _unlink(const char *filename);
+
+spi_inst_t host_spi[2] = {{0, 8}, {1, 8}};
+i2c_inst_t host_i2c[2] = {{0}, {1}};
+uart_inst_t host_uart[2] = {{0}, {1}};
+
+static pthread_mutex_t irq_lock;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+static struct timespec boot_time;
+
+static volatile sig_atomic_t ppm_requested = 0;
+
+#define HOST_IOLOG_RECORDS (1 << 22) // SD sector accesses kept by RUNCPM_IOLOG, a long session
+
+//
+//  Configuration
+//
+
+const char *host_sd_image_path(void)
+{
+    const char *path = getenv("RUNCPM_SD_IMAGE");
+    return (path && *path) ? path : "sdcard.img";
+}
+
+const char *host_ppm_path(void)
+{
+    const char *path = getenv("RUNCPM_PPM");
+    return (path && *path) ? path : NULL;
+}
+
+const char *host_trace_path(void)
+{
+    const char *path = getenv("RUNCPM_TRACE_JSON");
+    return (path && *path) ? path : NULL;
+}
+
+const char *host_iolog_path(void)
+{
+    const char *path = getenv("RUNCPM_IOLOG");
+    return (path && *path) ? path : NULL;
+}
+
+//
+//  Time
+//
+
+static void host_init_once(void)
+{
+    pthread_mutexattr_t attr;
+
+    clock_gettime(CLOCK_MONOTONIC, &boot_time);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&irq_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+uint64_t time_us_64(void)
+{
+    struct timespec now;
+
+    pthread_once(&host_once, host_init_once);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - boot_time.tv_sec) * 1000000u +
+           (now.tv_nsec - boot_time.tv_nsec) / 1000;
+}
+
+absolute_time_t get_absolute_time(void)
+{
+    return time_us_64();
+}
+
+void busy_wait_us(uint64_t us)
+{
+    struct timespec ts = {(time_t)(us / 1000000u), (long)(us % 1000000u) * 1000};
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+void sleep_us(uint64_t us)
+{
+    fflush(stdout); // about to idle, let the terminal catch up
+    busy_wait_us(us);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t)ms * 1000);
+}
+
+//
+//  Interrupts
+//
+//  There is a single "interrupt context": the timer thread. Disabling
+//  interrupts takes the lock it holds while running callbacks.
+//
+
+uint32_t save_and_disable_interrupts(void)
+{
+    pthread_once(&host_once, host_init_once);
+    pthread_mutex_lock(&irq_lock);
+    return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    (void)status;
+    pthread_mutex_unlock(&irq_lock);
+}
+
+//
+//  Repeating timers
+//
+
+static repeating_timer_t *timers = NULL;
+static pthread_t timer_thread;
+static bool timer_thread_started = false;
+
+static void *timer_thread_main(void *arg)
+{
+    uint64_t last_flush = 0;
+
+    (void)arg;
+    while (true)
+    {
+        busy_wait_us(1000);
+        uint64_t now = time_us_64();
+
+        save_and_disable_interrupts();
+        for (repeating_timer_t *t = timers; t; t = t->next)
+        {
+            if (!t->active || now < t->next_us)
+                continue;
+            if (!t->callback(t))
+            {
+                t->active = false;
+                continue;
+            }
+            uint64_t period = (uint64_t)(t->delay_us < 0 ? -t->delay_us : t->delay_us);
+            t->next_us = (t->delay_us < 0 ? time_us_64() : t->next_us) + period;
+        }
+        if (ppm_requested)
+        {
+            ppm_requested = 0;
+            host_lcd_dump_ppm(host_ppm_path() ? host_ppm_path() : "runcpm.ppm");
+        }
+        restore_interrupts(0);
+
+        if (now - last_flush >= 50000)
+        {
+            fflush(stdout);
+            last_flush = now;
+        }
+    }
+    return NULL;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out)
+{
+    if (!delay_us)
+        delay_us = 1;
+
+    save_and_disable_interrupts();
+    out->delay_us = delay_us;
+    out->next_us = time_us_64() + (uint64_t)(delay_us < 0 ? -delay_us : delay_us);
+    out->callback = callback;
+    out->user_data = user_data;
+    if (!out->active)
+    {
+        out->next = timers;
+        timers = out;
+    }
+    out->active = true;
+    if (!timer_thread_started)
+    {
+        timer_thread_started = !pthread_create(&timer_thread, NULL, timer_thread_main, NULL);
+    }
+    restore_interrupts(0);
+    return true;
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer)
+{
+    bool was_active;
+
+    save_and_disable_interrupts();
+    was_active = timer->active;
+    timer->active = false;
+    restore_interrupts(0);
+    return was_active;
+}
+
+//
+//  GPIO
+//
+
+static bool gpio_state[32];
+
+void gpio_init(uint gpio)
+{
+    if (gpio < 32)
+        gpio_state[gpio] = false;
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    if (gpio < 32)
+        gpio_state[gpio] = value;
+}
+
+bool gpio_get(uint gpio)
+{
+    return gpio < 32 ? gpio_state[gpio] : false;
+}
+
+//
+//  USB serial stand-in: a thread reads stdin into a ring buffer and
+//  signals the chars-available callback once per byte, as the SDK does.
+//
+
+#define STDIN_BUFFER_SIZE (4096)
+
+static uint8_t stdin_buffer[STDIN_BUFFER_SIZE];
+static uint32_t stdin_head = 0;
+static uint32_t stdin_tail = 0;
+static bool stdin_eof = false;
+static pthread_mutex_t stdin_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stdin_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t stdin_thread;
+static bool stdin_started = false;
+
+static void (*chars_available_callback)(void *) = NULL;
+static void *chars_available_param = NULL;
+
+static struct termios saved_termios;
+static bool termios_saved = false;
+
+static void *stdin_thread_main(void *arg)
+{
+    uint8_t buf[256];
+    uint8_t last = 0;
+    ssize_t n;
+
+    (void)arg;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t ch = buf[i];
+            if (ch == '\n')
+            {
+                if (last == '\r')
+                {
+                    last = ch;
+                    continue; // CR LF counts as one Return
+                }
+                ch = '\r';    // a terminal's Enter key sends CR
+            }
+            last = buf[i];
+
+            pthread_mutex_lock(&stdin_lock);
+            while (stdin_head - stdin_tail == STDIN_BUFFER_SIZE)
+                pthread_cond_wait(&stdin_cond, &stdin_lock);
+            stdin_buffer[stdin_head++ % STDIN_BUFFER_SIZE] = ch;
+            pthread_cond_broadcast(&stdin_cond);
+            pthread_mutex_unlock(&stdin_lock);
+
+            if (chars_available_callback)
+            {
+                save_and_disable_interrupts(); // delivered in "IRQ" context
+                chars_available_callback(chars_available_param);
+                restore_interrupts(0);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&stdin_lock);
+    stdin_eof = true;
+    pthread_cond_broadcast(&stdin_cond);
+    pthread_mutex_unlock(&stdin_lock);
+    return NULL;
+}
+
+static void restore_terminal(void)
+{
+    if (termios_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+bool stdio_usb_init(void)
+{
+    if (stdin_started)
+        return true;
+
+    if (isatty(STDIN_FILENO) && !tcgetattr(STDIN_FILENO, &saved_termios))
+    {
+        struct termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+        raw.c_iflag &= ~(IXON | ICRNL | INLCR);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        termios_saved = !tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    stdin_started = !pthread_create(&stdin_thread, NULL, stdin_thread_main, NULL);
+    return stdin_started;
+}
+
+void stdio_set_chars_available_callback(void (*fn)(void *), void *param)
+{
+    uint32_t pending;
+
+    save_and_disable_interrupts();
+    pthread_mutex_lock(&stdin_lock);
+    chars_available_callback = fn;
+    chars_available_param = param;
+    pending = stdin_head - stdin_tail;
+    pthread_mutex_unlock(&stdin_lock);
+
+    // Announce input that arrived before anyone was listening
+    while (fn && pending--)
+        fn(param);
+    restore_interrupts(0);
+}
+
+int getchar_timeout_us(uint32_t timeout_us)
+{
+    int ch = PICO_ERROR_TIMEOUT;
+    struct timespec deadline;
+
+    fflush(stdout);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_us / 1000000u;
+    deadline.tv_nsec += (long)(timeout_us % 1000000u) * 1000;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&stdin_lock);
+    while (stdin_head == stdin_tail && !stdin_eof)
+    {
+        if (pthread_cond_timedwait(&stdin_cond, &stdin_lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    if (stdin_head != stdin_tail)
+    {
+        ch = stdin_buffer[stdin_tail++ % STDIN_BUFFER_SIZE];
+        pthread_cond_broadcast(&stdin_cond);
+    }
+    pthread_mutex_unlock(&stdin_lock);
+    return ch;
+}
+
+int stdio_get_until(char *buf, int len, absolute_time_t until)
+{
+    int n = 0;
+
+    while (n < len)
+    {
+        int ch = getchar_timeout_us(n ? 0 : 10000);
+        if (ch >= 0)
+        {
+            buf[n++] = (char)ch;
+            continue;
+        }
+        if (n || time_us_64() >= until)
+            break;
+    }
+    return n ? n : PICO_ERROR_TIMEOUT;
+}
+
+//
+//  stdio output
+//
+
+static stdio_driver_t *drivers = NULL;
+
+bool stdio_init_all(void)
+{
+    pthread_once(&host_once, host_init_once);
+    return true;
+}
+
+void stdio_set_driver_enabled(stdio_driver_t *driver, bool enabled)
+{
+    stdio_driver_t **p = &drivers;
+
+    while (*p && *p != driver)
+        p = &(*p)->next;
+    if (enabled && !*p)
+    {
+        driver->next = NULL;
+        *p = driver;
+    }
+    else if (!enabled && *p)
+    {
+        *p = driver->next;
+    }
+}
+
+void stdio_set_translate_crlf(stdio_driver_t *driver, bool translate)
+{
+    driver->crlf_enabled = translate;
+}
+
+void stdio_flush(void)
+{
+    for (stdio_driver_t *d = drivers; d; d = d->next)
+    {
+        if (d->out_flush)
+            d->out_flush();
+    }
+    fflush(stdout);
+}
+
+static void driver_out(stdio_driver_t *d, const char *s, int len, bool cr_translation)
+{
+    if (!d->crlf_enabled || !cr_translation)
+    {
+        d->out_chars(s, len);
+        return;
+    }
+
+    int start = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (s[i] == '\n' && !(i ? s[i - 1] == '\r' : d->last_ended_with_cr))
+        {
+            if (i > start)
+                d->out_chars(s + start, i - start);
+            d->out_chars("\r", 1);
+            start = i;
+        }
+    }
+    if (len > start)
+        d->out_chars(s + start, len - start);
+    d->last_ended_with_cr = len && s[len - 1] == '\r';
+}
+
+int stdio_put_string(const char *s, int len, bool newline, bool cr_translation)
+{
+    if (len < 0)
+        len = (int)strlen(s);
+
+    for (stdio_driver_t *d = drivers; d; d = d->next)
+    {
+        driver_out(d, s, len, cr_translation);
+        if (newline)
+            driver_out(d, "\n", 1, cr_translation);
+    }
+    fwrite(s, 1, len, stdout);
+    if (newline)
+        fputc('\n', stdout);
+    return len;
+}
+
+int host_putchar(int c)
+{
+    char ch = (char)c;
+    stdio_put_string(&ch, 1, false, true);
+    return (uint8_t)c;
+}
+
+int host_printf(const char *format, ...)
+{
+    char stack_buf[256];
+    char *buf = stack_buf;
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(stack_buf, sizeof(stack_buf), format, args);
+    va_end(args);
+    if (len < 0)
+        return len;
+
+    if ((size_t)len >= sizeof(stack_buf))
+    {
+        buf = malloc(len + 1);
+        if (!buf)
+            return -1;
+        va_start(args, format);
+        vsnprintf(buf, len + 1, format, args);
+        va_end(args);
+    }
+    stdio_put_string(buf, len, false, true);
+    if (buf != stack_buf)
+        free(buf);
+    return len;
+}
+
+//
+//  File system calls routed through drivers/clib.c
+//
+
+// A file of host_fopen: its clib descriptor and its stdio buffer, of newlib's
+// BUFSIZ on the device. setvbuf without a buffer keeps the 8 KB one of glibc,
+// which reads and seeks in other blocks than the device does
+typedef struct
+{
+    int fd;
+    char buffer[1024];
+} host_file_t;
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size)
+{
+    int result = _read(((host_file_t *)cookie)->fd, buf, (int)size);
+    return result < 0 ? -1 : result;
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size)
+{
+    int result = _write(((host_file_t *)cookie)->fd, buf, (int)size);
+    return result < 0 ? 0 : result;
+}
+
+static int cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+    off_t result = _lseek(((host_file_t *)cookie)->fd, (off_t)*offset, whence);
+    if (result < 0)
+        return -1;
+    *offset = result;
+    return 0;
+}
+
+static int cookie_close(void *cookie)
+{
+    int result = _close(((host_file_t *)cookie)->fd);
+    free(cookie);
+    return result;
+}
+
+FILE *host_fopen(const char *path, const char *mode)
+{
+    static const cookie_io_functions_t io = {cookie_read, cookie_write, cookie_seek, cookie_close};
+    int oflag;
+    FILE *file;
+
+    switch (mode[0])
+    {
+    case 'r':
+        oflag = strchr(mode, '+') ? O_RDWR : O_RDONLY;
+        break;
+    case 'w':
+        oflag = (strchr(mode, '+') ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        oflag = (strchr(mode, '+') ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+        break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    host_file_t *cookie = malloc(sizeof(host_file_t));
+    if (!cookie)
+        return NULL;
+    cookie->fd = _open(path, oflag);
+    if (cookie->fd < 0)
+    {
+        free(cookie);
+        return NULL;
+    }
+
+    file = fopencookie(cookie, mode, io);
+    if (!file)
+    {
+        _close(cookie->fd);
+        free(cookie);
+        return NULL;
+    }
+    setvbuf(file, cookie->buffer, _IOFBF, sizeof(cookie->buffer));
+    return file;
+}
+
+FILE *host_fopen_native(const char *path, const char *mode)
+{
+    return fopen(path, mode);
+}
+
+int host_stat(const char *path, struct stat *buf)
+{
+    memset(buf, 0, sizeof(*buf));
+    return _stat(path, buf);
+}
+
+int host_access(const char *path, int mode)
+{
+    struct stat st;
+
+    if (host_stat(path, &st))
+        return -1;
+    if ((mode & W_OK) && !S_ISDIR(st.st_mode) && !(st.st_mode & S_IWUSR))
+    {
+        errno = EACCES;
+        return -1;
+    }
+    return 0;
+}
+
+int host_remove(const char *path)
+{
+    return _unlink(path);
+}
+
+//
+//  Process setup and teardown
+//
+
+static void on_sigusr1(int sig)
+{
+    (void)sig;
+    ppm_requested = 1;
+}
+
+static void host_exit(void)
+{
+    fflush(stdout);
+    restore_terminal();
+    if (host_ppm_path())
+    {
+        save_and_disable_interrupts();
+        host_lcd_dump_ppm(host_ppm_path());
+        restore_interrupts(0);
+    }
+    if (host_trace_path())
+    {
+        bool to_stdout = strcmp(host_trace_path(), "-") == 0;
+        FILE *file = to_stdout ? stdout : fopen(host_trace_path(), "w");
+
+        if (file)
+        {
+            trace_write_json(file);
+            if (!to_stdout)
+                fclose(file);
+        }
+    }
+    if (host_iolog_path())
+    {
+        FILE *file = fopen(host_iolog_path(), "w");
+
+        if (file)
+        {
+            fat32_io_write_log(file);
+            fclose(file);
+        }
+    }
+}
+
+__attribute__((constructor)) static void host_startup(void)
+{
+    pthread_once(&host_once, host_init_once);
+    signal(SIGUSR1, on_sigusr1);
+    atexit(host_exit);
+    if (host_trace_path())
+        trace_start();
+    if (host_iolog_path())
+    {
+        // Allocated only when asked for, about 100 MB on a 64-bit host
+        fat32_io_record_t *log = malloc(HOST_IOLOG_RECORDS * sizeof(fat32_io_record_t));
+
+        if (log)
+            fat32_io_capture(log, HOST_IOLOG_RECORDS);
+    }
+}
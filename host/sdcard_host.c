@@ -0,0 +1,142 @@
+//
+//  Host SD card driver
+//
+//  Implements the block interface of drivers/sdcard.h on top of a disk image
+//  file (RUNCPM_SD_IMAGE, default sdcard.img). The image may be a bare FAT32
+//  volume or a partitioned card dump; fat32.c sorts that out as on the device.
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pico/stdlib.h"
+
+#include "sdcard.h"
+#include "trace.h"
+
+static int image_fd = -1;
+static bool sd_initialised = false;
+
+bool sd_card_present(void)
+{
+    return image_fd >= 0;
+}
+
+bool sd_is_sdhc(void)
+{
+    return true; // block addressing, like every card the fat32 driver mounts
+}
+
+static sd_error_t image_read(uint32_t start_block, uint32_t num_blocks, uint8_t *buffer)
+{
+    size_t len = (size_t)num_blocks * SD_BLOCK_SIZE;
+
+    if (image_fd < 0)
+    {
+        return SD_ERROR_NO_CARD;
+    }
+    ssize_t n = pread(image_fd, buffer, len, (off_t)start_block * SD_BLOCK_SIZE);
+    if (n < 0)
+    {
+        return SD_ERROR_READ_FAILED;
+    }
+    if ((size_t)n < len)
+    {
+        memset(buffer + n, 0, len - n); // past the end of a sparse image
+    }
+    return SD_OK;
+}
+
+static sd_error_t image_write(uint32_t start_block, uint32_t num_blocks, const uint8_t *buffer)
+{
+    size_t len = (size_t)num_blocks * SD_BLOCK_SIZE;
+
+    if (image_fd < 0)
+    {
+        return SD_ERROR_NO_CARD;
+    }
+    if (pwrite(image_fd, buffer, len, (off_t)start_block * SD_BLOCK_SIZE) != (ssize_t)len)
+    {
+        return SD_ERROR_WRITE_FAILED;
+    }
+    return SD_OK;
+}
+
+sd_error_t sd_read_block(uint32_t block, uint8_t *buffer)
+{
+    return sd_read_blocks(block, 1, buffer);
+}
+
+sd_error_t sd_write_block(uint32_t block, const uint8_t *buffer)
+{
+    return sd_write_blocks(block, 1, buffer);
+}
+
+sd_error_t sd_read_blocks(uint32_t start_block, uint32_t num_blocks, uint8_t *buffer)
+{
+    uint32_t start = trace_begin();
+    sd_error_t result = image_read(start_block, num_blocks, buffer);
+
+    trace_end(TRACE_SD_READ, start_block, start);
+    return result;
+}
+
+sd_error_t sd_write_blocks(uint32_t start_block, uint32_t num_blocks, const uint8_t *buffer)
+{
+    uint32_t start = trace_begin();
+    sd_error_t result = image_write(start_block, num_blocks, buffer);
+
+    trace_end(TRACE_SD_WRITE, start_block, start);
+    return result;
+}
+
+const char *sd_error_string(sd_error_t error)
+{
+    switch (error)
+    {
+    case SD_OK:
+        return "Success";
+    case SD_ERROR_NO_CARD:
+        return "No SD card present";
+    case SD_ERROR_INIT_FAILED:
+        return "SD card initialization failed";
+    case SD_ERROR_READ_FAILED:
+        return "Read operation failed";
+    case SD_ERROR_WRITE_FAILED:
+        return "Write operation failed";
+    default:
+        return "Unknown error";
+    }
+}
+
+sd_error_t sd_card_init(void)
+{
+    return image_fd >= 0 ? SD_OK : SD_ERROR_NO_CARD;
+}
+
+static void sd_close_image(void)
+{
+    if (image_fd >= 0)
+    {
+        fsync(image_fd);
+        close(image_fd);
+        image_fd = -1;
+    }
+}
+
+void sd_init(void)
+{
+    if (sd_initialised)
+    {
+        return;
+    }
+
+    image_fd = open(host_sd_image_path(), O_RDWR);
+    if (image_fd < 0)
+    {
+        fprintf(stderr, "runcpm-host: cannot open SD image %s: %s\n", host_sd_image_path(), strerror(errno));
+    }
+    atexit(sd_close_image);
+
+    sd_initialised = true;
+}
@@ -0,0 +1,155 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/* BDOS/BIOS call profiler
+
+   For each BDOS and BIOS function it keeps the number of calls, the time spent
+   in microseconds and a log2 histogram of the call latency: bucket 0 counts
+   calls under 1us, bucket b calls from 2^(b-1) up to 2^b us, the last bucket
+   everything slower. Collection is off at power up; it is switched on and off
+   with the PROF command of the internal CCP or the host BDOS call (host.h).
+   While off it costs one test per call.
+*/
+
+#define PROF_BUCKETS 16
+#define PROF_BDOS_SLOTS 86 // 0-49: CP/M 2.2/3 calls, 50-84: RunCPM calls 220-254, 85: any other
+#define PROF_BIOS_SLOTS 33 // Function number / 3
+
+typedef struct {
+    uint32 calls;
+    uint64 us;
+    uint32 hist[PROF_BUCKETS];
+} ProfEntry;
+
+static uint8 profEnabled = FALSE;
+static ProfEntry profBdos[PROF_BDOS_SLOTS];
+static ProfEntry profBios[PROF_BIOS_SLOTS];
+
+static const char *profBdosNames[50] = {
+    "P_TERMCPM", "C_READ", "C_WRITE", "A_READ", "A_WRITE", "L_WRITE", "C_RAWIO", "A_STATIN",
+    "A_STATOUT", "C_WRITESTR", "C_READSTR", "C_STAT", "S_BDOSVER", "DRV_ALLRESET", "DRV_SET",
+    "F_OPEN", "F_CLOSE", "F_SFIRST", "F_SNEXT", "F_DELETE", "F_READ", "F_WRITE", "F_MAKE",
+    "F_RENAME", "DRV_LOGINVEC", "DRV_GET", "F_DMAOFF", "DRV_ALLOCVEC", "DRV_SETRO", "DRV_ROVEC",
+    "F_ATTRIB", "DRV_PDB", "F_USERNUM", "F_READRAND", "F_WRITERAND", "F_SIZE", "F_RANDREC",
+    "DRV_RESET", "DRV_ACCESS", "DRV_FREE", "F_WRITEZF", "F_TESTWRITE", "F_LOCKFILE",
+    "F_UNLOCKFILE", "F_MULTISEC", "F_ERRMODE", "DRV_SPACE", "P_CHAIN", "DRV_FLUSH", "S_SCB"};
+
+static const char *profBiosNames[PROF_BIOS_SLOTS] = {
+    "B_BOOT", "B_WBOOT", "B_CONST", "B_CONIN", "B_CONOUT", "B_LIST", "B_AUXOUT", "B_READER",
+    "B_HOME", "B_SELDSK", "B_SETTRK", "B_SETSEC", "B_SETDMA", "B_READ", "B_WRITE", "B_LISTST",
+    "B_SECTRAN", "B_CONOST", "B_AUXIST", "B_AUXOST", "B_DEVTBL", "B_DEVINI", "B_DRVTBL",
+    "B_MULTIO", "B_FLUSH", "B_MOVE", "B_TIME", "B_SELMEM", "B_SETBNK", "B_XMOVE", "B_USERF",
+    "B_RESERV1", "B_RESERV2"};
+
+// Maps a BDOS function number to its profiler slot
+static inline uint8 _profBdosSlot(uint8 function) {
+    if (function < 50)
+        return function;
+    if (function >= 220 && function <= 254)
+        return 50 + function - 220;
+    return PROF_BDOS_SLOTS - 1;
+}
+
+// Returns the profiler entry of a BDOS (isBios FALSE) or BIOS function, NULL if none
+ProfEntry *_profEntry(uint8 isBios, uint8 function) {
+    if (isBios)
+        return (function / 3 < PROF_BIOS_SLOTS) ? &profBios[function / 3] : NULL;
+    return &profBdos[_profBdosSlot(function)];
+}
+
+// Starts timing a call, returns 0 if the profiler is off
+static inline uint64 _profStart(void) {
+    return profEnabled ? time_us_64() : 0;
+}
+
+// Accounts a call started at start (from _profStart)
+static inline void _profRecord(ProfEntry *entry, uint64 start) {
+    uint32 us, bucket = 0;
+
+    if (!start || !entry)
+        return;
+    us = (uint32)(time_us_64() - start);
+    if (us)
+        bucket = 32 - __builtin_clz(us);
+    if (bucket >= PROF_BUCKETS)
+        bucket = PROF_BUCKETS - 1;
+    entry->calls++;
+    entry->us += us;
+    entry->hist[bucket]++;
+}
+
+void _profClear(void) {
+    memset(profBdos, 0, sizeof(profBdos));
+    memset(profBios, 0, sizeof(profBios));
+}
+
+// Prints one entry, with the non empty histogram buckets on a second line
+void _profPrintEntry(uint8 isBios, uint8 slot) {
+    ProfEntry *e = isBios ? &profBios[slot] : &profBdos[slot];
+    char line[96];
+    const char *name;
+    char number[4] = "  -";
+
+    if (isBios) {
+        sprintf(number, "%3u", slot * 3);
+        name = profBiosNames[slot];
+    } else if (slot < 50) {
+        sprintf(number, "%3u", slot);
+        name = profBdosNames[slot];
+    } else if (slot < PROF_BDOS_SLOTS - 1) {
+        sprintf(number, "%3u", slot - 50 + 220);
+        name = "RunCPM";
+    } else {
+        name = "other";
+    }
+    sprintf(line, "%s %s %-13s calls %-8lu total %-10lluus avg %lluus\r\n",
+            isBios ? "BIOS" : "BDOS", number, name, (unsigned long)e->calls, e->us, e->us / e->calls);
+    _puts(line);
+    _puts("              ");
+    for (uint8 b = 0; b < PROF_BUCKETS; ++b) {
+        if (!e->hist[b])
+            continue;
+        if (b == 0)
+            sprintf(line, " <1:%lu", (unsigned long)e->hist[b]);
+        else if (b == PROF_BUCKETS - 1)
+            sprintf(line, " >=%lu:%lu", 1UL << (b - 1), (unsigned long)e->hist[b]);
+        else
+            sprintf(line, " <%lu:%lu", 1UL << b, (unsigned long)e->hist[b]);
+        _puts(line);
+    }
+    _puts("\r\n");
+}
+
+// Prints every function called, the most time consuming first
+void _profReport(void) {
+    uint8 done[PROF_BDOS_SLOTS + PROF_BIOS_SLOTS] = {0};
+    uint8 any = FALSE;
+
+    _puts("Profiler is ");
+    _puts(profEnabled ? "on" : "off");
+    _puts(", times in us\r\n");
+    while (TRUE) {
+        int best = -1;
+        uint64 bestUs = 0;
+
+        for (int i = 0; i < PROF_BDOS_SLOTS + PROF_BIOS_SLOTS; ++i) {
+            ProfEntry *e = (i < PROF_BDOS_SLOTS) ? &profBdos[i] : &profBios[i - PROF_BDOS_SLOTS];
+            if (!done[i] && e->calls && (best < 0 || e->us > bestUs)) {
+                best = i;
+                bestUs = e->us;
+            }
+        }
+        if (best < 0)
+            break;
+        done[best] = TRUE;
+        any = TRUE;
+        if (best < PROF_BDOS_SLOTS)
+            _profPrintEntry(FALSE, best);
+        else
+            _profPrintEntry(TRUE, best - PROF_BDOS_SLOTS);
+    }
+    if (!any)
+        _puts("No calls recorded\r\n");
+}
+
+#endif // PROFILER_H
@@ -0,0 +1,73 @@
+# RAM budget profiles
+#
+# RUNCPM_RAM_PROFILE sizes the buffers of the optional features together and
+# sets how much static RAM (.data and .bss) the firmware may take. What is left
+# is heap and stack. After each link host/bench/ramreport.py checks the map
+# file against the budget and fails the build when it is exceeded. The ramreport
+# target prints the breakdown by subsystem.
+#
+#   minimal          RP2040, smallest buffers, the most heap and stack left
+#   rp2040-balanced  RP2040 (264 KB), room for the trace recorder or the sampler
+#   rp2350-max       RP2350 (520 KB), every buffer at its largest
+#
+# Any value can be overridden on the command line, e.g. -DRUNCPM_TRACE_CAPACITY=4096.
+
+set(RUNCPM_RAM_PROFILE rp2040-balanced CACHE STRING "RAM budget profile: minimal, rp2040-balanced or rp2350-max")
+set_property(CACHE RUNCPM_RAM_PROFILE PROPERTY STRINGS minimal rp2040-balanced rp2350-max)
+
+#                    budget  trace  IOLOG  files  keys  PC sampler shift  snapshot chunk  SUBMIT  disk image cache  FAT sectors
+if (RUNCPM_RAM_PROFILE STREQUAL "minimal")
+    set(RAM_PROFILE  196608  512    256    8      16    6                 512             1024    2                 2)
+elseif (RUNCPM_RAM_PROFILE STREQUAL "rp2040-balanced")
+    set(RAM_PROFILE  245760  2048   2048   16     32    4                 4096            2048    4                 4)
+elseif (RUNCPM_RAM_PROFILE STREQUAL "rp2350-max")
+    set(RAM_PROFILE  491520  16384  16384  32     64    2                 16384           8192    32                16)
+else()
+    message(FATAL_ERROR "Unknown RUNCPM_RAM_PROFILE ${RUNCPM_RAM_PROFILE}")
+endif()
+
+set(RAM_PROFILE_NAMES BUDGET TRACE_CAPACITY IOLOG_CAPACITY MAX_OPEN_FILES KBD_BUFFER_SIZE PCS_SHIFT SNAP_CHUNK SUBMIT_SIZE DSK_CACHE FAT32_FAT_BUFFERS)
+foreach (index RANGE 9)
+    list(GET RAM_PROFILE_NAMES ${index} name)
+    list(GET RAM_PROFILE ${index} value)
+    if (NOT DEFINED RUNCPM_${name})
+        set(RUNCPM_${name} ${value})
+    endif()
+endforeach()
+
+set(RUNCPM_RAM_REPORT ${CMAKE_CURRENT_LIST_DIR}/host/bench/ramreport.py)
+find_package(Python3 COMPONENTS Interpreter)
+
+# Adds the ramreport target, the breakdown of the static RAM in the map file of target
+function(runcpm_ram_report target map)
+    if (Python3_Interpreter_FOUND)
+        add_custom_target(ramreport
+                COMMAND ${Python3_EXECUTABLE} ${RUNCPM_RAM_REPORT} ${map} --top 20 ${ARGN}
+                DEPENDS ${target}
+                VERBATIM)
+    endif()
+endfunction()
+
+# Sizes the buffers of target from the profile, and checks its static RAM against the budget after each link
+function(runcpm_ram_budget target map)
+    target_compile_definitions(${target} PRIVATE
+            TRACE_CAPACITY=${RUNCPM_TRACE_CAPACITY}
+            IOLOG_CAPACITY=${RUNCPM_IOLOG_CAPACITY}
+            MAX_OPEN_FILES=${RUNCPM_MAX_OPEN_FILES}
+            KBD_BUFFER_SIZE=${RUNCPM_KBD_BUFFER_SIZE}
+            PCS_SHIFT=${RUNCPM_PCS_SHIFT}
+            SNAP_CHUNK=${RUNCPM_SNAP_CHUNK}
+            SUBMIT_SIZE=${RUNCPM_SUBMIT_SIZE}
+            DSK_CACHE=${RUNCPM_DSK_CACHE}
+            FAT32_FAT_BUFFERS=${RUNCPM_FAT32_FAT_BUFFERS}
+            )
+    if (NOT Python3_Interpreter_FOUND)
+        message(WARNING "Python 3 not found, the RAM budget of ${target} is not checked")
+        return()
+    endif()
+    add_custom_command(TARGET ${target} POST_BUILD
+            COMMAND ${Python3_EXECUTABLE} ${RUNCPM_RAM_REPORT} ${map} --summary
+                    --budget ${RUNCPM_BUDGET} --profile ${RUNCPM_RAM_PROFILE} --remove $<TARGET_FILE:${target}>
+            VERBATIM)
+    runcpm_ram_report(${target} ${map} --budget ${RUNCPM_BUDGET} --profile ${RUNCPM_RAM_PROFILE})
+endfunction()
@@ -0,0 +1,35 @@
+# Flash drive
+#
+# The .COM files of RUNCPM_ROMDISK_DIR are packed into the firmware by
+# tools/romdisk.py and show as the read-only drive RUNCPM_ROMDISK_DRIVE,
+# in every user area. A program on it loads with a single copy from flash, no
+# SD card access. The drive is left out unless RUNCPM_ROMDISK_DIR is given.
+# It hides the folder of its letter on the card, whatever is in it, so the
+# letter should be one the card does not use.
+#
+# e.g. -DRUNCPM_ROMDISK_DIR=~/cpm/tools for PIP, STAT, SUBMIT, ED and ASM.
+
+set(RUNCPM_ROMDISK_DIR "" CACHE PATH "Directory of the .COM files of the flash drive, empty for none")
+set(RUNCPM_ROMDISK_DRIVE P CACHE STRING "Drive letter of the flash drive")
+
+set(RUNCPM_ROMDISK_TOOL ${CMAKE_CURRENT_LIST_DIR}/tools/romdisk.py)
+find_package(Python3 COMPONENTS Interpreter)
+
+# Adds the flash drive to target
+function(runcpm_romdisk target)
+    if (NOT RUNCPM_ROMDISK_DIR)
+        return()
+    endif()
+    if (NOT Python3_Interpreter_FOUND)
+        message(WARNING "Python 3 not found, ${target} has no flash drive")
+        return()
+    endif()
+    file(GLOB files CONFIGURE_DEPENDS ${RUNCPM_ROMDISK_DIR}/*.COM ${RUNCPM_ROMDISK_DIR}/*.com)
+    set(source ${CMAKE_CURRENT_BINARY_DIR}/romdisk.c)
+    add_custom_command(OUTPUT ${source}
+            COMMAND ${Python3_EXECUTABLE} ${RUNCPM_ROMDISK_TOOL} --out ${source} ${files}
+            DEPENDS ${RUNCPM_ROMDISK_TOOL} ${files}
+            VERBATIM)
+    target_sources(${target} PRIVATE ${source})
+    target_compile_definitions(${target} PRIVATE ROMDISK='${RUNCPM_ROMDISK_DRIVE}')
+endfunction()
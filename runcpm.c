@@ -45,27 +45,26 @@ int lst_open = FALSE;
     #include "ram.h"     // ram.h - Implements the RAM
     #include "console.h" // console.h - Defines all the console abstraction functions
     #include CPU         // cpu.h - Implements the emulated CPU
+    #ifdef DISKIMAGE
+        #include "diskimg.h" // diskimg.h - Drives kept in CP/M disk images
+    #endif
     #include "disk.h"    // disk.h - Defines all the disk access abstraction functions
+    #include "profiler.h" // profiler.h - BDOS/BIOS call profiler
+    #ifdef PCSAMPLE
+        #include "sampler.h" // sampler.h - Guest program counter sampler
+    #endif
+    #include "boot.h"    // boot.h - Boot timeline and cached clock estimate
     #include "host.h"    // host.h - Custom host-specific BDOS call
     #include "cpm.h"     // cpm.h - Defines the CPM structures and calls
     #ifdef CCP_INTERNAL
         #include "ccp.h" // ccp.h - Defines a simple internal CCP
     #endif
-
-int main(void) {
-    uint8 blevel ;
-
-    #ifdef DEBUGLOG
-    _sys_deletefile((uint8 *)LogName);
+    #ifdef HIBERNATE
+        #include "snapshot.h" // snapshot.h - Saves and resumes the whole machine
     #endif
 
-    _HardwareInit();
-
-    #ifdef STREAMIO
-    _host_init(argc, &argv[0]);
-    _streamioInit();
-    #endif
-    _console_init();
+// Clears the screen and shows the banner, the CPU speed and the battery level
+void _banner(void) {
     _clrscr();
      _puts("CP/M Emulator v" VERSION "\e[0m by \e[97mMarcelo  Dantas\e[0m\r\n");
      _puts("Picocalc-text-framework v0.14 by \e[97mBlair Leduc\e[0m\r\n");
@@ -96,17 +95,41 @@ int main(void) {
     _puts("CPU is ");
     _puts(CPU_IS);
     _puts("\r\n");
-    Z80estimateClock();
+    _bootClock(FALSE);
+    _bootMark("clock");
 #ifdef INT_HANDOFF
     _puts("BIOS/BDOS using interrupt handoff method\r\n");
 #else
     _puts("BIOS/BDOS using legacy IN/OUT call method\r\n");
 #endif
+    _bootBattery();
+}
 
-    blevel = sb_read_battery() ;
-    printf("Battery Level: %d%%", blevel&0x7f) ;
-    if (blevel & 0x80) _puts(" (charging)") ;
-    _puts("\r\n") ;
+#ifdef STREAMIO
+int main(int argc, char *argv[]) {
+#else
+int main(void) {
+#endif
+    #ifdef DEBUGLOG
+    _sys_deletefile((uint8 *)LogName);
+    #endif
+
+    _HardwareInit();
+    _bootMark("hardware");
+
+    #ifdef STREAMIO
+    _host_init(argc, &argv[0]);
+    _streamioInit();
+    atexit(_SyncDisksAtExit); // Before the card image is closed
+    #endif
+    _console_init();
+    #ifdef HIBERNATE
+    snapResumed = _sys_exists((uint8 *)SNAPSHOT); // The snapshot has the screen as it was
+    _bootMark("card");
+    if (!snapResumed)
+    #endif
+        _banner();
+    _bootMark("banner");
 
     #ifdef ABDOS
     _PatchBIOS();
@@ -164,6 +187,11 @@ int main(void) {
     }
 
     _puts("\r\n");
+    _SyncDisks(); // Before the power goes
+    #ifdef HIBERNATE
+    if (snapHibernated && sb_is_power_off_supported())
+        sb_write_power_off_delay(1); // The southbridge switches the PicoCalc off
+    #endif
     _console_reset();
     #ifdef STREAMIO
     _streamioReset();
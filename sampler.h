@@ -0,0 +1,108 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+/* Guest program counter sampler, run by the SAMPLE command of the internal CCP
+
+   While on, every pcsPeriod emulated instructions Z80run counts the address of
+   the instruction about to run in a histogram of 16 byte buckets (PCS_SHIFT),
+   and remembers it as the bucket's sample address. The report lists the
+   busiest buckets with the instruction at that address disassembled (from the
+   memory as it is when the report is printed, so run it right after the
+   program being profiled). The whole histogram can be saved to a file, one
+   "start,end,samples,address" line per non empty bucket.
+*/
+
+#define PCS_DEFAULT_PERIOD 997 // Prime, to not beat with program loops
+#define PCS_DEFAULT_TOP 16
+#define PCS_MAX_TOP 64
+
+void _pcsStart(uint32 period) {
+    pcsPeriod = period ? period : PCS_DEFAULT_PERIOD;
+    pcsCountdown = pcsPeriod;
+}
+
+void _pcsStop(void) {
+    pcsPeriod = 0;
+}
+
+void _pcsClear(void) {
+    memset(pcsCounts, 0, sizeof(pcsCounts));
+    memset(pcsLastPC, 0, sizeof(pcsLastPC));
+}
+
+uint32 _pcsTotal(void) {
+    uint32 total = 0;
+
+    for (uint16 i = 0; i < PCS_BUCKETS; ++i)
+        total += pcsCounts[i];
+    return total;
+}
+
+// Prints the top busiest buckets, the most sampled first
+void _pcsReport(uint8 top) {
+    uint32 total = _pcsTotal();
+    uint32 lastCount = 0xffffffff;
+    int32 lastBucket = -1;
+    char line[48];
+
+    sprintf(line, "Sampler is %s, %lu samples", pcsPeriod ? "on" : "off", (unsigned long)total);
+    _puts(line);
+    if (pcsPeriod) {
+        sprintf(line, ", 1 every %lu instructions", (unsigned long)pcsPeriod);
+        _puts(line);
+    }
+    _puts("\r\n");
+    if (!total)
+        return;
+    if (top > PCS_MAX_TOP)
+        top = PCS_MAX_TOP;
+
+    _puts("Bucket     Samples     %  Sample address\r\n");
+    while (top--) {
+        int32 best = -1;
+
+        // Next bucket in (count descending, address ascending) order
+        for (int32 i = 0; i < PCS_BUCKETS; ++i) {
+            uint32 c = pcsCounts[i];
+            if (!c || c > lastCount || (c == lastCount && i <= lastBucket))
+                continue;
+            if (best < 0 || c > pcsCounts[best])
+                best = i;
+        }
+        if (best < 0)
+            break;
+        lastCount = pcsCounts[best];
+        lastBucket = best;
+
+        _puthex16(best << PCS_SHIFT);
+        _putcon('-');
+        _puthex16(((best + 1) << PCS_SHIFT) - 1);
+        sprintf(line, " %8lu %5.1f  ", (unsigned long)lastCount, 100.0 * lastCount / total);
+        _puts(line);
+        _puthex16(pcsLastPC[best]);
+        _puts(": ");
+        Disasm(pcsLastPC[best]);
+        _puts("\r\n");
+    }
+}
+
+// Writes the non empty buckets to a text file, returns FALSE if it could not be created
+uint8 _pcsSave(uint8 *filename) {
+    FILE *file = _sys_fopen_w(filename);
+    char line[32];
+
+    if (file == NULL)
+        return FALSE;
+    for (uint16 i = 0; i < PCS_BUCKETS; ++i) {
+        if (!pcsCounts[i])
+            continue;
+        sprintf(line, "%04X,%04X,%lu,%04X\r\n", i << PCS_SHIFT, ((i + 1) << PCS_SHIFT) - 1,
+                (unsigned long)pcsCounts[i], pcsLastPC[i]);
+        fputs(line, file);
+    }
+    _sys_fputc(0x1a, file); // CP/M end of text
+    _sys_fclose(file);
+    return TRUE;
+}
+
+#endif // SAMPLER_H
@@ -0,0 +1,403 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/* Hibernation, saves the whole machine to the SNAPSHOT file and resumes it on the next boot
+
+   F10, the SUSPEND command or the host BDOS call (see host.h) hibernate. A
+   program is stopped at a BDOS or BIOS call, either the next one it makes or
+   the console input it is waiting on, and the snapshot holds the registers
+   as they were when the call was made. On resume the call is made again,
+   which is harmless as the BDOS and BIOS only act once they have the input.
+   Hibernating at the CCP prompt resumes at the prompt.
+
+    The file is a header followed by the 64K of RAM. The header has the Z80
+    registers, the BDOS state (drive, user, DMA, the directory search in
+    progress), the CCP state, the PUN:/LST: files in use, whether the overlay
+    is on and the screen text and cursor. The lines of a native SUBMIT not run
+    yet are written to $$$.SUB first, where the CCP carries on with them after
+    the resume. The RAM is stored raw, in one write, or run length encoded in
+    4K pieces. Either way the transfers are whole sectors, which fat32.c moves
+    in multi block SD commands. A snapshot from another build or format
+    version is refused, and it is deleted once restored so that the next power
+    cycle is a cold boot again.
+*/
+
+#define SNAP_MAGIC "RunCPMSn"
+#define SNAP_VERSION 2
+#define SNAP_RLE 0x01   // RAM is run length encoded
+#define SNAP_GUEST 0x02 // A program was running, the registers are valid
+#ifndef SNAP_CHUNK
+#define SNAP_CHUNK 4096 // Run length encoded RAM is written and read in pieces of this size, 512 at least
+#endif
+
+typedef struct {
+    char magic[8];
+    uint16 version;
+    uint16 flags;
+    char build[24]; // __DATE__ " " __TIME__ of the firmware that saved it
+    uint32 ramBytes; // Size of the RAM image that follows
+    uint32 ramSum;   // Sum of its bytes
+
+    // Z80
+    int32 AF, BC, DE, HL, IX, IY, PC, SP, AF1, BC1, DE1, HL1, IFF, IR;
+
+    // BDOS
+    uint8 filename[17], newname[17], fcbname[13], pattern[13];
+    uint16 dmaAddr, roVector, loginVector;
+    uint8 oDrive, cDrive, userCode, allUsers, allExtents, currFindUser, mask8bit;
+    uint8 blockShift, blockMask, extentMask, extentsPerDirEntry;
+    uint16 firstBlockAfterDir, numAllocBlocks, physicalExtentBytes;
+    uint16 cpuDelayInstructions;
+    uint16 fileRecords, fileExtents, fileExtentsUsed, firstFreeAllocBlock;
+    fat32_file_t fat_dir;
+    char fat_dir_fullpath[6];
+    uint8 fat_dir_open;
+    uint8 punOpen, lstOpen;
+    uint8 overlayOn;
+
+    // CCP
+    uint8 currentDrive, currentUser, submitFlag, submitRecords, pageSize;
+
+    display_state_t display;
+} SnapHeader;
+
+#define SNAP_HEADER_BYTES ((sizeof(SnapHeader) + 511) & ~511) // The RAM image starts on a sector
+
+static SnapHeader snap;              // The header being saved or restored
+static uint8 snapChunk[SNAP_CHUNK];  // Run length encoded RAM
+static uint16 snapChunkLen;
+
+// Called on entry of every BDOS and BIOS call, returns TRUE if the machine was hibernated instead
+uint8 _snapTrap(void) {
+    if (!snapGuest)
+        return FALSE;
+    // The registers as the program made the call, as the BDOS changes them before waiting for a key
+    snap.AF = AF;
+    snap.BC = BC;
+    snap.DE = DE;
+    snap.HL = HL;
+    snap.IX = IX;
+    snap.IY = IY;
+    snap.PC = PCX; // The RST (or OUT) instruction, to make the call again
+#ifdef INT_HANDOFF
+    snap.SP = (SP + 2) & 0xffff; // Without the return address pushed by the RST
+#else
+    snap.SP = SP;
+#endif
+    snap.AF1 = AF1;
+    snap.BC1 = BC1;
+    snap.DE1 = DE1;
+    snap.HL1 = HL1;
+    snap.IFF = IFF;
+    snap.IR = IR;
+    return (user_hibernate && _snapHibernate(TRUE));
+} // _snapTrap
+
+uint32 _snapSum(const uint8 *data, uint32 size) {
+    uint32 sum = 0;
+
+    while (size--)
+        sum += *data++;
+    return (sum);
+} // _snapSum
+
+void _snapFlush(FILE *file, uint8 *ok) {
+    if (snapChunkLen && _sys_fwrite(snapChunk, 1, snapChunkLen, file) != snapChunkLen)
+        *ok = FALSE;
+    snap.ramBytes += snapChunkLen;
+    snap.ramSum += _snapSum(snapChunk, snapChunkLen);
+    snapChunkLen = 0;
+} // _snapFlush
+
+// Run length encodes the RAM, as PackBits: n = 0-127 is followed by n+1 bytes as they are,
+// n = 129-255 by one byte repeated 257-n times
+uint8 _snapWriteRLE(FILE *file) {
+    uint8 ok = TRUE;
+    uint32 pos = 0;
+
+    snapChunkLen = 0;
+    while (pos < MEMSIZE) {
+        uint32 run = 1;
+        while (pos + run < MEMSIZE && run < 128 && RAM[pos + run] == RAM[pos])
+            ++run;
+        if (snapChunkLen > SNAP_CHUNK - 130)
+            _snapFlush(file, &ok);
+        if (run > 2) {
+            snapChunk[snapChunkLen++] = 257 - run;
+            snapChunk[snapChunkLen++] = RAM[pos];
+            pos += run;
+        } else {
+            uint32 start = pos;
+            // Literal bytes up to the next run of three
+            while (pos < MEMSIZE && pos - start < 128 &&
+                   !(pos + 2 < MEMSIZE && RAM[pos] == RAM[pos + 1] && RAM[pos] == RAM[pos + 2]))
+                ++pos;
+            snapChunk[snapChunkLen++] = pos - start - 1;
+            memcpy(&snapChunk[snapChunkLen], &RAM[start], pos - start);
+            snapChunkLen += pos - start;
+        }
+    }
+    _snapFlush(file, &ok);
+    return (ok);
+} // _snapWriteRLE
+
+uint8 _snapReadRLE(FILE *file) {
+    uint32 pos = 0, stored = 0, next = 0, sum = 0;
+    uint8 n, c;
+
+#define SNAP_NEXT(b)                                                          \
+    if (next == snapChunkLen) {                                           \
+        snapChunkLen = _sys_fread(snapChunk, 1, MIN(SNAP_CHUNK, snap.ramBytes - stored), file); \
+        stored += snapChunkLen;                                           \
+        sum += _snapSum(snapChunk, snapChunkLen);                         \
+        next = 0;                                                         \
+        if (!snapChunkLen)                                                \
+            return (FALSE);                                               \
+    }                                                                     \
+    b = snapChunk[next++]
+
+    snapChunkLen = 0;
+    while (pos < MEMSIZE) {
+        SNAP_NEXT(n);
+        if (n < 128) {
+            if (pos + n + 1 > MEMSIZE)
+                return (FALSE);
+            for (uint16 i = 0; i <= n; ++i) {
+                SNAP_NEXT(RAM[pos++]);
+            }
+        } else if (n > 128) {
+            SNAP_NEXT(c);
+            if (pos + 257 - n > MEMSIZE)
+                return (FALSE);
+            memset(&RAM[pos], c, 257 - n);
+            pos += 257 - n;
+        }
+    }
+#undef SNAP_NEXT
+    return (stored == snap.ramBytes && sum == snap.ramSum);
+} // _snapReadRLE
+
+// Writes the snapshot, returns FALSE if it could not be written
+uint8 _snapSave(uint8 compress) {
+    FILE *file;
+    uint8 ok;
+
+    memcpy(snap.magic, SNAP_MAGIC, sizeof(snap.magic));
+    snap.version = SNAP_VERSION;
+    snap.flags = (compress ? SNAP_RLE : 0) | (snapGuest ? SNAP_GUEST : 0);
+    strncpy(snap.build, __DATE__ " " __TIME__, sizeof(snap.build));
+    snap.ramBytes = 0;
+    snap.ramSum = 0;
+
+    memcpy(snap.filename, filename, sizeof(snap.filename));
+    memcpy(snap.newname, newname, sizeof(snap.newname));
+    memcpy(snap.fcbname, fcbname, sizeof(snap.fcbname));
+    memcpy(snap.pattern, pattern, sizeof(snap.pattern));
+    snap.dmaAddr = dmaAddr;
+    snap.roVector = roVector;
+    snap.loginVector = loginVector;
+    snap.oDrive = oDrive;
+    snap.cDrive = cDrive;
+    snap.userCode = userCode;
+    snap.allUsers = allUsers;
+    snap.allExtents = allExtents;
+    snap.currFindUser = currFindUser;
+    snap.mask8bit = mask8bit;
+    snap.blockShift = blockShift;
+    snap.blockMask = blockMask;
+    snap.extentMask = extentMask;
+    snap.extentsPerDirEntry = extentsPerDirEntry;
+    snap.firstBlockAfterDir = firstBlockAfterDir;
+    snap.numAllocBlocks = numAllocBlocks;
+    snap.physicalExtentBytes = physicalExtentBytes;
+    snap.cpuDelayInstructions = cpuDelayInstructions;
+    snap.fileRecords = fileRecords;
+    snap.fileExtents = fileExtents;
+    snap.fileExtentsUsed = fileExtentsUsed;
+    snap.firstFreeAllocBlock = firstFreeAllocBlock;
+    snap.fat_dir = fat_dir;
+    memcpy(snap.fat_dir_fullpath, fat_dir_fullpath, sizeof(snap.fat_dir_fullpath));
+    snap.fat_dir_open = fat_dir_open;
+    snap.punOpen = snap.lstOpen = FALSE;
+    snap.overlayOn = FALSE;
+#ifdef OVERLAY
+    snap.overlayOn = overlayOn; // The program goes on writing to the overlay
+#endif
+#ifdef USE_PUN
+    if (pun_dev)
+        _sys_fflush(pun_dev);
+    snap.punOpen = pun_open && pun_dev;
+#endif
+#ifdef USE_LST
+    if (lst_dev)
+        _sys_fflush(lst_dev);
+    snap.lstOpen = lst_open && lst_dev;
+#endif
+
+    if (submitEnd) { // The rest of a native SUBMIT goes on from $$$.SUB, as after a warm boot
+        _ccp_submitSave();
+        if (!snapGuest) { // The CCP reads it next, a program warm boots first
+            _CheckSUB();
+            _ccp_batchFCB();
+        }
+    }
+    snap.currentDrive = currentDrive;
+    snap.currentUser = currentUser;
+    snap.submitFlag = submitFlag;
+    snap.submitRecords = submitRecords;
+    snap.pageSize = pageSize;
+
+    display_save_state(&snap.display);
+
+    if (_SyncDisks()) // The card as the program left it, the machine stops after this
+        return (FALSE);
+    file = _sys_fopen_w((uint8 *)SNAPSHOT);
+    if (!file)
+        return (FALSE);
+    // The header is written twice, first to hold the place, then with the size of the RAM image
+    memset(snapChunk, 0, SNAP_HEADER_BYTES - sizeof(snap));
+    ok = _sys_fwrite(&snap, 1, sizeof(snap), file) == sizeof(snap) &&
+         _sys_fwrite(snapChunk, 1, SNAP_HEADER_BYTES - sizeof(snap), file) == SNAP_HEADER_BYTES - sizeof(snap);
+    if (ok && compress) {
+        ok = _snapWriteRLE(file);
+    } else if (ok) {
+        ok = _sys_fwrite(RAM, 1, MEMSIZE, file) == MEMSIZE;
+        snap.ramBytes = MEMSIZE;
+        snap.ramSum = _snapSum(RAM, MEMSIZE);
+    }
+    ok = ok && !_sys_fseek(file, 0, SEEK_SET) && _sys_fwrite(&snap, 1, sizeof(snap), file) == sizeof(snap);
+    _sys_fclose(file);
+    if (!ok)
+        _sys_remove((uint8 *)SNAPSHOT);
+    return (ok);
+} // _snapSave
+
+// Saves the machine and stops it, returns FALSE if the snapshot could not be written
+uint8 _snapHibernate(uint8 compress) {
+    user_hibernate = FALSE;
+    if (!_snapSave(compress)) {
+        _puts("\r\nUnable to save " SNAPSHOT "\r\n");
+        return (FALSE);
+    }
+    snapHibernated = TRUE;
+    Status = STATUS_EXIT;
+    _puts("\r\nHibernated, the next boot resumes here\r\n");
+    return (TRUE);
+} // _snapHibernate
+
+// Reads and checks the snapshot, returns FALSE if there is none or it cannot be used
+uint8 _snapLoad(void) {
+    FILE *file = _sys_fopen_r((uint8 *)SNAPSHOT);
+    uint8 ok;
+
+    if (!file)
+        return (FALSE);
+    ok = _sys_fread(&snap, 1, sizeof(snap), file) == sizeof(snap) &&
+         !memcmp(snap.magic, SNAP_MAGIC, sizeof(snap.magic)) && snap.version == SNAP_VERSION &&
+         !strncmp(snap.build, __DATE__ " " __TIME__, sizeof(snap.build)) &&
+         !_sys_fseek(file, SNAP_HEADER_BYTES, SEEK_SET);
+    if (ok) {
+        if (snap.flags & SNAP_RLE)
+            ok = _snapReadRLE(file);
+        else
+            ok = snap.ramBytes == MEMSIZE && _sys_fread(RAM, 1, MEMSIZE, file) == MEMSIZE &&
+                 _snapSum(RAM, MEMSIZE) == snap.ramSum;
+        if (!ok)
+            _PatchCPM(); // Part of the RAM may have been overwritten
+    }
+    _sys_fclose(file);
+    _sys_remove((uint8 *)SNAPSHOT); // Resumed once only
+    return (ok);
+} // _snapLoad
+
+// Restores the machine from the snapshot and runs the program that was running, if any.
+// Returns FALSE if there is no usable snapshot
+uint8 _snapResume(void) {
+    snapResumed = FALSE;
+    if (!_snapLoad()) {
+        _puts("\r\n" SNAPSHOT " is from another build or damaged, starting afresh\r\n");
+        return (FALSE);
+    }
+
+    memcpy(filename, snap.filename, sizeof(filename));
+    memcpy(newname, snap.newname, sizeof(newname));
+    memcpy(fcbname, snap.fcbname, sizeof(fcbname));
+    memcpy(pattern, snap.pattern, sizeof(pattern));
+    dmaAddr = snap.dmaAddr;
+    roVector = snap.roVector;
+    loginVector = snap.loginVector;
+    oDrive = snap.oDrive;
+    cDrive = snap.cDrive;
+    userCode = snap.userCode;
+    allUsers = snap.allUsers;
+    allExtents = snap.allExtents;
+    currFindUser = snap.currFindUser;
+    mask8bit = snap.mask8bit;
+    blockShift = snap.blockShift;
+    blockMask = snap.blockMask;
+    extentMask = snap.extentMask;
+    extentsPerDirEntry = snap.extentsPerDirEntry;
+    firstBlockAfterDir = snap.firstBlockAfterDir;
+    numAllocBlocks = snap.numAllocBlocks;
+    physicalExtentBytes = snap.physicalExtentBytes;
+    cpuDelayInstructions = snap.cpuDelayInstructions;
+    fileRecords = snap.fileRecords;
+    fileExtents = snap.fileExtents;
+    fileExtentsUsed = snap.fileExtentsUsed;
+    firstFreeAllocBlock = snap.firstFreeAllocBlock;
+    fat_dir = snap.fat_dir;
+    memcpy(fat_dir_fullpath, snap.fat_dir_fullpath, sizeof(fat_dir_fullpath));
+    fat_dir_open = snap.fat_dir_open;
+#ifdef OVERLAY
+    overlayOn = snap.overlayOn;
+#endif
+#ifdef USE_PUN
+    if (snap.punOpen) {
+        pun_dev = _sys_fopen_a((uint8 *)pun_file); // Carries on where the output was
+        pun_open = TRUE;
+    }
+#endif
+#ifdef USE_LST
+    if (snap.lstOpen) {
+        lst_dev = _sys_fopen_a((uint8 *)lst_file);
+        lst_open = TRUE;
+    }
+#endif
+
+    currentDrive = snap.currentDrive;
+    currentUser = snap.currentUser;
+    submitFlag = snap.submitFlag;
+    submitRecords = snap.submitRecords;
+    pageSize = snap.pageSize;
+    firstBoot = FALSE;
+    bufferLen = 0;
+
+    display_restore_state(&snap.display);
+
+    if (snap.flags & SNAP_GUEST) {
+        AF = snap.AF;
+        BC = snap.BC;
+        DE = snap.DE;
+        HL = snap.HL;
+        IX = snap.IX;
+        IY = snap.IY;
+        PC = snap.PC;
+        SP = snap.SP;
+        AF1 = snap.AF1;
+        BC1 = snap.BC1;
+        DE1 = snap.DE1;
+        HL1 = snap.HL1;
+        IFF = snap.IFF;
+        IR = snap.IR;
+
+        // As _ccp_ext runs a program
+        snapGuest = TRUE;
+        Z80run(cpuDelayInstructions);
+        snapGuest = FALSE;
+        PC = 0;
+        SP = 0;
+    }
+    return (TRUE);
+} // _snapResume
+
+#endif // SNAPSHOT_H
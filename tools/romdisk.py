@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+#
+#  RunCPM flash drive builder
+#
+#  Packs CP/M files into a C source, to be linked into the firmware as the
+#  read-only flash drive (see drivers/romdisk.h and romdisk.cmake). The
+#  directory is sorted by name here, so the firmware finds a file by binary
+#  search, and the files follow it back to back, each padded with ^Z to a
+#  whole number of 128 byte records as CP/M reads them.
+#
+#  Usage:
+#    romdisk.py --out romdisk.c FILE...
+#
+
+import argparse
+import os
+
+RECORD = 128
+
+
+def host_name(path):
+    # The 8.3 name CP/M sees, in upper case as _FCBtoHostname builds it
+    base, ext = os.path.splitext(os.path.basename(path).upper())
+    ext = ext[1:]
+    if not base or len(base) > 8 or len(ext) > 3 or any(c in base + ext for c in ' .*?/'):
+        raise SystemExit('romdisk: %s is not an 8.3 name' % path)
+    return base + ('.' + ext if ext else '')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack CP/M files into the flash drive of the firmware')
+    parser.add_argument('files', nargs='*', metavar='FILE')
+    parser.add_argument('--out', required=True, help='C source to write')
+    args = parser.parse_args()
+
+    files = {}
+    for path in args.files:
+        name = host_name(path)
+        if name in files:
+            raise SystemExit('romdisk: %s is given twice' % name)
+        with open(path, 'rb') as file:
+            files[name] = file.read()
+
+    data = bytearray()
+    directory = []
+    for name in sorted(files):
+        body = files[name]
+        directory.append((name, len(data), len(body)))
+        data += body + b'\x1a' * (-len(body) % RECORD)
+
+    lines = ['// Generated by tools/romdisk.py, do not edit', '',
+             '#include "drivers/romdisk.h"', '',
+             'const romdisk_file_t romdisk_files[] = {']
+    lines += ['    {"%s", %d, %d},' % entry for entry in directory]
+    if not directory:
+        lines.append('    {"", 0, 0},')
+    lines += ['};', '', 'const uint16_t romdisk_count = %d;' % len(directory), '',
+              'const uint8_t romdisk_data[] = {']
+    for i in range(0, len(data), 16):
+        lines.append('    ' + ' '.join('0x%02x,' % b for b in data[i:i + 16]))
+    if not data:
+        lines.append('    0x1a,')
+    lines.append('};')
+
+    text = '\n'.join(lines) + '\n'
+    # Written only when changed, so that a reconfigure does not relink
+    if not os.path.exists(args.out) or open(args.out).read() != text:
+        with open(args.out, 'w') as file:
+            file.write(text)
+    print('romdisk: %d files, %d bytes of flash' % (len(directory), len(data)))
+
+
+if __name__ == '__main__':
+    main()